@@ -0,0 +1,286 @@
+#include "asset_conversion.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <optional>
+
+#include <cel2clx.hpp>
+#include <cl22clx.hpp>
+#include <pcx2clx.hpp>
+
+#include "auto_crop.hpp"
+#include "dungeon_tiles.hpp"
+#include "extract_spell_icons.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+// Whether `clx` is a single list rather than a sheet, which is what a CL2 or CEL file with frame groups converts to.
+// As in the game, a list is told apart by its last frame offset being its size.
+bool IsClxList(std::span<const uint8_t> clx)
+{
+	if (clx.size() < 4)
+		return false;
+	const uint32_t numFrames = LoadLE32(clx.data());
+	if (clx.size() / 4 < static_cast<size_t>(numFrames) + 2)
+		return false;
+	return LoadLE32(&clx[4 + 4 * static_cast<size_t>(numFrames)]) == clx.size();
+}
+
+// Writes a converted CLX list, cropped first if the command has `--auto-crop`.
+// The crop offsets are written next to it, with the `.crop` extension.
+std::string WriteClxOutput(const ClxCommand &command, std::string_view path, std::vector<uint8_t> &clxData,
+    std::filesystem::path outputPath, EntryStats *stats, const OutputCallback &output)
+{
+	if (command.autoCrop == ClxAutoCrop::None) {
+		output(outputPath, clxData);
+		return "";
+	}
+	std::vector<uint8_t> cropped;
+	std::vector<uint8_t> cropData;
+	std::string error;
+	{
+		const StageTimer timer { stats, Stage::AutoCrop };
+		error = AutoCropClxList(clxData, command.autoCrop, cropped, cropData);
+	}
+	if (!error.empty())
+		return "Failed to crop " + std::string(path) + ": " + error;
+	if (stats != nullptr)
+		stats->noteBuffer(clxData.size() + cropped.size());
+	output(outputPath, cropped);
+	output(outputPath.replace_extension(".crop"), cropData);
+	return "";
+}
+
+std::string ConvertClx(std::string_view path, const ClxCommand &command, std::span<const uint8_t> data,
+    std::vector<uint8_t> &clxData, EntryStats *stats, std::filesystem::path outputPath, const OutputCallback &output)
+{
+	const auto conversionError = [path](const dvl_gfx::IoError &error) {
+		return "Failed CL2->CLX conversion: " + error.message + " " + std::string(path);
+	};
+	outputPath.replace_extension(".clx");
+	switch (command.kind) {
+	case ClxCommandKind::Cl2ToClx: {
+		clxData.clear();
+		std::optional<dvl_gfx::IoError> clxError;
+		{
+			const StageTimer timer { stats, Stage::Cl2ToClx };
+			clxError = dvl_gfx::Cl2ToClx(data.data(), data.size(), command.widths.data(), command.widths.size(), clxData);
+		}
+		if (clxError.has_value())
+			return conversionError(*clxError);
+		output(outputPath, clxData);
+		return "";
+	}
+	case ClxCommandKind::CelToClx: {
+		if (command.transform == ClxFrameTransform::SpellIcons) {
+			std::vector<uint8_t> iconBackground;
+			std::vector<uint8_t> iconsWithoutBackground;
+			std::string extractError;
+			{
+				const StageTimer timer { stats, Stage::SpellIcons };
+				extractError = ExtractSpellIcons(data, command.widths, iconBackground, iconsWithoutBackground);
+			}
+			if (!extractError.empty())
+				return "Failed to extract spell icons from " + std::string(path) + ": " + extractError;
+			const std::string stem = outputPath.stem().string();
+			output(outputPath.replace_filename(stem + "_bg.clx"), iconBackground);
+			output(outputPath.replace_filename(stem + "_fg.clx"), iconsWithoutBackground);
+			if (stats != nullptr)
+				stats->noteBuffer(iconBackground.size() + iconsWithoutBackground.size());
+			return "";
+		}
+		clxData.clear();
+		std::optional<dvl_gfx::IoError> clxError;
+		{
+			const StageTimer timer { stats, Stage::CelToClx };
+			clxError = dvl_gfx::CelToClx(data.data(), data.size(), command.widths.data(), command.widths.size(), clxData);
+		}
+		if (clxError.has_value())
+			return conversionError(*clxError);
+		return WriteClxOutput(command, path, clxData, outputPath, stats, output);
+	}
+	case ClxCommandKind::PcxToClx: {
+		clxData.clear();
+		std::array<uint8_t, 256 * 3> paletteData;
+		std::optional<dvl_gfx::IoError> clxError;
+		{
+			const StageTimer timer { stats, Stage::PcxToClx };
+			clxError = dvl_gfx::PcxToClx(data.data(), data.size(), command.numFrames, command.transparentColor,
+			    /*cropWidths=*/ {}, clxData, command.exportPalette ? paletteData.data() : nullptr);
+		}
+		if (clxError.has_value())
+			return conversionError(*clxError);
+		if (std::string error = WriteClxOutput(command, path, clxData, outputPath, stats, output); !error.empty())
+			return error;
+		if (command.exportPalette)
+			output(outputPath.replace_extension(".pal"), paletteData);
+		return "";
+	}
+	case ClxCommandKind::DedupTiles:
+		break;
+	}
+	return "Internal error: " + std::string(command.description) + " is not a single file conversion";
+}
+
+} // namespace
+
+bool IsWavFile(std::string_view mpqPath)
+{
+	if (mpqPath.size() < 4)
+		return false;
+	std::string ext { mpqPath.substr(mpqPath.size() - 4) };
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) {
+		return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	});
+	return ext == ".wav";
+}
+
+std::string DefaultCombinedClxFilename(std::string_view firstPath)
+{
+	std::string outputFilename = std::filesystem::path(firstPath).stem().string();
+	size_t numSuffixLength = 0;
+	while (numSuffixLength < outputFilename.size()) {
+		const char c = outputFilename[outputFilename.size() - numSuffixLength - 1];
+		if (c < '0' || c > '9')
+			break;
+		++numSuffixLength;
+	}
+	outputFilename.resize(outputFilename.size() - numSuffixLength);
+	outputFilename.append(".clx");
+	return outputFilename;
+}
+
+std::string CombinedClxPath(const ClxCombineGroup &group)
+{
+	if (!group.outputName.empty())
+		return std::string(group.outputName);
+	const std::filesystem::path firstFile { group.files[0] };
+	return (firstFile.parent_path() / DefaultCombinedClxFilename(group.files[0])).generic_string();
+}
+
+EntryConversion GetEntryConversion(std::string_view mpqPath, const ClxCommand *command, AudioCodec audioCodec)
+{
+	if (command != nullptr)
+		return EntryConversion::Clx;
+	if (audioCodec != AudioCodec::Copy && IsWavFile(mpqPath))
+		return EntryConversion::Audio;
+	return EntryConversion::Extract;
+}
+
+std::string ConvertEntry(std::string_view path, const ClxCommand *command, AudioCodec audioCodec,
+    std::span<const uint8_t> data, std::vector<uint8_t> &buffer, EntryStats *stats, const OutputCallback &output)
+{
+	if (stats != nullptr) {
+		stats->inputSize = data.size();
+		stats->noteBuffer(data.size());
+	}
+	const std::filesystem::path outputPath { path };
+	std::string error;
+	switch (GetEntryConversion(path, command, audioCodec)) {
+	case EntryConversion::Clx:
+		error = ConvertClx(path, *command, data, buffer, stats, outputPath, output);
+		break;
+	case EntryConversion::Audio:
+		{
+			const StageTimer timer { stats, Stage::Audio };
+			error = EncodeWav(data, audioCodec, buffer);
+		}
+		if (!error.empty())
+			return "Failed to encode " + std::string(path) + ": " + error;
+		// Kept as is if re-encoding does not apply.
+		output(outputPath, buffer.empty() ? data : std::span<const uint8_t>(buffer));
+		break;
+	case EntryConversion::Extract:
+		output(outputPath, data);
+		break;
+	}
+	if (stats != nullptr)
+		stats->noteBuffer(buffer.size());
+	return error;
+}
+
+std::vector<std::filesystem::path> EntryOutputPaths(std::string_view path, const ClxCommand *command)
+{
+	std::filesystem::path outputPath { path };
+	if (command == nullptr)
+		return { outputPath };
+	outputPath.replace_extension(".clx");
+	if (command->kind == ClxCommandKind::CelToClx && command->transform == ClxFrameTransform::SpellIcons) {
+		const std::string stem = outputPath.stem().string();
+		return { outputPath.parent_path() / (stem + "_bg.clx"), outputPath.parent_path() / (stem + "_fg.clx") };
+	}
+	std::vector<std::filesystem::path> result { outputPath };
+	if (command->kind != ClxCommandKind::Cl2ToClx && command->autoCrop != ClxAutoCrop::None)
+		result.push_back(std::filesystem::path(outputPath).replace_extension(".crop"));
+	if (command->kind == ClxCommandKind::PcxToClx && command->exportPalette)
+		result.push_back(std::filesystem::path(outputPath).replace_extension(".pal"));
+	return result;
+}
+
+std::string ConvertCombineGroupMember(const ClxCombineGroup &group, size_t member,
+    std::span<const uint8_t> input, std::vector<uint8_t> &clxData)
+{
+	const ClxCommand &command = *group.commands[member];
+	clxData.clear();
+	std::optional<dvl_gfx::IoError> clxError;
+	switch (command.kind) {
+	case ClxCommandKind::Cl2ToClx:
+		clxError = dvl_gfx::Cl2ToClx(input.data(), input.size(), command.widths.data(), command.widths.size(), clxData);
+		break;
+	case ClxCommandKind::CelToClx:
+		clxError = dvl_gfx::CelToClx(input.data(), input.size(), command.widths.data(), command.widths.size(), clxData);
+		break;
+	case ClxCommandKind::PcxToClx:
+		clxError = dvl_gfx::PcxToClx(input.data(), input.size(), command.numFrames, command.transparentColor,
+		    /*cropWidths=*/ {}, clxData, /*outPalette=*/nullptr);
+		break;
+	case ClxCommandKind::DedupTiles:
+		clxError = dvl_gfx::IoError { "not a CLX conversion: " + std::string(command.description) };
+		break;
+	}
+	if (clxError.has_value())
+		return "Failed combined CLX conversion: " + clxError->message + " " + std::string(group.files[member]);
+	// The sheet would store a nested sheet as if it were a list.
+	if (!IsClxList(clxData))
+		return "Files with frame groups cannot be combined: " + std::string(group.files[member]);
+	return "";
+}
+
+std::string ConvertDedupTilesGroup(const ClxCombineGroup &group, std::span<const uint8_t> cel, std::span<const uint8_t> min,
+    EntryStats *stats, const OutputCallback &output)
+{
+	std::vector<uint8_t> celOut;
+	std::vector<uint8_t> minOut;
+	std::string error;
+	{
+		const StageTimer timer { stats, Stage::DedupTiles };
+		error = DedupDungeonTiles(cel, min, celOut, minOut);
+	}
+	if (!error.empty())
+		return "Failed to deduplicate the tiles of " + std::string(group.files[0]) + ": " + error;
+	if (stats != nullptr) {
+		stats->inputSize = cel.size() + min.size();
+		stats->noteBuffer(stats->inputSize + celOut.size() + minOut.size());
+	}
+	output(group.files[0], celOut);
+	output(group.files[1], minOut);
+	return "";
+}
+
+std::vector<std::filesystem::path> GroupOutputPaths(const ClxCombineGroup &group)
+{
+	if (group.command->kind == ClxCommandKind::DedupTiles)
+		return { group.files[0], group.files[1] };
+	return { CombinedClxPath(group) };
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "clx_commands.hpp"
+#include "stats.hpp"
+#include "wav_encoder.hpp"
+
+namespace devilution_mpq_tools {
+
+// The conversion of the MPQ entries into the output files, shared by `unpack_and_minify_mpq`
+// and `AssetLibrary`.
+//
+// The output paths are relative to the output directory of the MPQ, with `/` as the separator.
+// The functions that can fail return an error message, including the path of the entry.
+
+// Receives an output of a conversion.
+using OutputCallback = std::function<void(const std::filesystem::path &path, std::span<const uint8_t> data)>;
+
+bool IsWavFile(std::string_view mpqPath);
+
+// The name of the sheet of a combine group without `--output`: the name of the first file
+// without its numeric suffix, with the `.clx` extension.
+std::string DefaultCombinedClxFilename(std::string_view firstPath);
+
+// The path of the sheet of a combine group.
+std::string CombinedClxPath(const ClxCombineGroup &group);
+
+// How a single entry is converted.
+enum class EntryConversion : uint8_t {
+	Clx,
+	Audio,
+	Extract,
+};
+
+// `command` is the entry's CLX command, or null if it has none.
+EntryConversion GetEntryConversion(std::string_view mpqPath, const ClxCommand *command, AudioCodec audioCodec);
+
+// Converts (or extracts) a single entry that is not part of a group.
+// `path` is the path of the entry, with `/` as the separator.
+// `buffer` holds the intermediate data, and can be reused across calls.
+//
+// `stats` is null if stats are disabled.
+std::string ConvertEntry(std::string_view path, const ClxCommand *command, AudioCodec audioCodec,
+    std::span<const uint8_t> data, std::vector<uint8_t> &buffer, EntryStats *stats, const OutputCallback &output);
+
+// The paths of the outputs `ConvertEntry` produces.
+std::vector<std::filesystem::path> EntryOutputPaths(std::string_view path, const ClxCommand *command);
+
+// Converts the `member`-th file of a combine group into a CLX list, to be added to the sheet.
+// Fails for files with frame groups, which convert to a sheet instead.
+std::string ConvertCombineGroupMember(const ClxCombineGroup &group, size_t member,
+    std::span<const uint8_t> input, std::vector<uint8_t> &clxData);
+
+// Deduplicates the frames of the CEL of a dedup-tiles group and rewrites its MIN, see dungeon_tiles.hpp.
+std::string ConvertDedupTilesGroup(const ClxCombineGroup &group, std::span<const uint8_t> cel, std::span<const uint8_t> min,
+    EntryStats *stats, const OutputCallback &output);
+
+// The paths of the outputs of a group: its sheet, or the CEL and the MIN of a dedup-tiles group.
+std::vector<std::filesystem::path> GroupOutputPaths(const ClxCombineGroup &group);
+
+} // namespace devilution_mpq_tools
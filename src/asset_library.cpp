@@ -0,0 +1,280 @@
+#include "asset_library.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <span>
+#include <utility>
+
+#include "asset_conversion.hpp"
+#include "clx_commands.hpp"
+#include "clx_sheet_builder.hpp"
+#include "mpq_archive.hpp"
+#include "mpq_reader.hpp"
+#include "mpq_sources.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+std::string WithForwardSlashes(std::string_view path)
+{
+	std::string result { path };
+	std::replace(result.begin(), result.end(), '\\', '/');
+	return result;
+}
+
+// The key of an asset in the index and the cache.
+std::string AssetKey(std::string_view path)
+{
+	std::string result = WithForwardSlashes(path);
+	std::transform(result.begin(), result.end(), result.begin(), [](char c) {
+		return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	});
+	return result;
+}
+
+} // namespace
+
+struct AssetLibrary::Archive {
+	explicit Archive(const std::filesystem::path &path)
+	    : source(path)
+	{
+	}
+
+	MpqSource source;
+	std::unique_ptr<MpqReader> reader;
+
+	// Guards `archive`, which is not thread-safe.
+	std::mutex mutex;
+	std::unique_ptr<MpqArchive> archive;
+
+	// Reads a file by path, resizing `buf` to its size.
+	std::string read(std::string_view path, std::vector<uint8_t> &buf)
+	{
+		std::string mpqPath { path };
+		std::replace(mpqPath.begin(), mpqPath.end(), '/', '\\');
+		std::string error;
+		{
+			const std::lock_guard<std::mutex> lock { mutex };
+			error = archive->readFile(mpqPath.c_str(), buf);
+		}
+		if (!error.empty())
+			return "Failed to read MPQ file " + mpqPath + ": " + error;
+		return "";
+	}
+};
+
+// What an asset is converted from: a single MPQ entry or a group.
+struct AssetLibrary::Source {
+	Archive *archive;
+	const char *mpqPath;
+
+	// Null if the entry is extracted as is.
+	const ClxCommand *command;
+
+	// Null for a single entry.
+	const ClxCombineGroup *group;
+
+	// Single entries only.
+	uint32_t blockIndex;
+	uint32_t fileKey;
+};
+
+AssetLibrary::AssetLibrary(AssetLibraryOptions options)
+    : options_(options)
+{
+}
+
+AssetLibrary::~AssetLibrary() = default;
+
+std::string AssetLibrary::openArchive(const std::filesystem::path &path)
+{
+	auto archive = std::make_unique<Archive>(path);
+	std::string error;
+	archive->reader = MpqReader::open(path, error);
+	if (archive->reader == nullptr)
+		return "Failed to open MPQ at " + path.string() + ": " + error;
+	archive->archive = std::make_unique<MpqArchive>(path, *archive->reader);
+	error = archive->source.loadListfile(*archive->archive);
+	if (!error.empty())
+		return "Failed to read the listfile of " + path.string() + ": " + error;
+
+	const MpqSource &mpqSource = archive->source;
+	std::vector<uint32_t> blockIndices(mpqSource.mpqFiles.size());
+	archive->reader->findBlocks(mpqSource.mpqFiles.hashes, blockIndices);
+
+	// The index is built without holding the lock, and then merged.
+	std::vector<std::pair<std::string, std::shared_ptr<const Source>>> assets;
+	std::vector<bool> indexedGroups(mpqSource.clxCommands.groups.size());
+	for (size_t i = 0; i < mpqSource.mpqFiles.size(); ++i) {
+		if (blockIndices[i] == MpqReader::NoBlock)
+			continue;
+		const char *mpqPath = mpqSource.mpqFiles.path(i);
+		const ClxCommandEntry *clxEntry = mpqSource.clxCommands.find(mpqPath);
+		std::shared_ptr<const Source> source;
+		std::vector<std::filesystem::path> outputPaths;
+		if (clxEntry != nullptr && clxEntry->group != nullptr) {
+			const size_t groupIndex = clxEntry->group - mpqSource.clxCommands.groups.data();
+			if (indexedGroups[groupIndex])
+				continue;
+			indexedGroups[groupIndex] = true;
+			source = std::make_shared<const Source>(Source { archive.get(), mpqPath, clxEntry->command, clxEntry->group, MpqReader::NoBlock, 0 });
+			outputPaths = GroupOutputPaths(*clxEntry->group);
+		} else {
+			if (mpqSource.isExcluded(mpqPath))
+				continue;
+			const ClxCommand *command = clxEntry != nullptr ? clxEntry->command : nullptr;
+			source = std::make_shared<const Source>(Source { archive.get(), mpqPath, command, nullptr, blockIndices[i], mpqSource.mpqFiles.hashes[i].fileKey });
+			outputPaths = EntryOutputPaths(WithForwardSlashes(mpqPath), command);
+		}
+		for (const std::filesystem::path &outputPath : outputPaths)
+			assets.emplace_back(AssetKey(outputPath.generic_string()), source);
+	}
+
+	const std::lock_guard<std::mutex> lock { mutex_ };
+	const int priority = mpqSource.overlayPriority();
+	for (auto &[key, source] : assets) {
+		const auto [it, inserted] = sources_.try_emplace(key, source);
+		if (inserted || it->second->archive->source.overlayPriority() > priority)
+			continue;
+		it->second = std::move(source);
+		removeFromCache(key);
+	}
+	archives_.push_back(std::move(archive));
+	return "";
+}
+
+bool AssetLibrary::contains(std::string_view path) const
+{
+	const std::lock_guard<std::mutex> lock { mutex_ };
+	return sources_.contains(AssetKey(path));
+}
+
+std::string AssetLibrary::get(std::string_view path, Asset &asset)
+{
+	asset = nullptr;
+	const std::string key = AssetKey(path);
+	std::shared_ptr<const Source> source;
+	{
+		const std::lock_guard<std::mutex> lock { mutex_ };
+		if (const auto it = cache_.find(key); it != cache_.end()) {
+			lru_.splice(lru_.begin(), lru_, it->second);
+			asset = it->second->second;
+			return "";
+		}
+		const auto it = sources_.find(key);
+		if (it == sources_.end())
+			return "No such asset: " + std::string(path);
+		source = it->second;
+	}
+	return convert(*source, key, asset);
+}
+
+std::vector<std::string> AssetLibrary::paths() const
+{
+	const std::lock_guard<std::mutex> lock { mutex_ };
+	std::vector<std::string> result;
+	result.reserve(sources_.size());
+	for (const auto &[key, source] : sources_)
+		result.push_back(key);
+	return result;
+}
+
+size_t AssetLibrary::cachedSize() const
+{
+	const std::lock_guard<std::mutex> lock { mutex_ };
+	return cachedSize_;
+}
+
+std::string AssetLibrary::convert(const Source &source, const std::string &path, Asset &asset)
+{
+	asset = nullptr;
+	std::vector<std::pair<std::string, Asset>> outputs;
+	const OutputCallback output = [&outputs](const std::filesystem::path &outputPath, std::span<const uint8_t> data) {
+		outputs.emplace_back(AssetKey(outputPath.generic_string()), std::make_shared<const std::vector<uint8_t>>(data.begin(), data.end()));
+	};
+
+	Archive &archive = *source.archive;
+	std::string error;
+	std::vector<uint8_t> data;
+	std::vector<uint8_t> buffer;
+	if (source.group == nullptr) {
+		data.resize(archive.archive->fileSize(source.blockIndex));
+		{
+			const std::lock_guard<std::mutex> lock { archive.mutex };
+			error = archive.archive->readFile(source.blockIndex, source.mpqPath, source.fileKey, data.data());
+		}
+		if (!error.empty())
+			return "Failed to read MPQ file " + std::string(source.mpqPath) + ": " + error;
+		error = ConvertEntry(WithForwardSlashes(source.mpqPath), source.command, options_.audioCodec, data, buffer,
+		    /*stats=*/nullptr, output);
+	} else if (source.group->command->kind == ClxCommandKind::DedupTiles) {
+		error = archive.read(source.group->files[0], data);
+		if (error.empty())
+			error = archive.read(source.group->files[1], buffer);
+		if (error.empty())
+			error = ConvertDedupTilesGroup(*source.group, data, buffer, /*stats=*/nullptr, output);
+	} else {
+		const ClxCombineGroup &group = *source.group;
+		ClxSheetBuilder sheet { group.files.size() };
+		for (size_t i = 0; i < group.files.size(); ++i) {
+			error = archive.read(group.files[i], data);
+			if (!error.empty())
+				break;
+			buffer.clear();
+			error = ConvertCombineGroupMember(group, i, data, buffer);
+			if (!error.empty())
+				break;
+			sheet.addList(buffer);
+		}
+		if (error.empty())
+			output(CombinedClxPath(group), sheet.finish());
+	}
+	if (!error.empty())
+		return error;
+
+	const std::lock_guard<std::mutex> lock { mutex_ };
+	for (auto &[key, converted] : outputs) {
+		if (key == path) {
+			asset = converted;
+			continue;
+		}
+		// Only if the MPQ has not been overridden by another one in the meantime.
+		if (const auto it = sources_.find(key); it != sources_.end() && it->second.get() == &source)
+			addToCache(key, std::move(converted));
+	}
+	if (asset == nullptr)
+		return "Internal error: " + path + " is not an output of " + source.mpqPath;
+	// Last, so that it is the most recently used one.
+	if (const auto it = sources_.find(path); it != sources_.end() && it->second.get() == &source)
+		addToCache(path, asset);
+	return "";
+}
+
+void AssetLibrary::addToCache(const std::string &path, Asset asset)
+{
+	removeFromCache(path);
+	const size_t size = asset->size();
+	if (size > options_.cacheSize)
+		return;
+	lru_.emplace_front(path, std::move(asset));
+	cache_[path] = lru_.begin();
+	cachedSize_ += size;
+	while (cachedSize_ > options_.cacheSize) {
+		cachedSize_ -= lru_.back().second->size();
+		cache_.erase(lru_.back().first);
+		lru_.pop_back();
+	}
+}
+
+void AssetLibrary::removeFromCache(const std::string &path)
+{
+	const auto it = cache_.find(path);
+	if (it == cache_.end())
+		return;
+	cachedSize_ -= it->second->second->size();
+	lru_.erase(it->second);
+	cache_.erase(it);
+}
+
+} // namespace devilution_mpq_tools
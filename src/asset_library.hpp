@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "audio_codec.hpp"
+
+namespace devilution_mpq_tools {
+
+struct AssetLibraryOptions {
+	// The maximum total size of the converted assets kept in memory.
+	// Assets larger than this are converted on every request.
+	size_t cacheSize = 64 * 1024 * 1024;
+
+	// How the WAV files are converted.
+	AudioCodec audioCodec = AudioCodec::Copy;
+};
+
+// The minified assets of the game's MPQs, converted on first request instead of being unpacked up front.
+// The `dvl_mpq_tools` library, for embedding the conversion into the game or a launcher.
+//
+// An asset has the same path and contents as the file `unpack_and_minify_mpq` writes for it,
+// relative to the output directory of its MPQ, e.g. "plrgfx/warrior/wla/wlaas.clx".
+// Paths are case-insensitive and accept both `/` and `\` as the separator.
+//
+// The converted assets are kept in a least-recently-used cache bounded by `AssetLibraryOptions::cacheSize`.
+// All the outputs of a conversion are cached, e.g. the `.pal` along with its `.clx`.
+//
+// The methods that can fail return an error message, empty on success.
+//
+// Thread-safe. Assets are converted concurrently, only the reads from the same MPQ take turns.
+// An asset requested by several threads at once may be converted more than once.
+class AssetLibrary {
+public:
+	using Asset = std::shared_ptr<const std::vector<uint8_t>>;
+
+	explicit AssetLibrary(AssetLibraryOptions options = {});
+	~AssetLibrary();
+
+	AssetLibrary(const AssetLibrary &) = delete;
+	AssetLibrary &operator=(const AssetLibrary &) = delete;
+
+	// Opens an MPQ or a save file. Where several MPQs have the same asset, it is converted from the one
+	// the game would load it from: the Hellfire MPQs override the others, and the add-ons override hellfire.mpq.
+	// With equal priorities, the MPQ opened last wins.
+	std::string openArchive(const std::filesystem::path &path);
+
+	[[nodiscard]] bool contains(std::string_view path) const;
+
+	// Sets `asset` to the converted asset, converting it if it is not cached.
+	// The asset stays valid after it is evicted from the cache. On failure, `asset` is reset.
+	std::string get(std::string_view path, Asset &asset);
+
+	// The paths of all the assets, in no particular order.
+	[[nodiscard]] std::vector<std::string> paths() const;
+
+	// The total size of the cached assets.
+	[[nodiscard]] size_t cachedSize() const;
+
+private:
+	struct Archive;
+	struct Source;
+
+	// Converts `source`, caches all its outputs, and sets `asset` to the one at `path`.
+	std::string convert(const Source &source, const std::string &path, Asset &asset);
+
+	// Adds the asset as the most recently used one, evicting the least recently used ones to make room.
+	void addToCache(const std::string &path, Asset asset);
+
+	void removeFromCache(const std::string &path);
+
+	AssetLibraryOptions options_;
+
+	// Guards the index and the cache. Not held while converting.
+	mutable std::mutex mutex_;
+
+	std::vector<std::unique_ptr<Archive>> archives_;
+
+	// The source of every asset, by lowercase path with `/` as the separator.
+	std::unordered_map<std::string, std::shared_ptr<const Source>> sources_;
+
+	// Most recently used first.
+	std::list<std::pair<std::string, Asset>> lru_;
+	std::unordered_map<std::string, std::list<std::pair<std::string, Asset>>::iterator> cache_;
+	size_t cachedSize_ = 0;
+};
+
+} // namespace devilution_mpq_tools
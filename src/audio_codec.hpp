@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+namespace devilution_mpq_tools {
+
+enum class AudioCodec : uint8_t {
+	// The WAV files are extracted as is.
+	Copy,
+
+	// PCM WAV files are re-encoded as IMA ADPCM WAV (4 bits per sample),
+	// which the game decodes when loading the sound.
+	ImaAdpcm,
+};
+
+} // namespace devilution_mpq_tools
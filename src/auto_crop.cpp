@@ -0,0 +1,182 @@
+#include "auto_crop.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <optional>
+
+#include <clx2pixels.hpp>
+#include <clx_decode.hpp>
+
+#include "frame_pipeline.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void AppendLE16(std::vector<uint8_t> &out, unsigned val)
+{
+	out.push_back(static_cast<uint8_t>(val));
+	out.push_back(static_cast<uint8_t>(val >> 8));
+}
+
+void AppendLE32(std::vector<uint8_t> &out, uint32_t val)
+{
+	AppendLE16(out, val & 0xFFFF);
+	AppendLE16(out, val >> 16);
+}
+
+// The opaque part of a frame. `right` and `bottom` are exclusive.
+struct Bounds {
+	unsigned left;
+	unsigned top;
+	unsigned right;
+	unsigned bottom;
+
+	[[nodiscard]] bool empty() const
+	{
+		return left >= right;
+	}
+};
+
+struct FrameInfo {
+	std::span<const uint8_t> data;
+	unsigned width;
+	unsigned height;
+	Bounds bounds;
+};
+
+// Decodes a single CLX frame by wrapping it into a single-frame list.
+class FrameDecoder {
+public:
+	std::string decode(const FrameInfo &frame, uint8_t transparentColor, std::vector<uint8_t> &pixels)
+	{
+		list_.clear();
+		AppendLE32(list_, 1);
+		AppendLE32(list_, 12);
+		AppendLE32(list_, static_cast<uint32_t>(12 + frame.data.size()));
+		list_.insert(list_.end(), frame.data.begin(), frame.data.end());
+		pixels.clear();
+		const std::optional<dvl_gfx::IoError> error = dvl_gfx::Clx2Pixels(list_, transparentColor, pixels);
+		if (error.has_value())
+			return "Failed CLX->Pixels conversion: " + error->message;
+		if (pixels.size() != static_cast<size_t>(frame.width) * frame.height)
+			return "unexpected decoded frame size";
+		return "";
+	}
+
+private:
+	std::vector<uint8_t> list_;
+};
+
+} // namespace
+
+std::string AutoCropClxList(std::span<const uint8_t> clxList, ClxAutoCrop mode,
+    std::vector<uint8_t> &croppedClxList, std::vector<uint8_t> &cropData)
+{
+	if (clxList.size() < 8)
+		return "CLX list is truncated";
+	const uint32_t numFrames = LoadLE32(clxList.data());
+	if (clxList.size() / 4 < static_cast<size_t>(numFrames) + 2
+	    || LoadLE32(&clxList[4]) != 4 * (static_cast<size_t>(numFrames) + 2)
+	    || LoadLE32(&clxList[4 + 4 * static_cast<size_t>(numFrames)]) != clxList.size())
+		return "not a CLX list";
+
+	// A pixel is transparent if it decodes to the transparent color with 2 different transparent colors.
+	// The opaque colors are collected to find a color that is free to be the transparent color when re-encoding.
+	FrameDecoder decoder;
+	std::vector<FrameInfo> frames(numFrames);
+	std::bitset<256> usedColors;
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> otherPixels;
+	for (size_t i = 0; i < numFrames; ++i) {
+		FrameInfo &frame = frames[i];
+		frame.data = dvl_gfx::GetSpriteDataFromClxList(clxList.data(), i);
+		frame.width = dvl_gfx::GetClxSpriteWidth(frame.data.data());
+		frame.height = dvl_gfx::GetClxSpriteHeight(frame.data.data());
+		std::string error = decoder.decode(frame, 0, pixels);
+		if (error.empty())
+			error = decoder.decode(frame, 255, otherPixels);
+		if (!error.empty())
+			return "frame " + std::to_string(i) + ": " + error;
+		frame.bounds = Bounds { frame.width, frame.height, 0, 0 };
+		for (unsigned y = 0; y < frame.height; ++y) {
+			for (unsigned x = 0; x < frame.width; ++x) {
+				const size_t index = static_cast<size_t>(y) * frame.width + x;
+				if (pixels[index] == 0 && otherPixels[index] == 255)
+					continue;
+				usedColors.set(pixels[index]);
+				frame.bounds.left = std::min(frame.bounds.left, x);
+				frame.bounds.top = std::min(frame.bounds.top, y);
+				frame.bounds.right = std::max(frame.bounds.right, x + 1);
+				frame.bounds.bottom = std::max(frame.bounds.bottom, y + 1);
+			}
+		}
+	}
+
+	if (mode == ClxAutoCrop::List) {
+		std::optional<Bounds> listBounds;
+		for (const FrameInfo &frame : frames) {
+			if (frame.width != frames[0].width || frame.height != frames[0].height)
+				return "--auto-crop list requires frames of the same size";
+			if (frame.bounds.empty())
+				continue;
+			if (!listBounds.has_value()) {
+				listBounds = frame.bounds;
+				continue;
+			}
+			listBounds->left = std::min(listBounds->left, frame.bounds.left);
+			listBounds->top = std::min(listBounds->top, frame.bounds.top);
+			listBounds->right = std::max(listBounds->right, frame.bounds.right);
+			listBounds->bottom = std::max(listBounds->bottom, frame.bounds.bottom);
+		}
+		for (FrameInfo &frame : frames) {
+			if (listBounds.has_value())
+				frame.bounds = *listBounds;
+		}
+	}
+
+	size_t transparentColor = 0;
+	while (transparentColor < usedColors.size() && usedColors.test(transparentColor))
+		++transparentColor;
+
+	ClxListEncoder encoder { numFrames, static_cast<uint8_t>(transparentColor) };
+	cropData.clear();
+	AppendLE32(cropData, numFrames);
+	for (size_t i = 0; i < numFrames; ++i) {
+		FrameInfo &frame = frames[i];
+		const Bounds &bounds = frame.bounds;
+		const bool isCropped = !bounds.empty() && transparentColor < usedColors.size()
+		    && (bounds.left != 0 || bounds.top != 0 || bounds.right != frame.width || bounds.bottom != frame.height);
+		if (!isCropped) {
+			encoder.addEncodedFrame(frame.data);
+			AppendLE16(cropData, 0);
+			AppendLE16(cropData, 0);
+		} else {
+			if (std::string error = decoder.decode(frame, static_cast<uint8_t>(transparentColor), pixels); !error.empty())
+				return "frame " + std::to_string(i) + ": " + error;
+			const unsigned width = bounds.right - bounds.left;
+			const unsigned height = bounds.bottom - bounds.top;
+			// The rows only ever move towards the start, so they can be moved in place.
+			for (unsigned y = 0; y < height; ++y) {
+				std::memmove(&pixels[static_cast<size_t>(y) * width],
+				    &pixels[static_cast<size_t>(bounds.top + y) * frame.width + bounds.left], width);
+			}
+			encoder.addFrame(FramePixels { pixels.data(), width, height });
+			AppendLE16(cropData, bounds.left);
+			AppendLE16(cropData, bounds.top);
+		}
+		AppendLE16(cropData, frame.width);
+		AppendLE16(cropData, frame.height);
+	}
+	croppedClxList = encoder.finish();
+	return "";
+}
+
+} // namespace devilution_mpq_tools
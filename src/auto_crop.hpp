@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "clx_commands.hpp"
+
+namespace devilution_mpq_tools {
+
+// Crops the fully transparent borders of the frames of a CLX list.
+//
+// `cropData` receives where each cropped frame is within the original one, so that the game can draw it
+// at the same position: a little-endian uint32 number of frames, then for each frame 4 little-endian uint16s:
+// the left and top offsets of the cropped frame (from the top-left corner) and the original width and height.
+//
+// Fully transparent frames are kept as is.
+//
+// Returns an error message on failure.
+std::string AutoCropClxList(std::span<const uint8_t> clxList, ClxAutoCrop mode,
+    std::vector<uint8_t> &croppedClxList, std::vector<uint8_t> &cropData);
+
+} // namespace devilution_mpq_tools
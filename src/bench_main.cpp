@@ -0,0 +1,525 @@
+// Measures the throughput of the conversions as `unpack_and_minify_mpq` invokes them.
+//
+// The inputs are synthetic and generated in-process, so no game data is needed.
+// Usage: bench [--filter SUBSTRING] [--min-time-ms N] [--json FILE]
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cel2clx.hpp>
+#include <cl22clx.hpp>
+#include <clx_encode.hpp>
+#include <pcx2clx.hpp>
+#include <pixels2clx.hpp>
+
+#include "asset_conversion.hpp"
+#include "clx_commands.hpp"
+#include "clx_sheet_builder.hpp"
+#include "extract_spell_icons.hpp"
+
+namespace {
+
+constexpr uint8_t TransparentColor = 255;
+
+constexpr char kHelp[] = R"(Usage: bench [-h] [--filter SUBSTRING] [--min-time-ms N] [--json FILE]
+
+Measures the throughput of the CLX conversions on synthetic inputs.
+
+Options:
+  --filter SUBSTRING          Only run the benchmarks whose name contains SUBSTRING.
+  --json FILE                 Also write the results to FILE as JSON.
+  --min-time-ms N             Run each benchmark for at least N milliseconds. Default: 500.
+)";
+
+// A small deterministic PRNG (xorshift32), so that the inputs are the same on every run.
+class Random {
+public:
+	explicit Random(uint32_t seed)
+	    : state_(seed)
+	{
+	}
+
+	uint32_t next()
+	{
+		state_ ^= state_ << 13;
+		state_ ^= state_ >> 17;
+		state_ ^= state_ << 5;
+		return state_;
+	}
+
+	// Returns a number in [min, max].
+	uint32_t next(uint32_t min, uint32_t max)
+	{
+		return min + next() % (max - min + 1);
+	}
+
+private:
+	uint32_t state_;
+};
+
+// Generates frames that look roughly like game sprites: an opaque blob with
+// a transparent surrounding, a mix of noisy and solid-color spans, and `bgColor` holes.
+std::vector<uint8_t> GenerateFrames(unsigned width, unsigned height, unsigned numFrames, uint32_t seed,
+    uint8_t minColor = 0, uint8_t maxColor = 254)
+{
+	Random random { seed };
+	std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * numFrames, TransparentColor);
+	for (unsigned frame = 0; frame < numFrames; ++frame) {
+		uint8_t *framePixels = &pixels[static_cast<size_t>(frame) * width * height];
+		const int cx = static_cast<int>(width / 2 + random.next(0, width / 8));
+		const int cy = static_cast<int>(height / 2 + random.next(0, height / 8));
+		const int rx = static_cast<int>(width * 3 / 8);
+		const int ry = static_cast<int>(height * 3 / 8);
+		for (unsigned y = 0; y < height; ++y) {
+			unsigned x = 0;
+			while (x < width) {
+				const int dx = static_cast<int>(x) - cx;
+				const int dy = static_cast<int>(y) - cy;
+				if (dx * dx * ry * ry + dy * dy * rx * rx > rx * rx * ry * ry) {
+					++x;
+					continue;
+				}
+				// A span of either noise or a solid color.
+				const unsigned spanEnd = std::min(width, x + random.next(1, 12));
+				const bool solid = random.next(0, 3) == 0;
+				const auto solidColor = static_cast<uint8_t>(random.next(minColor, maxColor));
+				for (; x < spanEnd; ++x)
+					framePixels[y * width + x] = solid ? solidColor : static_cast<uint8_t>(random.next(minColor, maxColor));
+			}
+		}
+	}
+	return pixels;
+}
+
+void AppendLE16(std::vector<uint8_t> &out, uint16_t val)
+{
+	out.push_back(static_cast<uint8_t>(val));
+	out.push_back(static_cast<uint8_t>(val >> 8));
+}
+
+void AppendLE32(std::vector<uint8_t> &out, uint32_t val)
+{
+	AppendLE16(out, static_cast<uint16_t>(val));
+	AppendLE16(out, static_cast<uint16_t>(val >> 16));
+}
+
+void WriteLE16(uint8_t *out, uint16_t val)
+{
+	out[0] = static_cast<uint8_t>(val);
+	out[1] = static_cast<uint8_t>(val >> 8);
+}
+
+void WriteLE32(uint8_t *out, uint32_t val)
+{
+	WriteLE16(out, static_cast<uint16_t>(val));
+	WriteLE16(out + 2, static_cast<uint16_t>(val >> 16));
+}
+
+// Returns the length of the run of the same kind (transparent or not) starting at `x`.
+unsigned RunLength(const uint8_t *row, unsigned x, unsigned width)
+{
+	const bool transparent = row[x] == TransparentColor;
+	unsigned end = x + 1;
+	while (end < width && (row[end] == TransparentColor) == transparent)
+		++end;
+	return end - x;
+}
+
+// Encodes a single CL2 frame, bottom row first, with the 10-byte frame header.
+void EncodeCl2Frame(const uint8_t *pixels, unsigned width, unsigned height, std::vector<uint8_t> &out)
+{
+	const size_t frameBegin = out.size();
+	out.resize(frameBegin + 10, 0);
+	WriteLE16(&out[frameBegin], 10);
+	for (unsigned i = 0; i < height; ++i) {
+		// The header has the offsets of every 32nd row.
+		if (i != 0 && i % 32 == 0 && i / 32 <= 4)
+			WriteLE16(&out[frameBegin + 2 * (i / 32)], static_cast<uint16_t>(out.size() - frameBegin));
+		const uint8_t *row = &pixels[static_cast<size_t>(height - 1 - i) * width];
+		unsigned x = 0;
+		while (x < width) {
+			const unsigned len = RunLength(row, x, width);
+			if (row[x] == TransparentColor) {
+				for (unsigned remaining = len; remaining > 0;) {
+					const unsigned n = std::min(remaining, 0x7FU);
+					out.push_back(static_cast<uint8_t>(n));
+					remaining -= n;
+				}
+				x += len;
+				continue;
+			}
+			const unsigned end = x + len;
+			while (x < end) {
+				unsigned fill = 1;
+				while (x + fill < end && fill < 63 && row[x + fill] == row[x])
+					++fill;
+				if (fill >= 3) {
+					out.push_back(static_cast<uint8_t>(0xBF - fill));
+					out.push_back(row[x]);
+					x += fill;
+					continue;
+				}
+				unsigned literal = 1;
+				while (x + literal < end && literal < 65
+				    && !(x + literal + 2 < end && row[x + literal] == row[x + literal + 1] && row[x + literal] == row[x + literal + 2]))
+					++literal;
+				out.push_back(static_cast<uint8_t>(256 - literal));
+				out.insert(out.end(), row + x, row + x + literal);
+				x += literal;
+			}
+		}
+	}
+}
+
+// Encodes a single CEL frame, bottom row first, without a frame header.
+void EncodeCelFrame(const uint8_t *pixels, unsigned width, unsigned height, std::vector<uint8_t> &out)
+{
+	for (unsigned i = 0; i < height; ++i) {
+		const uint8_t *row = &pixels[static_cast<size_t>(height - 1 - i) * width];
+		unsigned x = 0;
+		while (x < width) {
+			const unsigned len = std::min(RunLength(row, x, width), row[x] == TransparentColor ? 0x80U : 0x7FU);
+			if (row[x] == TransparentColor) {
+				out.push_back(static_cast<uint8_t>(256 - len));
+			} else {
+				out.push_back(static_cast<uint8_t>(len));
+				out.insert(out.end(), row + x, row + x + len);
+			}
+			x += len;
+		}
+	}
+}
+
+// A CEL or CL2 file: the number of frames, the frame offsets, and the frames.
+std::vector<uint8_t> EncodeFrames(const std::vector<uint8_t> &pixels, unsigned width, unsigned height, unsigned numFrames,
+    void (*encodeFrame)(const uint8_t *, unsigned, unsigned, std::vector<uint8_t> &))
+{
+	std::vector<uint8_t> out;
+	AppendLE32(out, numFrames);
+	out.resize(out.size() + 4 * (numFrames + 1));
+	for (unsigned frame = 0; frame < numFrames; ++frame) {
+		WriteLE32(&out[4 + 4 * frame], static_cast<uint32_t>(out.size()));
+		encodeFrame(&pixels[static_cast<size_t>(frame) * width * height], width, height, out);
+	}
+	WriteLE32(&out[4 + 4 * numFrames], static_cast<uint32_t>(out.size()));
+	return out;
+}
+
+// An 8-bit RLE-encoded PCX with the frames stacked vertically and a trailing palette.
+std::vector<uint8_t> EncodePcx(const std::vector<uint8_t> &pixels, unsigned width, unsigned height)
+{
+	const uint16_t bytesPerLine = static_cast<uint16_t>((width + 1) & ~1U);
+	std::vector<uint8_t> out(128, 0);
+	out[0] = 0x0A; // manufacturer
+	out[1] = 5;    // version
+	out[2] = 1;    // RLE encoding
+	out[3] = 8;    // bits per pixel
+	WriteLE16(&out[8], static_cast<uint16_t>(width - 1));
+	WriteLE16(&out[10], static_cast<uint16_t>(height - 1));
+	out[65] = 1; // number of planes
+	WriteLE16(&out[66], bytesPerLine);
+	WriteLE16(&out[68], 1); // color palette
+	for (unsigned y = 0; y < height; ++y) {
+		const uint8_t *row = &pixels[static_cast<size_t>(y) * width];
+		unsigned x = 0;
+		while (x < bytesPerLine) {
+			const uint8_t color = x < width ? row[x] : 0;
+			unsigned len = 1;
+			while (x + len < bytesPerLine && len < 63 && (x + len < width ? row[x + len] : 0) == color)
+				++len;
+			if (len > 1 || color >= 0xC0)
+				out.push_back(static_cast<uint8_t>(0xC0 | len));
+			out.push_back(color);
+			x += len;
+		}
+	}
+	out.push_back(0x0C);
+	for (unsigned i = 0; i < 256; ++i) {
+		out.push_back(static_cast<uint8_t>(i));
+		out.push_back(static_cast<uint8_t>(255 - i));
+		out.push_back(static_cast<uint8_t>(i / 2));
+	}
+	return out;
+}
+
+struct Benchmark {
+	std::string name;
+	size_t inputSize;
+	size_t numSprites;
+	// Runs a single iteration and returns the output size.
+	std::function<size_t()> run;
+};
+
+struct BenchmarkResult {
+	std::string name;
+	size_t iterations;
+	double seconds;
+	size_t inputSize;
+	size_t outputSize;
+	size_t numSprites;
+
+	[[nodiscard]] double megabytesPerSecond() const
+	{
+		return static_cast<double>(inputSize) * static_cast<double>(iterations) / seconds / 1e6;
+	}
+
+	[[nodiscard]] double spritesPerSecond() const
+	{
+		return static_cast<double>(numSprites) * static_cast<double>(iterations) / seconds;
+	}
+};
+
+void CheckError(const std::optional<dvl_gfx::IoError> &error, std::string_view benchmark)
+{
+	if (error.has_value()) {
+		std::cerr << benchmark << ": " << error->message << std::endl;
+		std::exit(1);
+	}
+}
+
+Benchmark Cl2ToClxBenchmark(unsigned width, unsigned height, unsigned numFrames)
+{
+	std::string name = "cl22clx/" + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(numFrames);
+	std::vector<uint8_t> cl2 = EncodeFrames(GenerateFrames(width, height, numFrames, /*seed=*/1), width, height, numFrames, EncodeCl2Frame);
+	const size_t inputSize = cl2.size();
+	return Benchmark { name, inputSize, numFrames,
+		[name, cl2 = std::move(cl2), widths = std::vector<uint16_t> { static_cast<uint16_t>(width) }, clxData = std::vector<uint8_t>()]() mutable {
+		    clxData.clear();
+		    CheckError(dvl_gfx::Cl2ToClx(cl2.data(), cl2.size(), widths.data(), widths.size(), clxData), name);
+		    return clxData.size();
+		} };
+}
+
+Benchmark CelToClxBenchmark(unsigned width, unsigned height, unsigned numFrames)
+{
+	std::string name = "cel2clx/" + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(numFrames);
+	std::vector<uint8_t> cel = EncodeFrames(GenerateFrames(width, height, numFrames, /*seed=*/2), width, height, numFrames, EncodeCelFrame);
+	const size_t inputSize = cel.size();
+	return Benchmark { name, inputSize, numFrames,
+		[name, cel = std::move(cel), widths = std::vector<uint16_t> { static_cast<uint16_t>(width) }, clxData = std::vector<uint8_t>()]() mutable {
+		    clxData.clear();
+		    CheckError(dvl_gfx::CelToClx(cel.data(), cel.size(), widths.data(), widths.size(), clxData), name);
+		    return clxData.size();
+		} };
+}
+
+Benchmark PcxToClxBenchmark(unsigned width, unsigned frameHeight, unsigned numFrames)
+{
+	std::string name = "pcx2clx/" + std::to_string(width) + "x" + std::to_string(frameHeight) + "x" + std::to_string(numFrames);
+	std::vector<uint8_t> pcx = EncodePcx(GenerateFrames(width, frameHeight, numFrames, /*seed=*/3), width, frameHeight * numFrames);
+	const size_t inputSize = pcx.size();
+	return Benchmark { name, inputSize, numFrames,
+		[name, pcx = std::move(pcx), numFrames, clxData = std::vector<uint8_t>(), palette = std::array<uint8_t, 256 * 3>()]() mutable {
+		    clxData.clear();
+		    CheckError(dvl_gfx::PcxToClx(pcx.data(), pcx.size(), static_cast<int>(numFrames), TransparentColor,
+		                   /*cropWidths=*/ {}, clxData, palette.data()),
+		        name);
+		    return clxData.size();
+		} };
+}
+
+// Same dimensions as `spelicon`, with the colors in the background range.
+Benchmark ExtractSpellIconsBenchmark()
+{
+	constexpr unsigned Width = 56;
+	constexpr unsigned Height = 56;
+	constexpr unsigned NumFrames = 52;
+	std::string name = "spell_icons/56x56x52";
+	std::vector<uint8_t> cel = EncodeFrames(
+	    GenerateFrames(Width, Height, NumFrames, /*seed=*/4, /*minColor=*/190, /*maxColor=*/208),
+	    Width, Height, NumFrames, EncodeCelFrame);
+	const size_t inputSize = cel.size();
+	return Benchmark { name, inputSize, NumFrames,
+		[name, cel = std::move(cel), bg = std::vector<uint8_t>(), fg = std::vector<uint8_t>()]() mutable {
+		    const uint16_t width = Width;
+		    const std::string error = devilution_mpq_tools::ExtractSpellIcons(cel, { &width, 1 }, bg, fg);
+		    if (!error.empty()) {
+			    std::cerr << name << ": " << error << std::endl;
+			    std::exit(1);
+		    }
+		    return bg.size() + fg.size();
+		} };
+}
+
+// Combines several CL2 files into a single CLX sheet, like `ProcessCombineGroup` in `unpack_and_minify_mpq`:
+// each file is converted into a list on its own and added to the sheet.
+Benchmark CombineBenchmark(unsigned width, unsigned height, unsigned numFramesPerFile, unsigned numFiles)
+{
+	using devilution_mpq_tools::ClxCombineGroup;
+	using devilution_mpq_tools::ClxCommand;
+	std::string name = "combine/" + std::to_string(numFiles) + "x" + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(numFramesPerFile);
+
+	// The group points into this, so it is shared by the copies of the benchmark function.
+	struct Input {
+		std::vector<std::vector<uint8_t>> files;
+		std::array<uint16_t, 1> widths;
+		ClxCommand command;
+		std::vector<std::string_view> paths;
+		std::vector<const ClxCommand *> commands;
+		ClxCombineGroup group;
+	};
+	auto input = std::make_shared<Input>();
+	size_t inputSize = 0;
+	for (unsigned i = 0; i < numFiles; ++i) {
+		input->files.push_back(EncodeFrames(GenerateFrames(width, height, numFramesPerFile, /*seed=*/5 + i), width, height, numFramesPerFile, EncodeCl2Frame));
+		inputSize += input->files.back().size();
+	}
+	input->widths = { static_cast<uint16_t>(width) };
+	input->command = ClxCommand {
+		.kind = devilution_mpq_tools::ClxCommandKind::Cl2ToClx,
+		.widths = input->widths,
+		.numFrames = 0,
+		.transparentColor = std::nullopt,
+		.exportPalette = false,
+		.transform = devilution_mpq_tools::ClxFrameTransform::None,
+		.autoCrop = devilution_mpq_tools::ClxAutoCrop::None,
+		.description = "cl22clx",
+	};
+	input->paths.assign(numFiles, "bench.cl2");
+	input->commands.assign(numFiles, &input->command);
+	input->group = ClxCombineGroup {
+		.command = &input->command,
+		.files = input->paths,
+		.commands = input->commands,
+		.outputName = {},
+	};
+	return Benchmark { name, inputSize, static_cast<size_t>(numFramesPerFile) * numFiles,
+		[name, input = std::move(input), list = std::vector<uint8_t>()]() mutable {
+		    devilution_mpq_tools::ClxSheetBuilder sheet { input->files.size() };
+		    for (size_t i = 0; i < input->files.size(); ++i) {
+			    const std::string error = devilution_mpq_tools::ConvertCombineGroupMember(input->group, i, input->files[i], list);
+			    if (!error.empty()) {
+				    std::cerr << name << ": " << error << std::endl;
+				    std::exit(1);
+			    }
+			    sheet.addList(list);
+		    }
+		    return sheet.finish().size();
+	    } };
+}
+
+BenchmarkResult RunBenchmark(Benchmark &benchmark, std::chrono::milliseconds minTime)
+{
+	using Clock = std::chrono::steady_clock;
+	// Warm up the caches and the output buffers.
+	size_t outputSize = benchmark.run();
+	size_t iterations = 0;
+	const Clock::time_point start = Clock::now();
+	Clock::time_point now;
+	do {
+		outputSize = benchmark.run();
+		++iterations;
+		now = Clock::now();
+	} while (now - start < minTime);
+	return BenchmarkResult {
+		benchmark.name,
+		iterations,
+		std::chrono::duration<double>(now - start).count(),
+		benchmark.inputSize,
+		outputSize,
+		benchmark.numSprites,
+	};
+}
+
+void WriteJson(std::ostream &out, const std::vector<BenchmarkResult> &results)
+{
+	out << "{\n  \"benchmarks\": [";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchmarkResult &result = results[i];
+		out << (i == 0 ? "\n" : ",\n")
+		    << "    {\"name\": \"" << result.name << "\""
+		    << ", \"iterations\": " << result.iterations
+		    << ", \"seconds\": " << result.seconds
+		    << ", \"input_bytes\": " << result.inputSize
+		    << ", \"output_bytes\": " << result.outputSize
+		    << ", \"sprites\": " << result.numSprites
+		    << ", \"mb_per_s\": " << result.megabytesPerSecond()
+		    << ", \"sprites_per_s\": " << result.spritesPerSecond()
+		    << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::string_view filter;
+	std::chrono::milliseconds minTime { 500 };
+	const char *jsonPath = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		if (arg == "-h" || arg == "--help") {
+			std::cerr << kHelp << std::endl;
+			return 0;
+		}
+		if (i + 1 == argc) {
+			std::cerr << "unknown argument or missing value: " << arg << std::endl;
+			return 64;
+		}
+		const std::string_view value = argv[++i];
+		if (arg == "--filter") {
+			filter = value;
+		} else if (arg == "--json") {
+			jsonPath = argv[i];
+		} else if (arg == "--min-time-ms") {
+			unsigned ms;
+			const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), ms);
+			if (ec != std::errc() || ptr != value.data() + value.size()) {
+				std::cerr << "expected a number, got " << value << std::endl;
+				return 64;
+			}
+			minTime = std::chrono::milliseconds { ms };
+		} else {
+			std::cerr << "unknown argument: " << arg << std::endl;
+			return 64;
+		}
+	}
+
+	// The sizes are those of typical assets: monster animations, items, UI screens, and spell icons.
+	std::vector<Benchmark> benchmarks;
+	benchmarks.push_back(Cl2ToClxBenchmark(96, 96, 128));
+	benchmarks.push_back(Cl2ToClxBenchmark(160, 160, 64));
+	benchmarks.push_back(CelToClxBenchmark(64, 64, 64));
+	benchmarks.push_back(CelToClxBenchmark(28, 28, 180));
+	benchmarks.push_back(PcxToClxBenchmark(640, 480, 1));
+	benchmarks.push_back(PcxToClxBenchmark(56, 56, 64));
+	benchmarks.push_back(ExtractSpellIconsBenchmark());
+	benchmarks.push_back(CombineBenchmark(96, 96, 16, 8));
+
+	std::vector<BenchmarkResult> results;
+	std::printf("%-28s %10s %12s %12s %14s\n", "benchmark", "iterations", "in bytes", "MB/s", "sprites/s");
+	for (Benchmark &benchmark : benchmarks) {
+		if (benchmark.name.find(filter) == std::string::npos)
+			continue;
+		const BenchmarkResult &result = results.emplace_back(RunBenchmark(benchmark, minTime));
+		std::printf("%-28s %10zu %12zu %12.1f %14.0f\n", result.name.c_str(), result.iterations,
+		    result.inputSize, result.megabytesPerSecond(), result.spritesPerSecond());
+		std::fflush(stdout);
+	}
+
+	if (jsonPath != nullptr) {
+		std::ofstream out { jsonPath };
+		WriteJson(out, results);
+		out.close();
+		if (out.fail()) {
+			std::cerr << "Failed to write " << jsonPath << ": " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
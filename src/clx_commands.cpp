@@ -0,0 +1,35 @@
+#include "clx_commands.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+bool PathsEqual(std::string_view a, std::string_view b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		const char ca = a[i] == '\\' ? '/' : a[i];
+		const char cb = b[i] == '\\' ? '/' : b[i];
+		if (ca != cb)
+			return false;
+	}
+	return true;
+}
+
+} // namespace
+
+const ClxCommandEntry *ClxCommandTable::find(std::string_view path) const
+{
+	if (slots.empty())
+		return nullptr;
+	const uint64_t hash = ClxPathHash(path);
+	const uint32_t displacement = displacements[(hash >> 32) % displacements.size()];
+	const uint16_t slot = slots[ClxSlotHash(hash, displacement) & (slots.size() - 1)];
+	if (slot == ClxNoEntry)
+		return nullptr;
+	const ClxCommandEntry &entry = entries[slot];
+	return PathsEqual(entry.path, path) ? &entry : nullptr;
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace devilution_mpq_tools {
+
+// The CLX conversion commands of `data/*-clx.txt`.
+//
+// The command files are parsed and validated at build time by `gen_clx_commands`,
+// which emits the tables below as constant data, so a malformed command file fails the build
+// and looking up a command does not allocate.
+
+enum class ClxCommandKind : uint8_t {
+	Cl2ToClx,
+	CelToClx,
+	PcxToClx,
+
+	// Not a CLX conversion: deduplicates the frames of a dungeon tile CEL and rewrites its `.min`,
+	// see dungeon_tiles.hpp. Always a group of the CEL and the MIN, in that order.
+	DedupTiles,
+};
+
+// Post-processing of the decoded frames, see frame_pipeline.hpp.
+enum class ClxFrameTransform : uint8_t {
+	None,
+
+	// cel2clx: splits the spell icons into `<name>_bg.clx` and `<name>_fg.clx`, see extract_spell_icons.hpp.
+	SpellIcons,
+};
+
+// Cropping of the transparent borders of the frames, see auto_crop.hpp.
+//
+// Opt-in with `--auto-crop`, and off for every command in data/: DevilutionX does not read the `.crop` offsets yet,
+// and without them draws a cropped sprite in the wrong place. Only enable it once the game reads them.
+enum class ClxAutoCrop : uint8_t {
+	None,
+
+	// Each frame is cropped to its own bounds.
+	Frames,
+
+	// All the frames are cropped to the union of their bounds, so that they keep the same size.
+	List,
+};
+
+struct ClxCommand {
+	ClxCommandKind kind;
+
+	// cl22clx and cel2clx: the frame widths, or a single width for all the frames.
+	std::span<const uint16_t> widths;
+
+	// pcx2clx
+	size_t numFrames;
+	std::optional<uint8_t> transparentColor;
+	bool exportPalette;
+
+	ClxFrameTransform transform;
+
+	// cel2clx and pcx2clx
+	ClxAutoCrop autoCrop;
+
+	// The command in canonical form, e.g. "cl22clx --width 96".
+	std::string_view description;
+};
+
+// Files converted together: the files of `--combine` into a single CLX sheet,
+// with a list per file, or the CEL and the MIN of `dedup-tiles`.
+struct ClxCombineGroup {
+	// The command of the first file.
+	const ClxCommand *command;
+	std::span<const std::string_view> files;
+
+	// The command of each file. The lines of a group can have different commands, e.g. different widths.
+	std::span<const ClxCommand *const> commands;
+
+	// `--output`: the path of the sheet, relative to the output directory.
+	// If empty, the sheet is named after the first file, see `DefaultCombinedClxFilename`.
+	std::string_view outputName;
+};
+
+struct ClxCommandEntry {
+	std::string_view path;
+	const ClxCommand *command;
+
+	// Null if the file is converted on its own.
+	const ClxCombineGroup *group;
+};
+
+// Marks an empty slot of `ClxCommandTable::slots`.
+inline constexpr uint16_t ClxNoEntry = 0xFFFF;
+
+// FNV-1a, with `\` hashed as `/` so that MPQ paths can be looked up as is.
+constexpr uint64_t ClxPathHash(std::string_view path)
+{
+	uint64_t hash = 0xCBF29CE484222325;
+	for (const char c : path) {
+		hash ^= static_cast<uint8_t>(c == '\\' ? '/' : c);
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+// The second level of the perfect hash: the slot of a path in its bucket's displacement.
+constexpr uint64_t ClxSlotHash(uint64_t pathHash, uint32_t displacement)
+{
+	uint64_t x = pathHash + displacement * 0x9E3779B97F4A7C15;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+	return x ^ (x >> 31);
+}
+
+// The commands of a single MPQ, indexed by path with a perfect hash (hash and displace):
+// a path's bucket gives the displacement that maps it to its slot, and the slot gives its entry.
+struct ClxCommandTable {
+	std::span<const ClxCommand> commands;
+	std::span<const ClxCombineGroup> groups;
+	std::span<const ClxCommandEntry> entries;
+	std::span<const uint32_t> displacements;
+
+	// A power of 2 in size. Indices into `entries`, or `ClxNoEntry`.
+	std::span<const uint16_t> slots;
+
+	// Accepts both `/` and `\` as the path separator.
+	[[nodiscard]] const ClxCommandEntry *find(std::string_view path) const;
+};
+
+// The commands for the MPQ named `srcName` (e.g. "diabdat"). Empty for the MPQs without any.
+const ClxCommandTable &GetClxCommandTable(std::string_view srcName);
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,50 @@
+#include "clx_sheet_builder.hpp"
+
+#include <algorithm>
+#include <functional>
+
+#include <clx_encode.hpp>
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+size_t HashList(std::span<const uint8_t> list)
+{
+	return std::hash<std::string_view> {}({ reinterpret_cast<const char *>(list.data()), list.size() });
+}
+
+} // namespace
+
+ClxSheetBuilder::ClxSheetBuilder(size_t numLists)
+    : numLists_(numLists)
+    , sheet_(dvl_gfx::ClxSheetHeaderSize(numLists))
+{
+}
+
+void ClxSheetBuilder::addList(std::span<const uint8_t> list)
+{
+	const size_t hash = HashList(list);
+	// The last list is always stored: the game derives the size of a sheet from the end of its last list.
+	if (numAdded_ + 1 != numLists_) {
+		const auto [begin, end] = lists_.equal_range(hash);
+		for (auto it = begin; it != end; ++it) {
+			const auto [offset, size] = it->second;
+			if (size == list.size() && std::equal(list.begin(), list.end(), sheet_.begin() + offset)) {
+				dvl_gfx::ClxSheetHeaderSetListOffset(numAdded_++, offset, sheet_.data());
+				bytesSaved_ += size;
+				return;
+			}
+		}
+	}
+	lists_.emplace(hash, std::make_pair(sheet_.size(), list.size()));
+	dvl_gfx::ClxSheetHeaderSetListOffset(numAdded_++, sheet_.size(), sheet_.data());
+	sheet_.insert(sheet_.end(), list.begin(), list.end());
+}
+
+std::vector<uint8_t> ClxSheetBuilder::finish()
+{
+	return std::move(sheet_);
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// Builds a CLX sheet a list at a time. Identical lists are stored once,
+// with their sheet offsets pointing at the same bytes.
+//
+// Only whole lists are shared: the game derives the size of a frame from the offset of the next one,
+// so the frames of a list must stay contiguous and in order.
+class ClxSheetBuilder {
+public:
+	explicit ClxSheetBuilder(size_t numLists);
+
+	void addList(std::span<const uint8_t> list);
+
+	// The size of the sheet so far.
+	[[nodiscard]] size_t size() const
+	{
+		return sheet_.size();
+	}
+
+	// The bytes saved by sharing the identical lists.
+	[[nodiscard]] size_t bytesSaved() const
+	{
+		return bytesSaved_;
+	}
+
+	// Returns the sheet. All the lists must have been added.
+	std::vector<uint8_t> finish();
+
+private:
+	size_t numLists_;
+	size_t numAdded_ = 0;
+	size_t bytesSaved_ = 0;
+	std::vector<uint8_t> sheet_;
+
+	// The offset of every distinct list so far, by content.
+	// Keyed by offset and size rather than by a view of `sheet_`, which reallocates as it grows.
+	std::unordered_multimap<size_t, std::pair<size_t, size_t>> lists_;
+};
+
+} // namespace devilution_mpq_tools
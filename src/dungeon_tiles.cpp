@@ -0,0 +1,111 @@
+#include "dungeon_tiles.hpp"
+
+#include <array>
+#include <string_view>
+#include <unordered_map>
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr uint16_t MinFrameMask = 0x0FFF;
+constexpr unsigned MinTypeShift = 12;
+constexpr size_t NumTileTypes = 16;
+
+// `frameTypes` values besides the tile types.
+constexpr uint8_t UnusedFrame = 0xFF;
+constexpr uint8_t MixedTypesFrame = 0xFE;
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void WriteLE32(uint8_t *out, uint32_t val)
+{
+	out[0] = static_cast<uint8_t>(val);
+	out[1] = static_cast<uint8_t>(val >> 8);
+	out[2] = static_cast<uint8_t>(val >> 16);
+	out[3] = static_cast<uint8_t>(val >> 24);
+}
+
+} // namespace
+
+std::string DedupDungeonTiles(std::span<const uint8_t> cel, std::span<const uint8_t> min,
+    std::vector<uint8_t> &celOut, std::vector<uint8_t> &minOut)
+{
+	if (cel.size() < 4)
+		return "CEL file is truncated";
+	const uint32_t numFrames = LoadLE32(cel.data());
+	if (cel.size() / 4 < static_cast<size_t>(numFrames) + 2)
+		return "CEL frame offsets are truncated";
+	if (LoadLE32(&cel[4 + 4 * static_cast<size_t>(numFrames)]) != cel.size())
+		return "CEL files with frame groups are not supported";
+	if (min.size() % 2 != 0)
+		return "MIN file size is not a multiple of 2";
+
+	std::vector<uint8_t> frameTypes(numFrames, UnusedFrame);
+	for (size_t i = 0; i < min.size(); i += 2) {
+		const auto entry = static_cast<uint16_t>(min[i] | (min[i + 1] << 8));
+		const unsigned frame = entry & MinFrameMask;
+		if (frame == 0)
+			continue;
+		if (frame > numFrames)
+			return "MIN references frame " + std::to_string(frame) + " of " + std::to_string(numFrames);
+		uint8_t &type = frameTypes[frame - 1];
+		const auto entryType = static_cast<uint8_t>(entry >> MinTypeShift);
+		if (type == UnusedFrame) {
+			type = entryType;
+		} else if (type != entryType) {
+			type = MixedTypesFrame;
+		}
+	}
+
+	// The new 1-based index of every frame, in the original order. 0 for the unused frames.
+	std::vector<uint16_t> newIndices(numFrames, 0);
+	std::vector<std::string_view> keptFrames;
+	std::array<std::unordered_map<std::string_view, uint16_t>, NumTileTypes> uniqueFrames;
+	for (size_t frame = 0; frame < numFrames; ++frame) {
+		const uint8_t type = frameTypes[frame];
+		if (type == UnusedFrame)
+			continue;
+		const uint32_t begin = LoadLE32(&cel[4 + 4 * frame]);
+		const uint32_t end = LoadLE32(&cel[8 + 4 * frame]);
+		if (begin > end || end > cel.size())
+			return "invalid CEL frame offsets";
+		const std::string_view data { reinterpret_cast<const char *>(&cel[begin]), end - begin };
+		const auto newIndex = static_cast<uint16_t>(keptFrames.size() + 1);
+		if (type != MixedTypesFrame) {
+			const auto [it, inserted] = uniqueFrames[type].try_emplace(data, newIndex);
+			if (!inserted) {
+				newIndices[frame] = it->second;
+				continue;
+			}
+		}
+		newIndices[frame] = newIndex;
+		keptFrames.push_back(data);
+	}
+
+	celOut.assign(4 * (keptFrames.size() + 2), 0);
+	WriteLE32(celOut.data(), static_cast<uint32_t>(keptFrames.size()));
+	for (size_t i = 0; i < keptFrames.size(); ++i) {
+		WriteLE32(&celOut[4 + 4 * i], static_cast<uint32_t>(celOut.size()));
+		celOut.insert(celOut.end(), keptFrames[i].begin(), keptFrames[i].end());
+	}
+	WriteLE32(&celOut[4 + 4 * keptFrames.size()], static_cast<uint32_t>(celOut.size()));
+
+	minOut.assign(min.begin(), min.end());
+	for (size_t i = 0; i < minOut.size(); i += 2) {
+		const auto entry = static_cast<uint16_t>(minOut[i] | (minOut[i + 1] << 8));
+		const unsigned frame = entry & MinFrameMask;
+		if (frame == 0)
+			continue;
+		const auto newEntry = static_cast<uint16_t>((entry & ~MinFrameMask) | newIndices[frame - 1]);
+		minOut[i] = static_cast<uint8_t>(newEntry);
+		minOut[i + 1] = static_cast<uint8_t>(newEntry >> 8);
+	}
+	return "";
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// Removes the duplicate and the unused frames of a dungeon tile CEL (e.g. `levels/l1data/l1.cel`)
+// and points the level pieces of its `.min` file at the remaining frames.
+//
+// A `.min` entry is a 1-based frame index in the low 12 bits and the tile type in the high 4 bits.
+// Only the frame index is rewritten, so the game loads the outputs the same way as the originals,
+// with fewer frames to re-encode. Frames referenced with more than one tile type are kept as is.
+//
+// Returns an error message on failure.
+std::string DedupDungeonTiles(std::span<const uint8_t> cel, std::span<const uint8_t> min,
+    std::vector<uint8_t> &celOut, std::vector<uint8_t> &minOut);
+
+} // namespace devilution_mpq_tools
@@ -1,13 +1,21 @@
 #include "extract_spell_icons.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <string>
 
-#include <clx2pixels.hpp>
-#include <clx_decode.hpp>
-#include <pixels2clx.hpp>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DVL_EXTRACT_SPELL_ICONS_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DVL_EXTRACT_SPELL_ICONS_NEON
+#endif
+
+#include "frame_pipeline.hpp"
 
 namespace devilution_mpq_tools {
 
@@ -46,6 +54,52 @@ constexpr bool ShouldRemove(uint8_t fg, uint8_t bg)
 	return false;
 }
 
+// `ShouldRemove` for every (fg, bg) pair, a bit per pair.
+using ShouldRemoveBitmap = std::array<std::array<uint64_t, 4>, 256>;
+
+constexpr ShouldRemoveBitmap BuildShouldRemoveBitmap()
+{
+	ShouldRemoveBitmap result {};
+	for (unsigned fg = 0; fg < 256; ++fg) {
+		for (unsigned bg = 0; bg < 256; ++bg) {
+			if (ShouldRemove(static_cast<uint8_t>(fg), static_cast<uint8_t>(bg)))
+				result[fg][bg / 64] |= uint64_t { 1 } << (bg % 64);
+		}
+	}
+	return result;
+}
+
+constexpr ShouldRemoveBitmap ShouldRemoveBits = BuildShouldRemoveBitmap();
+
+constexpr bool ShouldRemoveLookup(uint8_t fg, uint8_t bg)
+{
+	return ((ShouldRemoveBits[fg][bg / 64] >> (bg % 64)) & 1) != 0;
+}
+
+// `ShouldRemove` as computed by the SIMD kernels, one lane at a time.
+constexpr bool ShouldRemoveBranchless(uint8_t fg, uint8_t bg)
+{
+	const uint8_t d = std::max(fg, bg) - std::min(fg, bg);
+	const uint8_t a = std::min(fg, bg);
+	const bool inRange = static_cast<uint8_t>(fg - MinBgColor) <= MaxBgColor - MinBgColor;
+	return fg == 144 || (inRange && (d <= 5 || (d == 6 && (a == 196 || a == 199))));
+}
+
+constexpr bool BranchlessMatchesBitmap()
+{
+	for (unsigned fg = 0; fg < 256; ++fg) {
+		for (unsigned bg = 0; bg < 256; ++bg) {
+			if (ShouldRemoveBranchless(static_cast<uint8_t>(fg), static_cast<uint8_t>(bg))
+			    != ShouldRemoveLookup(static_cast<uint8_t>(fg), static_cast<uint8_t>(bg)))
+				return false;
+		}
+	}
+	return true;
+}
+
+// If this fails, `ShouldRemove` has changed and the SIMD kernels must be updated to match.
+static_assert(BranchlessMatchesBitmap());
+
 void RemoveBackground(uint8_t *pixels, unsigned width, unsigned height,
     Borders borders, const uint8_t *bg)
 {
@@ -63,11 +117,7 @@ void RemoveBackground(uint8_t *pixels, unsigned width, unsigned height,
 		// Remove left border:
 		std::memset(&pixels[static_cast<size_t>(y * width)],
 		    TransparentColor, borders.left);
-		for (unsigned x = borders.left, xEnd = borders.left + innerWidth; x < xEnd; ++x) {
-			uint8_t &pixel = pixels[y * width + x];
-			if (ShouldRemove(pixel, bg[y * width + x]))
-				pixel = TransparentColor;
-		}
+		RemoveBackgroundRow(&pixels[y * width + borders.left], &bg[y * width + borders.left], innerWidth);
 		// Remove right border:
 		std::memset(&pixels[y * width + borders.left + innerWidth],
 		    TransparentColor, borders.right);
@@ -79,27 +129,81 @@ void RemoveBackground(uint8_t *pixels, unsigned width, unsigned height,
 
 } // namespace
 
-std::string ExtractSpellIcons(std::span<const uint8_t> clxData,
-    std::vector<uint8_t> &iconBackground, std::vector<uint8_t> &iconsWithoutBackground)
+void RemoveBackgroundRowScalar(uint8_t *pixels, const uint8_t *bg, unsigned n)
 {
-	std::vector<uint8_t> pixels;
-	const std::optional<dvl_gfx::IoError> clxError = dvl_gfx::Clx2Pixels(clxData, TransparentColor, pixels);
-	if (clxError.has_value())
-		return "Failed CLX->Pixels conversion: " + clxError->message;
+	for (unsigned x = 0; x < n; ++x) {
+		if (ShouldRemoveLookup(pixels[x], bg[x]))
+			pixels[x] = TransparentColor;
+	}
+}
 
-	size_t numSprites = dvl_gfx::GetNumSpritesFromClxList(clxData.data());
-	const std::span<const uint8_t> firstSprite = dvl_gfx::GetSpriteDataFromClxList(clxData.data(), 0);
-	const unsigned width = dvl_gfx::GetClxSpriteWidth(firstSprite.data());
-	const unsigned height = dvl_gfx::GetClxSpriteHeight(firstSprite.data());
+void RemoveBackgroundRow(uint8_t *pixels, const uint8_t *bg, unsigned n)
+{
+	static_assert(TransparentColor == 255, "the kernels set removed pixels by OR-ing with the mask");
+	unsigned x = 0;
+#if defined(DVL_EXTRACT_SPELL_ICONS_SSE2)
+	const __m128i minBg = _mm_set1_epi8(static_cast<char>(MinBgColor));
+	const __m128i bgRange = _mm_set1_epi8(static_cast<char>(MaxBgColor - MinBgColor));
+	for (; x + 16 <= n; x += 16) {
+		const __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&pixels[x]));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&bg[x]));
+		const __m128i d = _mm_or_si128(_mm_subs_epu8(f, b), _mm_subs_epu8(b, f));
+		const __m128i a = _mm_min_epu8(f, b);
+		const __m128i fgOffset = _mm_sub_epi8(f, minBg);
+		const __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(fgOffset, bgRange), fgOffset);
+		const __m128i dLe5 = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(5)), d);
+		const __m128i pair = _mm_and_si128(_mm_cmpeq_epi8(d, _mm_set1_epi8(6)),
+		    _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(static_cast<char>(196))),
+		        _mm_cmpeq_epi8(a, _mm_set1_epi8(static_cast<char>(199)))));
+		const __m128i remove = _mm_or_si128(_mm_cmpeq_epi8(f, _mm_set1_epi8(static_cast<char>(144))),
+		    _mm_and_si128(inRange, _mm_or_si128(dLe5, pair)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&pixels[x]), _mm_or_si128(f, remove));
+	}
+#elif defined(DVL_EXTRACT_SPELL_ICONS_NEON)
+	for (; x + 16 <= n; x += 16) {
+		const uint8x16_t f = vld1q_u8(&pixels[x]);
+		const uint8x16_t b = vld1q_u8(&bg[x]);
+		const uint8x16_t d = vabdq_u8(f, b);
+		const uint8x16_t a = vminq_u8(f, b);
+		const uint8x16_t inRange = vcleq_u8(vsubq_u8(f, vdupq_n_u8(MinBgColor)), vdupq_n_u8(MaxBgColor - MinBgColor));
+		const uint8x16_t pair = vandq_u8(vceqq_u8(d, vdupq_n_u8(6)),
+		    vorrq_u8(vceqq_u8(a, vdupq_n_u8(196)), vceqq_u8(a, vdupq_n_u8(199))));
+		const uint8x16_t remove = vorrq_u8(vceqq_u8(f, vdupq_n_u8(144)),
+		    vandq_u8(inRange, vorrq_u8(vcleq_u8(d, vdupq_n_u8(5)), pair)));
+		vst1q_u8(&pixels[x], vorrq_u8(f, remove));
+	}
+#endif
+	RemoveBackgroundRowScalar(&pixels[x], &bg[x], n - x);
+}
 
-	Borders borders;
+std::string ExtractSpellIcons(std::span<const uint8_t> celData, std::span<const uint16_t> widths,
+    std::vector<uint8_t> &iconBackground, std::vector<uint8_t> &iconsWithoutBackground)
+{
+	CelFrameDecoder decoder;
+	std::string error = decoder.open(celData, widths);
+	if (error.empty() && decoder.numFrames() == 0)
+		error = "no frames";
+	if (!error.empty())
+		return "Failed to read the CEL file: " + error;
+
+	// The background is an empty icon. Decode it first, so that it can be removed from the others.
 	const size_t emptySprite = 26;
-	if (width == 37 && height == 38) {
+	if (decoder.numFrames() <= emptySprite)
+		return "Unsupported number of icons";
+	std::vector<uint8_t> bgBuffer;
+	FramePixels bg;
+	error = decoder.decode(emptySprite, TransparentColor, bgBuffer, bg);
+	if (!error.empty())
+		return "Failed to decode the background: " + error;
+
+	size_t numSprites = decoder.numFrames();
+	Borders borders;
+	if (bg.width == 37 && bg.height == 38) {
 		// `spelli2`, the last sprite is unused
 		--numSprites;
 		borders.left = borders.bottom = 1;
 		borders.right = borders.top = 2;
-	} else if (width == 56 && height == 56) {
+	} else if (bg.width == 56 && bg.height == 56) {
 		// `spelicon`, the last 9 sprites are overlays, unused in DevilutionX.
 		numSprites -= 9;
 		borders.left = borders.bottom = 5;
@@ -108,21 +212,24 @@ std::string ExtractSpellIcons(std::span<const uint8_t> clxData,
 		return "Unsupported icon size";
 	}
 
-	dvl_gfx::Pixels2Clx(&pixels[emptySprite * width * height],
-	    /*width=*/width, width, /*frameHeight=*/height, /*numFrames=*/1,
-	    TransparentColor, iconBackground);
-
-	for (size_t frame = 0; frame < numSprites; ++frame) {
-		if (frame == emptySprite)
-			continue;
-		RemoveBackground(&pixels[frame * width * height], width, height,
-		    borders, &pixels[emptySprite * width * height]);
-	}
-	std::memset(&pixels[emptySprite * width * height], TransparentColor, width * height);
-
-	dvl_gfx::Pixels2Clx(pixels.data(),
-	    /*width=*/width, width, /*frameHeight=*/height, numSprites,
-	    TransparentColor, iconsWithoutBackground);
+	ClxListEncoder bgEncoder { 1, TransparentColor };
+	bgEncoder.addFrame(bg);
+	iconBackground = bgEncoder.finish();
+
+	error = TransformCelFrames(decoder, numSprites, TransparentColor,
+	    [&](size_t frame, FramePixels &pixels) -> std::string {
+		    if (pixels.width != bg.width || pixels.height != bg.height)
+			    return "icon size differs from the background";
+		    if (frame == emptySprite) {
+			    std::memset(pixels.pixels, TransparentColor, static_cast<size_t>(pixels.width) * pixels.height);
+		    } else {
+			    RemoveBackground(pixels.pixels, pixels.width, pixels.height, borders, bg.pixels);
+		    }
+		    return "";
+	    },
+	    iconsWithoutBackground);
+	if (!error.empty())
+		return "Failed to extract the icons: " + error;
 	return "";
 }
 
@@ -7,7 +7,19 @@
 
 namespace devilution_mpq_tools {
 
-std::string ExtractSpellIcons(std::span<const uint8_t> clxData,
+// Splits the spell icons CEL (`spelicon.cel` or `spelli2.cel`) into the icon background
+// and the icons without the background, as CLX lists.
+//
+// The frames are decoded, edited and encoded one at a time (see frame_pipeline.hpp),
+// without converting the whole CEL to CLX and back first.
+std::string ExtractSpellIcons(std::span<const uint8_t> celData, std::span<const uint16_t> widths,
     std::vector<uint8_t> &iconBackground, std::vector<uint8_t> &iconsWithoutBackground);
 
+// Replaces the pixels of an icon row that belong to the background row `bg` with the transparent color.
+// Uses SSE2 or NEON where available, `RemoveBackgroundRowScalar` for the rest of the row.
+void RemoveBackgroundRow(uint8_t *pixels, const uint8_t *bg, unsigned n);
+
+// The reference implementation of `RemoveBackgroundRow`, one pixel at a time.
+void RemoveBackgroundRowScalar(uint8_t *pixels, const uint8_t *bg, unsigned n);
+
 } // namespace devilution_mpq_tools
@@ -0,0 +1,138 @@
+#include "frame_pipeline.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <pixels2clx.hpp>
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+// Some CEL frames begin with a header of this size, starting with the size itself.
+constexpr size_t CelFrameHeaderSize = 10;
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void WriteLE32(uint8_t *out, uint32_t val)
+{
+	out[0] = static_cast<uint8_t>(val);
+	out[1] = static_cast<uint8_t>(val >> 8);
+	out[2] = static_cast<uint8_t>(val >> 16);
+	out[3] = static_cast<uint8_t>(val >> 24);
+}
+
+} // namespace
+
+std::string CelFrameDecoder::open(std::span<const uint8_t> cel, std::span<const uint16_t> widths)
+{
+	if (cel.size() < 4)
+		return "CEL file is truncated";
+	const uint32_t numFrames = LoadLE32(cel.data());
+	if (cel.size() / 4 < static_cast<size_t>(numFrames) + 2)
+		return "CEL frame offsets are truncated";
+	if (LoadLE32(&cel[4 + 4 * static_cast<size_t>(numFrames)]) != cel.size())
+		return "CEL files with frame groups are not supported";
+	if (widths.empty() || (widths.size() != 1 && widths.size() < numFrames))
+		return "not enough widths for the CEL frames";
+	cel_ = cel;
+	widths_ = widths;
+	numFrames_ = numFrames;
+	return "";
+}
+
+std::string CelFrameDecoder::decode(size_t frame, uint8_t transparentColor,
+    std::vector<uint8_t> &pixels, FramePixels &out) const
+{
+	const unsigned width = widths_.size() == 1 ? widths_[0] : widths_[frame];
+	const uint32_t begin = LoadLE32(&cel_[4 + 4 * frame]);
+	const uint32_t end = LoadLE32(&cel_[8 + 4 * frame]);
+	if (begin > end || end > cel_.size())
+		return "invalid CEL frame offsets";
+	const uint8_t *src = &cel_[begin];
+	const uint8_t *const srcEnd = &cel_[end];
+	if (static_cast<size_t>(srcEnd - src) >= CelFrameHeaderSize && src[0] == CelFrameHeaderSize && src[1] == 0)
+		src += CelFrameHeaderSize;
+
+	// The rows are stored bottom to top. Decode them in that order and flip at the end.
+	pixels.clear();
+	while (src < srcEnd) {
+		const auto control = static_cast<int8_t>(*src++);
+		if (control < 0) {
+			pixels.insert(pixels.end(), static_cast<size_t>(-control), transparentColor);
+			continue;
+		}
+		if (srcEnd - src < control)
+			return "CEL frame is truncated";
+		pixels.insert(pixels.end(), src, src + control);
+		src += control;
+	}
+	if (width == 0 || pixels.size() % width != 0)
+		return "CEL frame size is not a multiple of its width";
+	const auto height = static_cast<unsigned>(pixels.size() / width);
+	for (unsigned y = 0; y < height / 2; ++y) {
+		std::swap_ranges(&pixels[static_cast<size_t>(y) * width], &pixels[static_cast<size_t>(y + 1) * width],
+		    &pixels[static_cast<size_t>(height - 1 - y) * width]);
+	}
+	out = FramePixels { pixels.data(), width, height };
+	return "";
+}
+
+ClxListEncoder::ClxListEncoder(size_t numFrames, uint8_t transparentColor)
+    : numFrames_(numFrames)
+    , transparentColor_(transparentColor)
+    , out_(4 * (numFrames + 2))
+{
+	WriteLE32(out_.data(), static_cast<uint32_t>(numFrames));
+}
+
+void ClxListEncoder::addFrame(const FramePixels &frame)
+{
+	// Encode a single-frame list and take its only frame.
+	frameClx_.clear();
+	dvl_gfx::Pixels2Clx(frame.pixels, /*pitch=*/frame.width, frame.width, frame.height, /*numFrames=*/1,
+	    transparentColor_, frameClx_);
+	const uint32_t frameBegin = LoadLE32(&frameClx_[4]);
+	const uint32_t frameEnd = LoadLE32(&frameClx_[8]);
+	addEncodedFrame({ frameClx_.data() + frameBegin, frameClx_.data() + frameEnd });
+}
+
+void ClxListEncoder::addEncodedFrame(std::span<const uint8_t> frame)
+{
+	WriteLE32(&out_[4 + 4 * numAdded_], static_cast<uint32_t>(out_.size()));
+	out_.insert(out_.end(), frame.begin(), frame.end());
+	++numAdded_;
+}
+
+std::vector<uint8_t> ClxListEncoder::finish()
+{
+	WriteLE32(&out_[4 + 4 * numFrames_], static_cast<uint32_t>(out_.size()));
+	return std::move(out_);
+}
+
+std::string TransformCelFrames(const CelFrameDecoder &decoder, size_t numFrames,
+    uint8_t transparentColor, const FrameTransform &transform, std::vector<uint8_t> &clxData)
+{
+	if (numFrames > decoder.numFrames())
+		return "not enough frames";
+	ClxListEncoder encoder { numFrames, transparentColor };
+	std::vector<uint8_t> buffer;
+	for (size_t i = 0; i < numFrames; ++i) {
+		FramePixels frame;
+		std::string error = decoder.decode(i, transparentColor, buffer, frame);
+		if (error.empty())
+			error = transform(i, frame);
+		if (!error.empty())
+			return "frame " + std::to_string(i) + ": " + error;
+		encoder.addFrame(frame);
+	}
+	clxData = encoder.finish();
+	return "";
+}
+
+} // namespace devilution_mpq_tools
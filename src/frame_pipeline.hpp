@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// A decoded frame: `width * height` palette indices, top row first.
+struct FramePixels {
+	uint8_t *pixels;
+	unsigned width;
+	unsigned height;
+};
+
+// Decodes the frames of a CEL file one at a time, in any order.
+//
+// Only single-group CEL files are supported.
+class CelFrameDecoder {
+public:
+	// `widths` is either a width per frame or a single width for all the frames.
+	// Returns an error message on failure.
+	[[nodiscard]] std::string open(std::span<const uint8_t> cel, std::span<const uint16_t> widths);
+
+	[[nodiscard]] size_t numFrames() const
+	{
+		return numFrames_;
+	}
+
+	// Decodes the frame into `pixels`, with the transparent pixels set to `transparentColor`.
+	// `pixels` is resized as needed, so that it can be reused across frames.
+	[[nodiscard]] std::string decode(size_t frame, uint8_t transparentColor,
+	    std::vector<uint8_t> &pixels, FramePixels &out) const;
+
+private:
+	std::span<const uint8_t> cel_;
+	std::span<const uint16_t> widths_;
+	size_t numFrames_ = 0;
+};
+
+// Encodes a CLX list a frame at a time.
+class ClxListEncoder {
+public:
+	ClxListEncoder(size_t numFrames, uint8_t transparentColor);
+
+	void addFrame(const FramePixels &frame);
+
+	// Adds a frame that is already CLX-encoded, e.g. taken from another list as is.
+	void addEncodedFrame(std::span<const uint8_t> frame);
+
+	// Returns the encoded list. All the frames must have been added.
+	std::vector<uint8_t> finish();
+
+private:
+	size_t numFrames_;
+	uint8_t transparentColor_;
+	size_t numAdded_ = 0;
+	std::vector<uint8_t> frameClx_;
+	std::vector<uint8_t> out_;
+};
+
+// Edits a decoded frame in-place. Returns an error message on failure.
+using FrameTransform = std::function<std::string(size_t frame, FramePixels &pixels)>;
+
+// Decodes the first `numFrames` frames of `decoder`, passes each to `transform`, and encodes the result
+// into a CLX list, one frame at a time, reusing a single frame buffer.
+[[nodiscard]] std::string TransformCelFrames(const CelFrameDecoder &decoder, size_t numFrames,
+    uint8_t transparentColor, const FrameTransform &transform, std::vector<uint8_t> &clxData);
+
+} // namespace devilution_mpq_tools
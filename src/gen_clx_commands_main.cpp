@@ -0,0 +1,548 @@
+// Parses the CLX conversion commands of `data/*-clx.txt` and generates their tables
+// (see clx_commands.hpp) as a C++ source file.
+//
+// Usage: gen_clx_commands OUTPUT NAME=COMMANDS_FILE...
+//
+// Exits with an error on a malformed command file, failing the build.
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "clx_commands.hpp"
+
+namespace {
+
+using devilution_mpq_tools::ClxAutoCrop;
+using devilution_mpq_tools::ClxCommandKind;
+using devilution_mpq_tools::ClxFrameTransform;
+using devilution_mpq_tools::ClxNoEntry;
+using devilution_mpq_tools::ClxPathHash;
+using devilution_mpq_tools::ClxSlotHash;
+
+struct ParseError {
+	std::string message;
+};
+
+struct Command {
+	ClxCommandKind kind;
+	std::vector<uint16_t> widths;
+	size_t numFrames = 1;
+	std::optional<uint8_t> transparentColor;
+	bool exportPalette = false;
+	ClxFrameTransform transform = ClxFrameTransform::None;
+	ClxAutoCrop autoCrop = ClxAutoCrop::None;
+
+	[[nodiscard]] std::string describe() const
+	{
+		std::string result;
+		switch (kind) {
+		case ClxCommandKind::Cl2ToClx:
+		case ClxCommandKind::CelToClx:
+			result = kind == ClxCommandKind::Cl2ToClx ? "cl22clx --width " : "cel2clx --width ";
+			for (size_t i = 0; i < widths.size(); ++i) {
+				if (i != 0)
+					result.append(",");
+				result.append(std::to_string(widths[i]));
+			}
+			if (transform == ClxFrameTransform::SpellIcons)
+				result.append(" --transform spell-icons");
+			break;
+		case ClxCommandKind::PcxToClx:
+			result = "pcx2clx --num-sprites " + std::to_string(numFrames);
+			if (transparentColor.has_value())
+				result.append(" --transparent-color " + std::to_string(*transparentColor));
+			if (exportPalette)
+				result.append(" --export-palette");
+			break;
+		case ClxCommandKind::DedupTiles:
+			result = "dedup-tiles";
+			break;
+		}
+		if (autoCrop != ClxAutoCrop::None)
+			result.append(autoCrop == ClxAutoCrop::Frames ? " --auto-crop frames" : " --auto-crop list");
+		return result;
+	}
+};
+
+struct Line {
+	Command command;
+	std::vector<std::string> files;
+	bool combine = false;
+	std::string output;
+};
+
+template <typename IntT>
+IntT ParseInt(std::string_view str)
+{
+	IntT result;
+	auto [ptr, ec] { std::from_chars(str.begin(), str.end(), result) };
+	if (ec == std::errc::result_out_of_range) {
+		throw ParseError { "expected a number between " + std::to_string(std::numeric_limits<IntT>::min())
+			+ " and " + std::to_string(std::numeric_limits<IntT>::max()) + ", got " + std::string(str) };
+	}
+	if (ec != std::errc() || ptr != str.end())
+		throw ParseError { "expected a number, got " + std::string(str) };
+	return result;
+}
+
+std::vector<uint16_t> ParseWidths(std::string_view str)
+{
+	std::vector<uint16_t> result;
+	while (true) {
+		const std::string_view::size_type commaPos = str.find(',');
+		result.push_back(ParseInt<uint16_t>(str.substr(0, commaPos)));
+		if (commaPos == std::string_view::npos)
+			break;
+		str.remove_prefix(commaPos + 1);
+	}
+	return result;
+}
+
+// Whether `path` is relative, with / as the separator, and stays within the output directory.
+bool IsOutputRelativePath(std::string_view path)
+{
+	if (path.find('\\') != std::string_view::npos)
+		return false;
+	while (true) {
+		const std::string_view::size_type slashPos = path.find('/');
+		const std::string_view component = path.substr(0, slashPos);
+		if (component.empty() || component == "." || component == "..")
+			return false;
+		if (slashPos == std::string_view::npos)
+			return true;
+		path.remove_prefix(slashPos + 1);
+	}
+}
+
+std::optional<Line> ParseLine(std::string_view line)
+{
+	std::vector<std::string_view> args;
+	while (!line.empty()) {
+		const std::string_view arg = line.substr(0, line.find(' '));
+		line.remove_prefix(std::min(arg.size() + 1, line.size()));
+		if (!arg.empty())
+			args.push_back(arg);
+	}
+	if (args.empty() || args[0][0] == '#')
+		return std::nullopt;
+
+	Line result;
+	if (args[0] == "cl22clx") {
+		result.command.kind = ClxCommandKind::Cl2ToClx;
+	} else if (args[0] == "cel2clx") {
+		result.command.kind = ClxCommandKind::CelToClx;
+	} else if (args[0] == "pcx2clx") {
+		result.command.kind = ClxCommandKind::PcxToClx;
+	} else if (args[0] == "dedup-tiles") {
+		result.command.kind = ClxCommandKind::DedupTiles;
+		result.combine = true;
+	} else {
+		throw ParseError { "unknown command: " + std::string(args[0]) };
+	}
+	const bool hasWidths = result.command.kind == ClxCommandKind::Cl2ToClx || result.command.kind == ClxCommandKind::CelToClx;
+	const bool isPcx = result.command.kind == ClxCommandKind::PcxToClx;
+	for (size_t i = 1; i < args.size(); ++i) {
+		const std::string_view arg = args[i];
+		const auto value = [&]() {
+			if (i + 1 == args.size())
+				throw ParseError { std::string(arg) + " requires a value" };
+			return args[++i];
+		};
+		if (hasWidths && arg == "--width") {
+			result.command.widths = ParseWidths(value());
+		} else if (result.command.kind != ClxCommandKind::DedupTiles && arg == "--combine") {
+			result.combine = true;
+		} else if (result.command.kind != ClxCommandKind::DedupTiles && arg == "--output") {
+			result.output = value();
+		} else if (result.command.kind == ClxCommandKind::CelToClx && arg == "--transform") {
+			const std::string_view name = value();
+			if (name != "spell-icons")
+				throw ParseError { "unknown transform: " + std::string(name) };
+			result.command.transform = ClxFrameTransform::SpellIcons;
+		} else if ((isPcx || result.command.kind == ClxCommandKind::CelToClx) && arg == "--auto-crop") {
+			const std::string_view mode = value();
+			if (mode == "frames") {
+				result.command.autoCrop = ClxAutoCrop::Frames;
+			} else if (mode == "list") {
+				result.command.autoCrop = ClxAutoCrop::List;
+			} else {
+				throw ParseError { "unknown --auto-crop mode: " + std::string(mode) };
+			}
+		} else if (isPcx && arg == "--num-sprites") {
+			result.command.numFrames = ParseInt<size_t>(value());
+			if (result.command.numFrames == 0)
+				throw ParseError { "--num-sprites must be at least 1" };
+		} else if (isPcx && arg == "--transparent-color") {
+			result.command.transparentColor = ParseInt<uint8_t>(value());
+		} else if (isPcx && arg == "--export-palette") {
+			result.command.exportPalette = true;
+		} else if (arg[0] == '-') {
+			throw ParseError { "unknown argument: " + std::string(arg) };
+		} else {
+			result.files.emplace_back(arg);
+		}
+	}
+	if (hasWidths && result.command.widths.empty())
+		throw ParseError { std::string(args[0]) + " requires --width" };
+	if (result.files.empty())
+		throw ParseError { "no files" };
+	if (result.command.autoCrop != ClxAutoCrop::None && result.command.transform != ClxFrameTransform::None)
+		throw ParseError { "--auto-crop cannot be combined with --transform" };
+	if (result.combine && result.command.kind != ClxCommandKind::DedupTiles) {
+		// Each of these produces more than a single CLX list per file.
+		if (result.command.transform != ClxFrameTransform::None)
+			throw ParseError { "--combine cannot be used with --transform" };
+		if (result.command.autoCrop != ClxAutoCrop::None)
+			throw ParseError { "--combine cannot be used with --auto-crop" };
+		if (result.command.exportPalette)
+			throw ParseError { "--combine cannot be used with --export-palette" };
+	}
+	if (!result.output.empty()) {
+		if (!result.combine)
+			throw ParseError { "--output requires --combine" };
+		if (!IsOutputRelativePath(result.output) || !result.output.ends_with(".clx"))
+			throw ParseError { "--output must be a relative path with / as the separator, without . or .., ending in .clx: " + result.output };
+	}
+	if (result.command.kind == ClxCommandKind::DedupTiles
+	    && (result.files.size() != 2 || !result.files[0].ends_with(".cel") || !result.files[1].ends_with(".min")))
+		throw ParseError { "dedup-tiles requires a .cel file and a .min file" };
+	return result;
+}
+
+struct Table {
+	std::string name;
+	std::vector<Command> commands;
+
+	struct Group {
+		std::vector<std::string> files;
+		std::vector<size_t> commands;
+		std::string output;
+	};
+	std::vector<Group> groups;
+
+	struct Entry {
+		std::string path;
+		size_t command;
+		std::optional<size_t> group;
+	};
+	std::vector<Entry> entries;
+
+	std::vector<uint32_t> displacements;
+	std::vector<uint16_t> slots;
+};
+
+size_t AddCommand(Table &table, Command &&command)
+{
+	const std::string description = command.describe();
+	for (size_t i = 0; i < table.commands.size(); ++i) {
+		if (table.commands[i].describe() == description)
+			return i;
+	}
+	table.commands.push_back(std::move(command));
+	return table.commands.size() - 1;
+}
+
+void ParseTable(std::istream &in, Table &table)
+{
+	std::unordered_set<std::string> seen;
+	// The lines with the same `--output` are combined into the same group.
+	std::map<std::string, size_t> groupsByOutput;
+	std::string lineStr;
+	for (size_t lineNumber = 1; std::getline(in, lineStr); ++lineNumber) {
+		if (!lineStr.empty() && lineStr.back() == '\r')
+			lineStr.pop_back();
+		try {
+			std::optional<Line> line = ParseLine(lineStr);
+			if (!line.has_value())
+				continue;
+			const size_t command = AddCommand(table, std::move(line->command));
+			std::optional<size_t> group;
+			if (line->combine) {
+				if (!line->output.empty()) {
+					const auto [it, inserted] = groupsByOutput.try_emplace(line->output, table.groups.size());
+					group = it->second;
+				} else {
+					group = table.groups.size();
+				}
+				if (*group == table.groups.size())
+					table.groups.push_back(Table::Group { {}, {}, line->output });
+				Table::Group &g = table.groups[*group];
+				if ((table.commands[g.commands.empty() ? command : g.commands[0]].kind == ClxCommandKind::DedupTiles)
+				    != (table.commands[command].kind == ClxCommandKind::DedupTiles))
+					throw ParseError { "dedup-tiles cannot share an --output with a CLX conversion" };
+				for (const std::string &file : line->files) {
+					g.files.push_back(file);
+					g.commands.push_back(command);
+				}
+			}
+			for (std::string &file : line->files) {
+				if (file.find('\\') != std::string::npos)
+					throw ParseError { "use / as the path separator: " + file };
+				if (!seen.insert(file).second)
+					throw ParseError { "more than 1 CLX conversion command for " + file };
+				table.entries.push_back(Table::Entry { std::move(file), command, group });
+			}
+		} catch (const ParseError &e) {
+			throw ParseError { std::to_string(lineNumber) + ": " + e.message };
+		}
+	}
+}
+
+// Hash and displace: the paths are split into buckets, and each bucket, largest first,
+// gets the first displacement that maps all of its paths to free slots.
+void BuildIndex(Table &table)
+{
+	const size_t n = table.entries.size();
+	if (n == 0)
+		return;
+	if (n >= ClxNoEntry)
+		throw ParseError { "too many entries" };
+	const size_t numBuckets = (n + 3) / 4;
+	table.slots.assign(std::bit_ceil(n + n / 4 + 1), ClxNoEntry);
+	table.displacements.assign(numBuckets, 0);
+
+	std::vector<std::vector<uint16_t>> buckets(numBuckets);
+	for (size_t i = 0; i < n; ++i)
+		buckets[(ClxPathHash(table.entries[i].path) >> 32) % numBuckets].push_back(static_cast<uint16_t>(i));
+	std::vector<size_t> order(numBuckets);
+	for (size_t i = 0; i < numBuckets; ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return buckets[a].size() > buckets[b].size();
+	});
+
+	const size_t mask = table.slots.size() - 1;
+	std::vector<size_t> bucketSlots;
+	for (const size_t bucket : order) {
+		if (buckets[bucket].empty())
+			break;
+		bool placed = false;
+		for (uint32_t displacement = 0; displacement < (1U << 24) && !placed; ++displacement) {
+			bucketSlots.clear();
+			placed = true;
+			for (const uint16_t entry : buckets[bucket]) {
+				const size_t slot = ClxSlotHash(ClxPathHash(table.entries[entry].path), displacement) & mask;
+				if (table.slots[slot] != ClxNoEntry
+				    || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end()) {
+					placed = false;
+					break;
+				}
+				bucketSlots.push_back(slot);
+			}
+			if (placed) {
+				table.displacements[bucket] = displacement;
+				for (size_t i = 0; i < bucketSlots.size(); ++i)
+					table.slots[bucketSlots[i]] = buckets[bucket][i];
+			}
+		}
+		if (!placed)
+			throw ParseError { "failed to build the perfect hash index" };
+	}
+}
+
+void WriteStringLiteral(std::ostream &out, std::string_view str)
+{
+	out << '"';
+	for (const char c : str) {
+		if (c == '"' || c == '\\')
+			out << '\\';
+		out << c;
+	}
+	out << '"';
+}
+
+void WriteTable(std::ostream &out, const Table &table)
+{
+	const std::string &name = table.name;
+	if (table.entries.empty()) {
+		out << "constexpr ClxCommandTable " << name << "_table {};\n\n";
+		return;
+	}
+	for (size_t i = 0; i < table.commands.size(); ++i) {
+		const Command &command = table.commands[i];
+		if (command.widths.empty())
+			continue;
+		out << "constexpr uint16_t " << name << "_widths_" << i << "[] = { ";
+		for (size_t j = 0; j < command.widths.size(); ++j)
+			out << (j == 0 ? "" : ", ") << command.widths[j];
+		out << " };\n";
+	}
+	out << "constexpr ClxCommand " << name << "_commands[] = {\n";
+	for (size_t i = 0; i < table.commands.size(); ++i) {
+		const Command &command = table.commands[i];
+		out << "\t{ ClxCommandKind::";
+		switch (command.kind) {
+		case ClxCommandKind::Cl2ToClx:
+			out << "Cl2ToClx";
+			break;
+		case ClxCommandKind::CelToClx:
+			out << "CelToClx";
+			break;
+		case ClxCommandKind::PcxToClx:
+			out << "PcxToClx";
+			break;
+		case ClxCommandKind::DedupTiles:
+			out << "DedupTiles";
+			break;
+		}
+		out << ", ";
+		if (command.widths.empty()) {
+			out << "{}";
+		} else {
+			out << name << "_widths_" << i;
+		}
+		out << ", " << command.numFrames << ", ";
+		if (command.transparentColor.has_value()) {
+			out << static_cast<unsigned>(*command.transparentColor);
+		} else {
+			out << "std::nullopt";
+		}
+		out << ", " << (command.exportPalette ? "true" : "false") << ", ClxFrameTransform::"
+		    << (command.transform == ClxFrameTransform::SpellIcons ? "SpellIcons" : "None") << ", ClxAutoCrop::";
+		switch (command.autoCrop) {
+		case ClxAutoCrop::None:
+			out << "None";
+			break;
+		case ClxAutoCrop::Frames:
+			out << "Frames";
+			break;
+		case ClxAutoCrop::List:
+			out << "List";
+			break;
+		}
+		out << ", ";
+		WriteStringLiteral(out, command.describe());
+		out << " },\n";
+	}
+	out << "};\n";
+
+	for (size_t i = 0; i < table.groups.size(); ++i) {
+		const Table::Group &group = table.groups[i];
+		out << "constexpr std::string_view " << name << "_group_" << i << "_files[] = {\n";
+		for (const std::string &file : group.files) {
+			out << "\t";
+			WriteStringLiteral(out, file);
+			out << ",\n";
+		}
+		out << "};\n";
+		out << "constexpr const ClxCommand *" << name << "_group_" << i << "_commands[] = {";
+		for (size_t j = 0; j < group.commands.size(); ++j)
+			out << (j % 8 == 0 ? "\n\t" : " ") << "&" << name << "_commands[" << group.commands[j] << "],";
+		out << "\n};\n";
+	}
+	if (!table.groups.empty()) {
+		out << "constexpr ClxCombineGroup " << name << "_groups[] = {\n";
+		for (size_t i = 0; i < table.groups.size(); ++i) {
+			const std::string prefix = name + "_group_" + std::to_string(i);
+			out << "\t{ &" << name << "_commands[" << table.groups[i].commands[0] << "], " << prefix << "_files, "
+			    << prefix << "_commands, ";
+			WriteStringLiteral(out, table.groups[i].output);
+			out << " },\n";
+		}
+		out << "};\n";
+	}
+
+	out << "constexpr ClxCommandEntry " << name << "_entries[] = {\n";
+	for (const Table::Entry &entry : table.entries) {
+		out << "\t{ ";
+		WriteStringLiteral(out, entry.path);
+		out << ", &" << name << "_commands[" << entry.command << "], ";
+		if (entry.group.has_value()) {
+			out << "&" << name << "_groups[" << *entry.group << "]";
+		} else {
+			out << "nullptr";
+		}
+		out << " },\n";
+	}
+	out << "};\n";
+
+	out << "constexpr uint32_t " << name << "_displacements[] = {";
+	for (size_t i = 0; i < table.displacements.size(); ++i)
+		out << (i % 16 == 0 ? "\n\t" : " ") << table.displacements[i] << ",";
+	out << "\n};\n";
+	out << "constexpr uint16_t " << name << "_slots[] = {";
+	for (size_t i = 0; i < table.slots.size(); ++i)
+		out << (i % 16 == 0 ? "\n\t" : " ") << table.slots[i] << ",";
+	out << "\n};\n";
+
+	out << "constexpr ClxCommandTable " << name << "_table {\n"
+	    << "\t" << name << "_commands,\n"
+	    << "\t" << (table.groups.empty() ? std::string("{}") : name + "_groups") << ",\n"
+	    << "\t" << name << "_entries,\n"
+	    << "\t" << name << "_displacements,\n"
+	    << "\t" << name << "_slots,\n"
+	    << "};\n\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cerr << "Usage: gen_clx_commands OUTPUT NAME=COMMANDS_FILE..." << std::endl;
+		return 1;
+	}
+	std::vector<Table> tables;
+	for (int i = 2; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		const size_t eqPos = arg.find('=');
+		if (eqPos == std::string_view::npos) {
+			std::cerr << "expected NAME=COMMANDS_FILE, got " << arg << std::endl;
+			return 1;
+		}
+		Table &table = tables.emplace_back();
+		table.name = arg.substr(0, eqPos);
+		const std::string path { arg.substr(eqPos + 1) };
+		std::ifstream in { path };
+		if (in.fail()) {
+			std::cerr << "failed to open " << path << std::endl;
+			return 1;
+		}
+		try {
+			ParseTable(in, table);
+			BuildIndex(table);
+		} catch (const ParseError &e) {
+			std::cerr << path << ":" << e.message << std::endl;
+			return 1;
+		}
+	}
+
+	std::ostringstream out;
+	out << "// Generated by gen_clx_commands. Do not edit.\n\n"
+	    << "#include \"clx_commands.hpp\"\n\n"
+	    << "namespace devilution_mpq_tools {\n\n"
+	    << "namespace {\n\n";
+	for (const Table &table : tables)
+		WriteTable(out, table);
+	out << "constexpr ClxCommandTable EmptyTable {};\n\n"
+	    << "} // namespace\n\n"
+	    << "const ClxCommandTable &GetClxCommandTable(std::string_view srcName)\n{\n";
+	for (const Table &table : tables) {
+		out << "\tif (srcName == ";
+		WriteStringLiteral(out, table.name);
+		out << ")\n\t\treturn " << table.name << "_table;\n";
+	}
+	out << "\treturn EmptyTable;\n}\n\n"
+	    << "} // namespace devilution_mpq_tools\n";
+
+	std::ofstream file { argv[1], std::ios::binary };
+	file << out.str();
+	file.close();
+	if (file.fail()) {
+		std::cerr << "failed to write " << argv[1] << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,112 @@
+// Generates the embedded listfiles (see mpq_listfile.hpp) as a C++ source file:
+// the paths of `data/*-listfile.txt` in a single string blob, and their MPQ hashes.
+//
+// Usage: gen_mpq_listfiles OUTPUT NAME=LISTFILE...
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mpq_crypt.hpp"
+
+namespace {
+
+using devilution_mpq_tools::HashMpqPath;
+using devilution_mpq_tools::MpqPathHashes;
+
+// Written as a list of numbers rather than a string literal,
+// because MSVC limits the size of string literals to 64 KiB.
+void WriteBlob(std::ostream &out, std::string_view blob)
+{
+	for (size_t i = 0; i < blob.size(); ++i)
+		out << (i % 24 == 0 ? "\n\t" : " ") << static_cast<unsigned>(static_cast<uint8_t>(blob[i])) << ",";
+	out << "\n";
+}
+
+void WriteListfile(std::ostream &out, const std::string &name, const std::vector<std::string> &paths)
+{
+	std::string blob;
+	std::vector<uint32_t> offsets;
+	for (const std::string &path : paths) {
+		offsets.push_back(static_cast<uint32_t>(blob.size()));
+		blob.append(path);
+		blob.push_back('\0');
+	}
+
+	out << "constexpr char " << name << "_strings[] = {";
+	WriteBlob(out, blob);
+	out << "};\n";
+	out << "constexpr uint32_t " << name << "_offsets[] = {";
+	for (size_t i = 0; i < offsets.size(); ++i)
+		out << (i % 12 == 0 ? "\n\t" : " ") << offsets[i] << ",";
+	out << "\n};\n";
+	out << "constexpr MpqPathHashes " << name << "_hashes[] = {\n" << std::hex;
+	for (const std::string &path : paths) {
+		const MpqPathHashes hashes = HashMpqPath(path);
+		out << "\t{ 0x" << hashes.tableOffset << ", 0x" << hashes.nameA
+		    << ", 0x" << hashes.nameB << ", 0x" << hashes.fileKey << " },\n";
+	}
+	out << std::dec << "};\n\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cerr << "Usage: gen_mpq_listfiles OUTPUT NAME=LISTFILE..." << std::endl;
+		return 1;
+	}
+	std::vector<std::string> names;
+	std::ostringstream out;
+	out << "// Generated by gen_mpq_listfiles. Do not edit.\n\n"
+	    << "#include \"mpq_listfile.hpp\"\n\n"
+	    << "namespace devilution_mpq_tools {\n\n"
+	    << "namespace {\n\n";
+	for (int i = 2; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		const size_t eqPos = arg.find('=');
+		if (eqPos == std::string_view::npos) {
+			std::cerr << "expected NAME=LISTFILE, got " << arg << std::endl;
+			return 1;
+		}
+		const std::string name { arg.substr(0, eqPos) };
+		const std::string path { arg.substr(eqPos + 1) };
+		std::ifstream in { path };
+		if (in.fail()) {
+			std::cerr << "failed to open " << path << std::endl;
+			return 1;
+		}
+		std::vector<std::string> paths;
+		std::string line;
+		while (std::getline(in, line)) {
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (!line.empty())
+				paths.push_back(std::move(line));
+		}
+		WriteListfile(out, name, paths);
+		names.push_back(name);
+	}
+	out << "} // namespace\n\n"
+	    << "MpqListfile GetEmbeddedListfile(std::string_view name)\n{\n";
+	for (const std::string &name : names) {
+		out << "\tif (name == \"" << name << "\")\n"
+		    << "\t\treturn { " << name << "_strings, " << name << "_offsets, " << name << "_hashes };\n";
+	}
+	out << "\treturn {};\n}\n\n"
+	    << "} // namespace devilution_mpq_tools\n";
+
+	std::ofstream file { argv[1], std::ios::binary };
+	file << out.str();
+	file.close();
+	if (file.fail()) {
+		std::cerr << "failed to write " << argv[1] << std::endl;
+		return 1;
+	}
+	return 0;
+}
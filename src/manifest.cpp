@@ -0,0 +1,199 @@
+#include "manifest.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr std::string_view ManifestHeader = "# unpack_and_minify_mpq manifest 1";
+
+uint64_t LoadLE64(const uint8_t *b)
+{
+	uint64_t result = 0;
+	for (int i = 7; i >= 0; --i)
+		result = (result << 8) | b[i];
+	return result;
+}
+
+// Splits off the next tab-separated field.
+std::string_view NextField(std::string_view &line)
+{
+	const size_t tabPos = line.find('\t');
+	const std::string_view field = line.substr(0, tabPos);
+	line.remove_prefix(tabPos == std::string_view::npos ? line.size() : tabPos + 1);
+	return field;
+}
+
+template <typename IntT>
+bool ParseField(std::string_view &line, IntT &out, int base = 10)
+{
+	const std::string_view field = NextField(line);
+	const auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), out, base);
+	return ec == std::errc() && ptr == field.data() + field.size();
+}
+
+} // namespace
+
+uint64_t HashBytes(std::span<const uint8_t> data, uint64_t seed)
+{
+	constexpr uint64_t M = 0xc6a4a7935bd1e995ULL;
+	constexpr int R = 47;
+	uint64_t h = seed ^ (data.size() * M);
+	const size_t numBlocks = data.size() / 8;
+	for (size_t i = 0; i < numBlocks; ++i) {
+		uint64_t k = LoadLE64(&data[i * 8]);
+		k *= M;
+		k ^= k >> R;
+		k *= M;
+		h ^= k;
+		h *= M;
+	}
+	const std::span<const uint8_t> tail = data.subspan(numBlocks * 8);
+	if (!tail.empty()) {
+		for (size_t i = tail.size(); i-- > 0;)
+			h ^= static_cast<uint64_t>(tail[i]) << (8 * i);
+		h *= M;
+	}
+	h ^= h >> R;
+	h *= M;
+	h ^= h >> R;
+	return h;
+}
+
+Manifest::Manifest(std::filesystem::path directory, bool ignoreExisting, std::string_view filename)
+    : directory_(std::move(directory))
+    , path_(directory_ / filename)
+{
+	if (!ignoreExisting)
+		load();
+}
+
+void Manifest::load()
+{
+	std::ifstream input { path_, std::ios::binary };
+	if (input.fail())
+		return;
+	std::string line;
+	if (!std::getline(input, line) || line != ManifestHeader || input.eof())
+		return;
+	completeSize_ = static_cast<uintmax_t>(input.tellg());
+	while (std::getline(input, line)) {
+		// The last line of an interrupted run can be truncated, even in a way that still parses.
+		// It has no newline, so it is ignored, and cut off before appending, see `record()`.
+		if (input.eof())
+			break;
+		completeSize_ = static_cast<uintmax_t>(input.tellg());
+		std::string_view remaining = line;
+		const std::string_view key = NextField(remaining);
+		Record record;
+		size_t numOutputs;
+		if (key.empty() || !ParseField(remaining, record.inputHash, 16) || !ParseField(remaining, numOutputs))
+			continue;
+		bool valid = true;
+		for (size_t i = 0; i < numOutputs && valid; ++i) {
+			ManifestOutput &output = record.outputs.emplace_back();
+			output.path = NextField(remaining);
+			valid = !output.path.empty() && ParseField(remaining, output.size);
+		}
+		if (valid && remaining.empty())
+			records_.insert_or_assign(std::string(key), std::move(record));
+	}
+}
+
+bool Manifest::isUpToDate(std::string_view key, uint64_t inputHash)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	const auto it = records_.find(std::string(key));
+	if (it == records_.end() || it->second.inputHash != inputHash)
+		return false;
+	const std::vector<ManifestOutput> outputs = it->second.outputs;
+	lock.unlock();
+	for (const ManifestOutput &output : outputs) {
+		std::error_code ec;
+		const uintmax_t size = std::filesystem::file_size(directory_ / output.path, ec);
+		if (ec || size != output.size)
+			return false;
+	}
+	return true;
+}
+
+std::optional<std::vector<ManifestOutput>> Manifest::outputs(std::string_view key)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	const auto it = records_.find(std::string(key));
+	if (it == records_.end())
+		return std::nullopt;
+	return it->second.outputs;
+}
+
+void Manifest::WriteRecord(std::ostream &out, std::string_view key, const Record &record)
+{
+	char hashStr[16];
+	const auto [hashEnd, ec] = std::to_chars(hashStr, hashStr + sizeof(hashStr), record.inputHash, 16);
+	out << key << "\t" << std::string_view(hashStr, hashEnd - hashStr) << "\t" << record.outputs.size();
+	for (const ManifestOutput &output : record.outputs)
+		out << "\t" << output.path << "\t" << output.size;
+	out << "\n";
+}
+
+void Manifest::openJournal(std::ios::openmode mode)
+{
+	std::filesystem::create_directories(directory_);
+	journal_.open(path_, std::ios::binary | mode);
+	if (journal_.fail()) {
+		std::cerr << "Failed to open " << path_ << " for writing: " << std::strerror(errno) << std::endl;
+		std::exit(1);
+	}
+}
+
+void Manifest::record(std::string_view key, uint64_t inputHash, std::vector<ManifestOutput> outputs)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (!journal_.is_open()) {
+		// Start a fresh journal if the existing one was ignored or unreadable.
+		const bool append = !records_.empty();
+		if (append) {
+			std::error_code ec;
+			std::filesystem::resize_file(path_, completeSize_, ec);
+		}
+		openJournal(append ? std::ios::app : std::ios::trunc);
+		if (!append)
+			journal_ << ManifestHeader << "\n";
+	}
+	Record record { inputHash, std::move(outputs) };
+	WriteRecord(journal_, key, record);
+	journal_.flush();
+	records_.insert_or_assign(std::string(key), std::move(record));
+}
+
+void Manifest::compact()
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (journal_.is_open())
+		journal_.close();
+	const std::filesystem::path tmpPath = std::filesystem::path(path_).concat(".tmp");
+	std::error_code ec;
+	std::filesystem::create_directories(directory_, ec);
+	{
+		std::ofstream out { tmpPath, std::ios::binary | std::ios::trunc };
+		out << ManifestHeader << "\n";
+		for (const auto &[key, record] : records_)
+			WriteRecord(out, key, record);
+		out.close();
+		if (out.fail()) {
+			std::cerr << "Failed to write " << tmpPath << ": " << std::strerror(errno) << std::endl;
+			return;
+		}
+	}
+	std::filesystem::rename(tmpPath, path_, ec);
+	if (ec)
+		std::cerr << "Failed to rename " << tmpPath << " to " << path_ << ": " << ec.message() << std::endl;
+}
+
+} // namespace devilution_mpq_tools
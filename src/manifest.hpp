@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// A fast non-cryptographic 64-bit hash (MurmurHash64A).
+// Pass the previous result as `seed` to hash several pieces of data.
+uint64_t HashBytes(std::span<const uint8_t> data, uint64_t seed = 0);
+
+inline uint64_t HashString(std::string_view str, uint64_t seed = 0)
+{
+	return HashBytes({ reinterpret_cast<const uint8_t *>(str.data()), str.size() }, seed);
+}
+
+// The name of the manifest file in the output directory.
+inline constexpr std::string_view DefaultManifestFilename = ".unpack_and_minify_mpq.manifest";
+
+struct ManifestOutput {
+	// Relative to the manifest's directory, with forward slashes.
+	std::string path;
+	uintmax_t size;
+};
+
+// Records the outputs of each unit of work together with a hash of everything they were produced from.
+// Allows skipping the work that is still up to date on the next run.
+//
+// The manifest file is also a journal: a record is appended and flushed as soon as its work completes,
+// so an interrupted run can resume where it stopped. `compact()` rewrites it without the superseded records.
+//
+// All methods are thread-safe.
+class Manifest {
+public:
+	// Loads the manifest from `directory / filename` if present.
+	// If `ignoreExisting` is true, the existing records are discarded.
+	Manifest(std::filesystem::path directory, bool ignoreExisting, std::string_view filename = DefaultManifestFilename);
+
+	// Whether the record for `key` has the given input hash and all of its outputs still exist.
+	[[nodiscard]] bool isUpToDate(std::string_view key, uint64_t inputHash);
+
+	// The outputs recorded for `key`, or `std::nullopt` if there is no record for it.
+	[[nodiscard]] std::optional<std::vector<ManifestOutput>> outputs(std::string_view key);
+
+	// Appends a record to the journal.
+	void record(std::string_view key, uint64_t inputHash, std::vector<ManifestOutput> outputs);
+
+	// Rewrites the manifest file with only the latest record for each key.
+	// Writes it even if there are no records, e.g. for a shard that had nothing to do, see `ShardManifestFilename`.
+	void compact();
+
+private:
+	struct Record {
+		uint64_t inputHash;
+		std::vector<ManifestOutput> outputs;
+	};
+
+	static void WriteRecord(std::ostream &out, std::string_view key, const Record &record);
+
+	void load();
+	void openJournal(std::ios::openmode mode);
+
+	std::filesystem::path directory_;
+	std::filesystem::path path_;
+	std::mutex mutex_;
+	std::unordered_map<std::string, Record> records_;
+	// The size of the loaded file up to the end of its last complete line.
+	uintmax_t completeSize_ = 0;
+	std::ofstream journal_;
+};
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,106 @@
+#include "mpq_archive.hpp"
+
+#include <optional>
+
+#include <libmpq/mpq.h>
+
+namespace devilution_mpq_tools {
+
+MpqArchive::MpqArchive(const std::filesystem::path &path, const MpqReader &reader, bool verifyDecompression)
+    : path_(path)
+    , reader_(&reader)
+{
+	decompressor_.setVerify(verifyDecompression);
+}
+
+MpqArchive::~MpqArchive()
+{
+	closeLibmpqArchive();
+}
+
+void MpqArchive::reset(const std::filesystem::path &path, const MpqReader &reader)
+{
+	closeLibmpqArchive();
+	path_ = path;
+	reader_ = &reader;
+}
+
+void MpqArchive::closeLibmpqArchive()
+{
+	// Closing only frees the archive's memory, there is nothing to report.
+	if (archive_ != nullptr)
+		libmpq__archive_close(archive_);
+	archive_ = nullptr;
+}
+
+std::string MpqArchive::findFile(const char *mpqPath, uint32_t &blockIndex) const
+{
+	const std::optional<uint32_t> block = reader_->findBlock(mpqPath);
+	if (!block.has_value())
+		return libmpq__strerror(LIBMPQ_ERROR_EXIST);
+	blockIndex = *block;
+	return "";
+}
+
+std::string MpqArchive::readFile(uint32_t blockIndex, const char *mpqPath, uint32_t fileKey, uint8_t *buf, bool decrypt)
+{
+	std::string error;
+	switch (reader_->readBlock(blockIndex, fileKey, decrypt, buf, decompressor_, error)) {
+	case MpqReader::ReadResult::Ok:
+		return "";
+	case MpqReader::ReadResult::Unsupported:
+		return readFileWithLibmpq(mpqPath, fileSize(blockIndex), buf, decrypt);
+	case MpqReader::ReadResult::Error:
+		break;
+	}
+	return error;
+}
+
+std::string MpqArchive::readFile(const char *mpqPath, std::vector<uint8_t> &buf, bool decrypt)
+{
+	uint32_t blockIndex;
+	if (std::string error = findFile(mpqPath, blockIndex); !error.empty())
+		return error;
+	buf.resize(fileSize(blockIndex));
+	return readFile(blockIndex, mpqPath, MpqFileKey(mpqPath), buf.data(), decrypt);
+}
+
+std::string MpqArchive::readSectors(uint32_t blockIndex, uint32_t fileKey, uint32_t firstSector, uint32_t endSector, uint8_t *buf)
+{
+	std::string error;
+	if (reader_->readSectors(blockIndex, fileKey, /*decrypt=*/true, firstSector, endSector, buf, decompressor_, error)
+	    != MpqReader::ReadResult::Ok
+	    && error.empty())
+		error = "not supported";
+	return error;
+}
+
+std::string MpqArchive::readFileWithLibmpq(const char *mpqPath, size_t size, uint8_t *buf, bool decrypt)
+{
+	int32_t error;
+	if (archive_ == nullptr) {
+		error = libmpq__archive_open(&archive_, path_.string().c_str(), 0);
+		if (error != 0) {
+			archive_ = nullptr;
+			return std::string("failed to open the MPQ with libmpq: ") + libmpq__strerror(error);
+		}
+	}
+	uint32_t fileNumber;
+	error = libmpq__file_number(archive_, mpqPath, &fileNumber);
+	if (error != 0)
+		return libmpq__strerror(error);
+	if (tmpBuf_.size() < size)
+		tmpBuf_.resize(size);
+	if (decrypt) {
+		error = libmpq__file_read_with_filename_and_temporary_buffer(
+		    archive_, fileNumber, mpqPath, buf, size, tmpBuf_.data(), size, /*transferred=*/nullptr);
+	} else {
+		error = libmpq__file_read_with_temporary_buffer(
+		    archive_, fileNumber, buf, size, tmpBuf_.data(), size, /*transferred=*/nullptr);
+	}
+	if (error != 0)
+		return libmpq__strerror(error);
+	return "";
+}
+
+} // namespace devilution_mpq_tools
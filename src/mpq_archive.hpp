@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "mpq_decompress.hpp"
+#include "mpq_reader.hpp"
+
+struct mpq_archive;
+
+namespace devilution_mpq_tools {
+
+// Reads files via the shared memory-mapped `MpqReader`,
+// falling back to libmpq for the files that it does not handle.
+//
+// All the methods that can fail return an error message, empty on success.
+//
+// Not thread-safe: each thread must use its own `MpqArchive`.
+class MpqArchive {
+public:
+	MpqArchive(const std::filesystem::path &path, const MpqReader &reader, bool verifyDecompression = false);
+	~MpqArchive();
+
+	MpqArchive(const MpqArchive &) = delete;
+	MpqArchive &operator=(const MpqArchive &) = delete;
+
+	// Switches to another archive, keeping the buffers, so that a thread can read
+	// many small archives (e.g. save files) one after another without reallocating them.
+	void reset(const std::filesystem::path &path, const MpqReader &reader);
+
+	[[nodiscard]] const MpqReader &reader() const
+	{
+		return *reader_;
+	}
+
+	// Sets `blockIndex` to the block of the file. Fails if the file is not in the archive.
+	std::string findFile(const char *mpqPath, uint32_t &blockIndex) const;
+
+	[[nodiscard]] size_t fileSize(uint32_t blockIndex) const
+	{
+		return reader_->block(blockIndex).unpackedSize;
+	}
+
+	// Reads the whole file into `buf`, which must have room for `fileSize(blockIndex)` bytes.
+	// `fileKey` is the precomputed `MpqFileKey(mpqPath)`.
+	std::string readFile(uint32_t blockIndex, const char *mpqPath, uint32_t fileKey, uint8_t *buf, bool decrypt = true);
+
+	// Looks up and reads the whole file, resizing `buf` to its size.
+	std::string readFile(const char *mpqPath, std::vector<uint8_t> &buf, bool decrypt = true);
+
+	// Reads the `[firstSector, endSector)` sectors of a file into their place in `buf`, see `MpqReader::readSectors`.
+	// Only for the files that `MpqReader::isSupported`.
+	std::string readSectors(uint32_t blockIndex, uint32_t fileKey, uint32_t firstSector, uint32_t endSector, uint8_t *buf);
+
+private:
+	std::string readFileWithLibmpq(const char *mpqPath, size_t size, uint8_t *buf, bool decrypt);
+
+	void closeLibmpqArchive();
+
+	std::filesystem::path path_;
+	const MpqReader *reader_;
+	MpqDecompressor decompressor_;
+
+	// Only opened if needed for a fallback read.
+	mpq_archive *archive_ = nullptr;
+	std::vector<uint8_t> tmpBuf_;
+};
+
+} // namespace devilution_mpq_tools
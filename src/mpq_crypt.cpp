@@ -0,0 +1,49 @@
+#include "mpq_crypt.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void WriteLE32(uint8_t *b, uint32_t val)
+{
+	b[0] = static_cast<uint8_t>(val);
+	b[1] = static_cast<uint8_t>(val >> 8);
+	b[2] = static_cast<uint8_t>(val >> 16);
+	b[3] = static_cast<uint8_t>(val >> 24);
+}
+
+} // namespace
+
+void MpqDecryptBlock(std::span<uint8_t> data, uint32_t key)
+{
+	uint32_t seed = 0xEEEEEEEE;
+	for (size_t i = 0, n = data.size() / 4; i < n; ++i) {
+		uint8_t *word = &data[i * 4];
+		seed += MpqCryptTable[0x400 + (key & 0xFF)];
+		const uint32_t ch = LoadLE32(word) ^ (key + seed);
+		key = ((~key << 0x15) + 0x11111111) | (key >> 0x0B);
+		seed = ch + seed + (seed << 5) + 3;
+		WriteLE32(word, ch);
+	}
+}
+
+void MpqEncryptBlock(std::span<uint8_t> data, uint32_t key)
+{
+	uint32_t seed = 0xEEEEEEEE;
+	for (size_t i = 0, n = data.size() / 4; i < n; ++i) {
+		uint8_t *word = &data[i * 4];
+		seed += MpqCryptTable[0x400 + (key & 0xFF)];
+		const uint32_t ch = LoadLE32(word);
+		WriteLE32(word, ch ^ (key + seed));
+		key = ((~key << 0x15) + 0x11111111) | (key >> 0x0B);
+		seed = ch + seed + (seed << 5) + 3;
+	}
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace devilution_mpq_tools {
+
+// The hash types used by the MPQ format, as offsets into the crypt table.
+enum class MpqHashType : uint16_t {
+	TableOffset = 0x000,
+	NameA = 0x100,
+	NameB = 0x200,
+	FileKey = 0x300,
+};
+
+constexpr std::array<uint32_t, 0x500> GenerateMpqCryptTable()
+{
+	std::array<uint32_t, 0x500> result {};
+	uint32_t seed = 0x00100001;
+	for (uint32_t index1 = 0; index1 < 0x100; ++index1) {
+		for (uint32_t index2 = index1, i = 0; i < 5; ++i, index2 += 0x100) {
+			seed = (seed * 125 + 3) % 0x2AAAAB;
+			const uint32_t temp1 = (seed & 0xFFFF) << 0x10;
+			seed = (seed * 125 + 3) % 0x2AAAAB;
+			const uint32_t temp2 = (seed & 0xFFFF);
+			result[index2] = temp1 | temp2;
+		}
+	}
+	return result;
+}
+
+inline constexpr std::array<uint32_t, 0x500> MpqCryptTable = GenerateMpqCryptTable();
+
+// Hashes an MPQ path. The path is case-insensitive and `/` is equivalent to `\`.
+constexpr uint32_t MpqHashString(std::string_view str, MpqHashType type)
+{
+	uint32_t seed1 = 0x7FED7FED;
+	uint32_t seed2 = 0xEEEEEEEE;
+	for (char c : str) {
+		if (c >= 'a' && c <= 'z') {
+			c = static_cast<char>(c - 'a' + 'A');
+		} else if (c == '/') {
+			c = '\\';
+		}
+		const auto ch = static_cast<uint8_t>(c);
+		seed1 = MpqCryptTable[static_cast<uint16_t>(type) + ch] ^ (seed1 + seed2);
+		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
+	}
+	return seed1;
+}
+
+// The base encryption key of a file, before the adjustment for `MpqFileFlags::FixKey`.
+constexpr uint32_t MpqFileKey(std::string_view path)
+{
+	const size_t lastSeparator = path.find_last_of("\\/");
+	if (lastSeparator != std::string_view::npos)
+		path.remove_prefix(lastSeparator + 1);
+	return MpqHashString(path, MpqHashType::FileKey);
+}
+
+// All the hashes of a path needed to find and read it, so that they can be computed ahead of time.
+struct MpqPathHashes {
+	uint32_t tableOffset;
+	uint32_t nameA;
+	uint32_t nameB;
+	uint32_t fileKey;
+};
+
+constexpr MpqPathHashes HashMpqPath(std::string_view path)
+{
+	return MpqPathHashes {
+		.tableOffset = MpqHashString(path, MpqHashType::TableOffset),
+		.nameA = MpqHashString(path, MpqHashType::NameA),
+		.nameB = MpqHashString(path, MpqHashType::NameB),
+		.fileKey = MpqFileKey(path),
+	};
+}
+
+// Decrypts the data in-place. Trailing bytes that do not form a whole 32-bit word are left as is.
+void MpqDecryptBlock(std::span<uint8_t> data, uint32_t key);
+
+// Encrypts the data in-place. Trailing bytes that do not form a whole 32-bit word are left as is.
+void MpqEncryptBlock(std::span<uint8_t> data, uint32_t key);
+
+} // namespace devilution_mpq_tools
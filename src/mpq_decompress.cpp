@@ -0,0 +1,336 @@
+#include "mpq_decompress.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#include <bzlib.h>
+#include <zlib.h>
+
+#include "mpq_reader.hpp"
+
+// Not part of the public libmpq API but exported by it.
+// `compressionType` is either `MpqFileFlags::Implode` or `MpqFileFlags::Compress`.
+extern "C" int32_t libmpq__decompress_block(uint8_t *in_buf, uint32_t in_size,
+    uint8_t *out_buf, uint32_t out_size, uint32_t compression_type);
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+// PKWARE DCL explode, as described by Mark Adler's blast.c.
+//
+// The codes are canonical Huffman codes, stored with their bits inverted and read from the most significant bit,
+// in a least-significant-bit-first stream. The symbols are decoded with a lookup table indexed by the next
+// `MaxBits` bits of the stream instead of a bit at a time.
+namespace explode {
+
+// The code lengths, in blast.c's compact form: the low 4 bits are the length,
+// the high 4 bits are the number of consecutive symbols with that length minus one.
+constexpr uint8_t LiteralLengths[] = {
+	11, 124, 8, 7, 28, 7, 188, 13, 76, 4, 10, 8, 12, 10, 12, 10, 8, 23, 8,
+	9, 7, 6, 7, 8, 7, 6, 55, 8, 23, 24, 12, 11, 7, 9, 11, 12, 6, 7, 22, 5,
+	7, 24, 6, 11, 9, 6, 7, 22, 7, 11, 38, 7, 9, 8, 25, 11, 8, 11, 9, 12,
+	8, 12, 5, 38, 5, 38, 5, 11, 7, 5, 6, 21, 6, 10, 53, 8, 7, 24, 10, 27,
+	44, 253, 253, 253, 252, 252, 252, 13, 12, 45, 12, 45, 12, 61, 12, 45,
+	44, 173
+};
+constexpr uint8_t LengthLengths[] = { 2, 35, 36, 53, 38, 23 };
+constexpr uint8_t DistanceLengths[] = { 2, 20, 53, 230, 247, 151, 248 };
+
+constexpr uint16_t LengthBase[16] = { 3, 2, 4, 5, 6, 7, 8, 9, 10, 12, 16, 24, 40, 72, 136, 264 };
+constexpr uint8_t LengthExtraBits[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+
+// The length of the end-of-stream code.
+constexpr unsigned EndOfStream = 519;
+
+// A lookup table for the codes of up to `MaxBits` bits.
+template <unsigned MaxBits>
+struct DecodeTable {
+	struct Entry {
+		uint8_t symbol;
+		uint8_t length;
+	};
+	std::array<Entry, 1U << MaxBits> entries;
+
+	explicit DecodeTable(std::span<const uint8_t> compactLengths)
+	{
+		std::array<uint8_t, 256> lengths {};
+		size_t numSymbols = 0;
+		for (const uint8_t rep : compactLengths) {
+			for (unsigned i = 0; i <= (rep >> 4U); ++i)
+				lengths[numSymbols++] = rep & 15;
+		}
+		std::array<unsigned, MaxBits + 2> count {};
+		for (size_t symbol = 0; symbol < numSymbols; ++symbol)
+			++count[lengths[symbol]];
+
+		// The first code of each length.
+		std::array<unsigned, MaxBits + 2> nextCode {};
+		unsigned code = 0;
+		for (unsigned length = 1; length <= MaxBits; ++length) {
+			nextCode[length] = code;
+			code = (code + count[length]) << 1;
+		}
+
+		for (size_t symbol = 0; symbol < numSymbols; ++symbol) {
+			const unsigned length = lengths[symbol];
+			const unsigned symbolCode = nextCode[length]++;
+			// The bits as they come in the stream: inverted, the most significant first.
+			unsigned streamBits = 0;
+			for (unsigned i = 0; i < length; ++i)
+				streamBits |= (((symbolCode >> (length - 1 - i)) & 1U) ^ 1U) << i;
+			for (unsigned index = streamBits; index < entries.size(); index += 1U << length)
+				entries[index] = Entry { static_cast<uint8_t>(symbol), static_cast<uint8_t>(length) };
+		}
+	}
+};
+
+struct Tables {
+	DecodeTable<13> literals { LiteralLengths };
+	DecodeTable<7> lengths { LengthLengths };
+	DecodeTable<8> distances { DistanceLengths };
+};
+
+const Tables &GetTables()
+{
+	static const Tables tables;
+	return tables;
+}
+
+class BitReader {
+public:
+	explicit BitReader(std::span<const uint8_t> in)
+	    : in_(in)
+	{
+	}
+
+	// Makes at least 57 bits available, as zeros past the end of the input.
+	void refill()
+	{
+		while (count_ <= 56) {
+			if (pos_ < in_.size())
+				bits_ |= static_cast<uint64_t>(in_[pos_]) << count_;
+			++pos_;
+			count_ += 8;
+		}
+	}
+
+	[[nodiscard]] uint32_t peek(unsigned n) const
+	{
+		return static_cast<uint32_t>(bits_ & ((uint64_t { 1 } << n) - 1));
+	}
+
+	void consume(unsigned n)
+	{
+		bits_ >>= n;
+		count_ -= n;
+	}
+
+	uint32_t take(unsigned n)
+	{
+		const uint32_t result = peek(n);
+		consume(n);
+		return result;
+	}
+
+	// Whether more bits have been consumed than the input has.
+	[[nodiscard]] bool overrun() const
+	{
+		return (pos_ * 8) - count_ > in_.size() * 8;
+	}
+
+private:
+	std::span<const uint8_t> in_;
+	size_t pos_ = 0;
+	uint64_t bits_ = 0;
+	unsigned count_ = 0;
+};
+
+// Returns the number of bytes written, or -1 on failure.
+// Stops at the end of `out`, the same as libmpq.
+int64_t Explode(std::span<const uint8_t> in, std::span<uint8_t> out)
+{
+	if (in.size() < 2)
+		return -1;
+	const unsigned codedLiterals = in[0];
+	const unsigned dictionaryBits = in[1];
+	if (codedLiterals > 1 || dictionaryBits < 4 || dictionaryBits > 6)
+		return -1;
+	const Tables &tables = GetTables();
+	BitReader reader { in.subspan(2) };
+	size_t pos = 0;
+	while (pos < out.size()) {
+		// The longest sequence is a flag, 7 + 8 length bits, and 8 + 6 distance bits.
+		reader.refill();
+		if (reader.take(1) == 0) {
+			if (codedLiterals != 0) {
+				const auto entry = tables.literals.entries[reader.peek(13)];
+				reader.consume(entry.length);
+				out[pos++] = entry.symbol;
+			} else {
+				out[pos++] = static_cast<uint8_t>(reader.take(8));
+			}
+			continue;
+		}
+		const auto lengthEntry = tables.lengths.entries[reader.peek(7)];
+		reader.consume(lengthEntry.length);
+		const unsigned length = LengthBase[lengthEntry.symbol] + reader.take(LengthExtraBits[lengthEntry.symbol]);
+		if (length == EndOfStream)
+			break;
+		const auto distanceEntry = tables.distances.entries[reader.peek(8)];
+		reader.consume(distanceEntry.length);
+		const unsigned lowBits = length == 2 ? 2 : dictionaryBits;
+		const size_t distance = ((static_cast<size_t>(distanceEntry.symbol) << lowBits) | reader.take(lowBits)) + 1;
+		if (distance > pos)
+			return -1;
+		const size_t n = std::min<size_t>(length, out.size() - pos);
+		uint8_t *dest = &out[pos];
+		const uint8_t *src = dest - distance;
+		if (distance >= n) {
+			std::memcpy(dest, src, n);
+		} else {
+			// Overlapping: repeats the last `distance` bytes.
+			for (size_t i = 0; i < n; ++i)
+				dest[i] = src[i];
+		}
+		pos += n;
+	}
+	if (reader.overrun())
+		return -1;
+	return static_cast<int64_t>(pos);
+}
+
+} // namespace explode
+
+} // namespace
+
+int64_t PkwareExplode(std::span<const uint8_t> in, std::span<uint8_t> out)
+{
+	return explode::Explode(in, out);
+}
+
+struct MpqDecompressor::ZlibState {
+	z_stream stream {};
+	bool initialized = false;
+
+	~ZlibState()
+	{
+		if (initialized)
+			inflateEnd(&stream);
+	}
+};
+
+MpqDecompressor::MpqDecompressor()
+    : zlib_(std::make_unique<ZlibState>())
+{
+}
+
+MpqDecompressor::~MpqDecompressor() = default;
+
+std::string MpqDecompressor::decompress(std::span<const uint8_t> in, std::span<uint8_t> out, uint32_t compressionType)
+{
+	const int64_t size = compressionType == MpqFileFlags::Implode
+	    ? explode::Explode(in, out)
+	    : decompressMulti(in, out);
+	if (size != static_cast<int64_t>(out.size())) {
+		// Not something the decoders here handle, e.g. a truncated stream that libmpq accepts.
+		if (libmpq__decompress_block(const_cast<uint8_t *>(in.data()), static_cast<uint32_t>(in.size()),
+		        out.data(), static_cast<uint32_t>(out.size()), compressionType)
+		    < 0)
+			return "failed to decompress sector";
+		return "";
+	}
+	if (verify_) {
+		libmpqOutput_.assign(out.size(), 0);
+		if (libmpq__decompress_block(const_cast<uint8_t *>(in.data()), static_cast<uint32_t>(in.size()),
+		        libmpqOutput_.data(), static_cast<uint32_t>(libmpqOutput_.size()), compressionType)
+		    < 0)
+			return "sector decompressed but libmpq failed to decompress it";
+		if (!std::equal(out.begin(), out.end(), libmpqOutput_.begin()))
+			return "sector decompressed differently from libmpq";
+	}
+	return "";
+}
+
+int64_t MpqDecompressor::decompressMulti(std::span<const uint8_t> in, std::span<uint8_t> out)
+{
+	if (in.empty())
+		return -1;
+	const uint8_t methods = in[0];
+	if ((methods & (MpqCompression::Huffman | MpqCompression::AdpcmMono | MpqCompression::AdpcmStereo)) != 0) {
+		// The stages of the WAV files are left to libmpq.
+		return libmpq__decompress_block(const_cast<uint8_t *>(in.data()), static_cast<uint32_t>(in.size()),
+		    out.data(), static_cast<uint32_t>(out.size()), MpqFileFlags::Compress);
+	}
+	// The reverse of the order they are applied in when compressing.
+	constexpr uint8_t Order[] = {
+		MpqCompression::Bzip2,
+		MpqCompression::PkwareImplode,
+		MpqCompression::Zlib,
+	};
+	uint8_t known = 0;
+	for (const uint8_t method : Order)
+		known |= method;
+	if (methods == 0 || (methods & ~known) != 0)
+		return -1;
+
+	std::span<const uint8_t> stageInput = in.subspan(1);
+	int numRemaining = std::popcount(methods);
+	size_t bufferIndex = 0;
+	for (const uint8_t method : Order) {
+		if ((methods & method) == 0)
+			continue;
+		std::span<uint8_t> stageOutput = out;
+		if (--numRemaining != 0) {
+			std::vector<uint8_t> &buffer = stageBuffers_[bufferIndex];
+			bufferIndex ^= 1;
+			buffer.resize(out.size());
+			stageOutput = buffer;
+		}
+		int64_t size = -1;
+		switch (method) {
+		case MpqCompression::Bzip2: {
+			auto destSize = static_cast<unsigned>(stageOutput.size());
+			if (BZ2_bzBuffToBuffDecompress(reinterpret_cast<char *>(stageOutput.data()), &destSize,
+			        const_cast<char *>(reinterpret_cast<const char *>(stageInput.data())), static_cast<unsigned>(stageInput.size()),
+			        /*small=*/0, /*verbosity=*/0)
+			    == BZ_OK)
+				size = destSize;
+		} break;
+		case MpqCompression::PkwareImplode:
+			size = explode::Explode(stageInput, stageOutput);
+			break;
+		case MpqCompression::Zlib:
+			size = inflate(stageInput, stageOutput);
+			break;
+		}
+		if (size < 0)
+			return -1;
+		stageInput = stageOutput.first(static_cast<size_t>(size));
+	}
+	return static_cast<int64_t>(stageInput.size());
+}
+
+int64_t MpqDecompressor::inflate(std::span<const uint8_t> in, std::span<uint8_t> out)
+{
+	z_stream &stream = zlib_->stream;
+	if (!zlib_->initialized) {
+		if (inflateInit(&stream) != Z_OK)
+			return -1;
+		zlib_->initialized = true;
+	} else if (inflateReset(&stream) != Z_OK) {
+		return -1;
+	}
+	stream.next_in = const_cast<Bytef *>(in.data());
+	stream.avail_in = static_cast<uInt>(in.size());
+	stream.next_out = out.data();
+	stream.avail_out = static_cast<uInt>(out.size());
+	const int result = ::inflate(&stream, Z_FINISH);
+	if (result != Z_STREAM_END && !(result == Z_BUF_ERROR && stream.avail_out == 0))
+		return -1;
+	return static_cast<int64_t>(stream.total_out);
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// The methods of a multi-compressed (`MpqFileFlags::Compress`) sector, as stored in its first byte.
+namespace MpqCompression {
+constexpr uint8_t Huffman = 0x01;
+constexpr uint8_t Zlib = 0x02;
+constexpr uint8_t PkwareImplode = 0x08;
+constexpr uint8_t Bzip2 = 0x10;
+constexpr uint8_t AdpcmMono = 0x40;
+constexpr uint8_t AdpcmStereo = 0x80;
+} // namespace MpqCompression
+
+// PKWARE DCL explode, without the fallback to libmpq of `MpqDecompressor`.
+// Returns the number of bytes written to `out`, or -1 on failure. Stops at the end of `out`, the same as libmpq.
+int64_t PkwareExplode(std::span<const uint8_t> in, std::span<uint8_t> out);
+
+// Decompresses MPQ sectors.
+//
+// PKWARE DCL explode, zlib and bzip2 are decoded here. The sectors of the WAV files (Huffman and the MPQ ADPCM)
+// are decompressed by libmpq, so they are no faster than before.
+// So is any sector that fails to decode here, so that the output is the same as libmpq's.
+//
+// Keeps its buffers and the zlib state across calls. Not thread-safe: each thread must use its own.
+class MpqDecompressor {
+public:
+	MpqDecompressor();
+	~MpqDecompressor();
+
+	MpqDecompressor(const MpqDecompressor &) = delete;
+	MpqDecompressor &operator=(const MpqDecompressor &) = delete;
+
+	// Also decompresses every sector with libmpq, and fails if the outputs differ.
+	void setVerify(bool verify)
+	{
+		verify_ = verify;
+	}
+
+	// Decompresses a sector into exactly `out.size()` bytes.
+	// `compressionType` is either `MpqFileFlags::Implode` or `MpqFileFlags::Compress`.
+	//
+	// Returns an error message on failure.
+	std::string decompress(std::span<const uint8_t> in, std::span<uint8_t> out, uint32_t compressionType);
+
+	// A buffer for the caller's own use, e.g. to decrypt the input into. Not used by `decompress`.
+	std::vector<uint8_t> &scratch()
+	{
+		return scratch_;
+	}
+
+private:
+	// Each returns the number of bytes written to `out`, or -1 on failure.
+	int64_t decompressMulti(std::span<const uint8_t> in, std::span<uint8_t> out);
+	int64_t inflate(std::span<const uint8_t> in, std::span<uint8_t> out);
+
+	struct ZlibState;
+	std::unique_ptr<ZlibState> zlib_;
+	bool verify_ = false;
+	std::vector<uint8_t> stageBuffers_[2];
+	std::vector<uint8_t> libmpqOutput_;
+	std::vector<uint8_t> scratch_;
+};
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "mpq_crypt.hpp"
+
+namespace devilution_mpq_tools {
+
+// A list of MPQ paths along with their hashes.
+//
+// The paths are NUL-terminated strings in a single blob, at `offsets` from `strings`.
+struct MpqListfile {
+	const char *strings = nullptr;
+	std::span<const uint32_t> offsets;
+	std::span<const MpqPathHashes> hashes;
+
+	[[nodiscard]] size_t size() const
+	{
+		return offsets.size();
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return offsets.empty();
+	}
+
+	[[nodiscard]] const char *path(size_t i) const
+	{
+		return strings + offsets[i];
+	}
+};
+
+// The listfile of `data/<name>-listfile.txt`, hashed at build time by `gen_mpq_listfiles`.
+// Empty if there is no such listfile.
+MpqListfile GetEmbeddedListfile(std::string_view name);
+
+} // namespace devilution_mpq_tools
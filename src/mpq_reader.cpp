@@ -0,0 +1,376 @@
+#include "mpq_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mpq_crypt.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr uint32_t MpqSignature = 0x1A51504D; // "MPQ\x1A"
+constexpr size_t MpqHeaderSize = 32;
+constexpr size_t MpqHeaderAlignment = 512;
+
+// The sector size is `512 << shift`. Larger shifts are rejected: they would overflow,
+// and no MPQ uses sectors larger than 16 MiB.
+constexpr uint16_t MaxSectorSizeShift = 15;
+
+constexpr uint32_t HashEntryEmpty = 0xFFFFFFFF;
+constexpr uint32_t HashEntryDeleted = 0xFFFFFFFE;
+
+constexpr uint32_t SupportedFlags = MpqFileFlags::Implode | MpqFileFlags::Compress
+    | MpqFileFlags::Encrypted | MpqFileFlags::FixKey | MpqFileFlags::SingleUnit
+    | MpqFileFlags::SectorCrc | MpqFileFlags::Exists;
+
+uint16_t LoadLE16(const uint8_t *b)
+{
+	return static_cast<uint16_t>(b[0] | (b[1] << 8));
+}
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+std::string ReadEncryptedTable(std::span<const uint8_t> archive, uint32_t pos, uint32_t numEntries,
+    std::string_view keyName, std::vector<uint8_t> &out)
+{
+	const size_t size = static_cast<size_t>(numEntries) * 16;
+	if (pos > archive.size() || archive.size() - pos < size)
+		return std::string(keyName) + " is out of bounds";
+	out.assign(archive.begin() + pos, archive.begin() + pos + size);
+	MpqDecryptBlock(out, MpqHashString(keyName, MpqHashType::FileKey));
+	return "";
+}
+
+} // namespace
+
+std::unique_ptr<MpqReader> MpqReader::open(const std::filesystem::path &path, std::string &error)
+{
+	std::unique_ptr<MpqReader> reader { new MpqReader() };
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+	    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		error = "failed to open file";
+		return nullptr;
+	}
+	reader->fileHandle_ = file;
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) == 0) {
+		error = "failed to get file size";
+		return nullptr;
+	}
+	reader->size_ = static_cast<size_t>(fileSize.QuadPart);
+	if (reader->size_ != 0) {
+		HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			error = "failed to map file";
+			return nullptr;
+		}
+		reader->mappingHandle_ = mapping;
+		reader->data_ = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (reader->data_ == nullptr) {
+			error = "failed to map file";
+			return nullptr;
+		}
+	}
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		error = std::string("failed to open file: ") + std::strerror(errno);
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		error = std::string("failed to stat file: ") + std::strerror(errno);
+		::close(fd);
+		return nullptr;
+	}
+	reader->size_ = static_cast<size_t>(st.st_size);
+	if (reader->size_ != 0) {
+		void *data = mmap(nullptr, reader->size_, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED) {
+			error = std::string("failed to map file: ") + std::strerror(errno);
+			::close(fd);
+			return nullptr;
+		}
+		reader->data_ = static_cast<const uint8_t *>(data);
+	}
+	::close(fd);
+#endif
+	error = reader->parse();
+	if (!error.empty())
+		return nullptr;
+	return reader;
+}
+
+MpqReader::~MpqReader()
+{
+#ifdef _WIN32
+	if (data_ != nullptr)
+		UnmapViewOfFile(data_);
+	if (mappingHandle_ != nullptr)
+		CloseHandle(mappingHandle_);
+	if (fileHandle_ != nullptr)
+		CloseHandle(fileHandle_);
+#else
+	if (data_ != nullptr)
+		munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+}
+
+std::string MpqReader::parse()
+{
+	// The archive may be preceded by arbitrary data, e.g. an installer executable.
+	while (true) {
+		if (archiveOffset_ > size_ || size_ - archiveOffset_ < MpqHeaderSize)
+			return "MPQ header not found";
+		if (LoadLE32(&data_[archiveOffset_]) == MpqSignature)
+			break;
+		archiveOffset_ += MpqHeaderAlignment;
+	}
+	const uint8_t *header = &data_[archiveOffset_];
+	const uint16_t sectorSizeShift = LoadLE16(&header[14]);
+	if (sectorSizeShift > MaxSectorSizeShift)
+		return "invalid sector size shift: " + std::to_string(sectorSizeShift);
+	sectorSize_ = 512U << sectorSizeShift;
+	const uint32_t hashTablePos = LoadLE32(&header[16]);
+	const uint32_t blockTablePos = LoadLE32(&header[20]);
+	const uint32_t hashTableSize = LoadLE32(&header[24]);
+	const uint32_t blockTableSize = LoadLE32(&header[28]);
+	if (hashTableSize == 0 || (hashTableSize & (hashTableSize - 1)) != 0)
+		return "hash table size is not a power of 2";
+
+	std::vector<uint8_t> table;
+	std::string error = ReadEncryptedTable(archiveData(), hashTablePos, hashTableSize, "(hash table)", table);
+	if (!error.empty())
+		return error;
+	hashTable_.resize(hashTableSize);
+	for (size_t i = 0; i < hashTableSize; ++i) {
+		const uint8_t *entry = &table[i * 16];
+		hashTable_[i] = HashEntry {
+			.nameA = LoadLE32(&entry[0]),
+			.nameB = LoadLE32(&entry[4]),
+			.blockIndex = LoadLE32(&entry[12]),
+		};
+	}
+
+	error = ReadEncryptedTable(archiveData(), blockTablePos, blockTableSize, "(block table)", table);
+	if (!error.empty())
+		return error;
+	blockTable_.resize(blockTableSize);
+	for (size_t i = 0; i < blockTableSize; ++i) {
+		const uint8_t *entry = &table[i * 16];
+		blockTable_[i] = MpqBlockEntry {
+			.offset = LoadLE32(&entry[0]),
+			.packedSize = LoadLE32(&entry[4]),
+			.unpackedSize = LoadLE32(&entry[8]),
+			.flags = LoadLE32(&entry[12]),
+		};
+	}
+	return "";
+}
+
+std::optional<uint32_t> MpqReader::findBlock(std::string_view mpqPath) const
+{
+	return findBlock(MpqPathHashes {
+	    .tableOffset = MpqHashString(mpqPath, MpqHashType::TableOffset),
+	    .nameA = MpqHashString(mpqPath, MpqHashType::NameA),
+	    .nameB = MpqHashString(mpqPath, MpqHashType::NameB),
+	    .fileKey = 0,
+	});
+}
+
+void MpqReader::findBlocks(std::span<const MpqPathHashes> hashes, std::span<uint32_t> blockIndices) const
+{
+	for (size_t i = 0; i < hashes.size(); ++i)
+		blockIndices[i] = findBlock(hashes[i]).value_or(NoBlock);
+}
+
+std::optional<uint32_t> MpqReader::findBlock(const MpqPathHashes &hashes) const
+{
+	const uint32_t mask = static_cast<uint32_t>(hashTable_.size()) - 1;
+	const uint32_t start = hashes.tableOffset & mask;
+	uint32_t i = start;
+	do {
+		const HashEntry &entry = hashTable_[i];
+		if (entry.blockIndex == HashEntryEmpty)
+			break;
+		if (entry.blockIndex != HashEntryDeleted && entry.nameA == hashes.nameA && entry.nameB == hashes.nameB
+		    && entry.blockIndex < blockTable_.size()
+		    && (blockTable_[entry.blockIndex].flags & MpqFileFlags::Exists) != 0) {
+			return entry.blockIndex;
+		}
+		i = (i + 1) & mask;
+	} while (i != start);
+	return std::nullopt;
+}
+
+std::span<const uint8_t> MpqReader::rawBlockData(uint32_t blockIndex) const
+{
+	const MpqBlockEntry &block = blockTable_[blockIndex];
+	const std::span<const uint8_t> archive = archiveData();
+	if (block.offset > archive.size() || archive.size() - block.offset < block.packedSize)
+		return {};
+	return archive.subspan(block.offset, block.packedSize);
+}
+
+void MpqReader::prefetchBlock(uint32_t blockIndex) const
+{
+#ifdef _WIN32
+	// `PrefetchVirtualMemory` needs Windows 8, so rely on the OS readahead instead.
+	(void)blockIndex;
+#else
+	const std::span<const uint8_t> data = rawBlockData(blockIndex);
+	if (data.empty())
+		return;
+	static const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	const uintptr_t begin = reinterpret_cast<uintptr_t>(data.data()) & ~(pageSize - 1);
+	const uintptr_t end = reinterpret_cast<uintptr_t>(data.data() + data.size());
+	madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+#endif
+}
+
+MpqReader::ReadResult MpqReader::readBlock(uint32_t blockIndex, std::string_view mpqPath, bool decrypt,
+    uint8_t *out, MpqDecompressor &decompressor, std::string &error) const
+{
+	return readBlock(blockIndex, MpqFileKey(mpqPath), decrypt, out, decompressor, error);
+}
+
+MpqReader::ReadResult MpqReader::readBlock(uint32_t blockIndex, uint32_t fileKey, bool decrypt,
+    uint8_t *out, MpqDecompressor &decompressor, std::string &error) const
+{
+	return readSectors(blockIndex, fileKey, decrypt, 0, numSectors(blockIndex), out, decompressor, error);
+}
+
+bool MpqReader::isSupported(uint32_t blockIndex, bool decrypt) const
+{
+	const MpqBlockEntry &block = blockTable_[blockIndex];
+	if ((block.flags & ~SupportedFlags) != 0)
+		return false;
+	return decrypt || (block.flags & MpqFileFlags::Encrypted) == 0;
+}
+
+uint32_t MpqReader::numSectors(uint32_t blockIndex) const
+{
+	const MpqBlockEntry &block = blockTable_[blockIndex];
+	if ((block.flags & MpqFileFlags::SingleUnit) != 0)
+		return 1;
+	return static_cast<uint32_t>((static_cast<uint64_t>(block.unpackedSize) + sectorSize_ - 1) / sectorSize_);
+}
+
+MpqReader::ReadResult MpqReader::readSectors(uint32_t blockIndex, uint32_t fileKey, bool decrypt,
+    uint32_t firstSector, uint32_t endSector, uint8_t *out, MpqDecompressor &decompressor, std::string &error) const
+{
+	if (!isSupported(blockIndex, decrypt))
+		return ReadResult::Unsupported;
+	const MpqBlockEntry &block = blockTable_[blockIndex];
+	const bool encrypted = (block.flags & MpqFileFlags::Encrypted) != 0;
+
+	const std::span<const uint8_t> archive = archiveData();
+	if (block.offset > archive.size() || archive.size() - block.offset < block.packedSize) {
+		error = "file data is out of bounds";
+		return ReadResult::Error;
+	}
+	const uint8_t *fileData = &archive[block.offset];
+
+	uint32_t key = 0;
+	if (encrypted) {
+		key = fileKey;
+		if ((block.flags & MpqFileFlags::FixKey) != 0)
+			key = (key + block.offset) ^ block.unpackedSize;
+	}
+
+	const uint32_t compressionType = block.flags & (MpqFileFlags::Implode | MpqFileFlags::Compress);
+
+	// Decrypts (if needed) and decompresses (if needed) a single sector into `dest`.
+	const auto readSector = [&](const uint8_t *src, uint32_t srcSize, uint8_t *dest, uint32_t destSize, uint32_t sectorKey) -> bool {
+		if (compressionType == 0 || srcSize >= destSize) {
+			// Stored as is: copy straight into the destination and decrypt in-place.
+			if (srcSize < destSize) {
+				error = "stored sector is truncated";
+				return false;
+			}
+			std::memcpy(dest, src, destSize);
+			if (encrypted)
+				MpqDecryptBlock({ dest, destSize }, sectorKey);
+			return true;
+		}
+		std::span<const uint8_t> input { src, srcSize };
+		if (encrypted) {
+			std::vector<uint8_t> &scratch = decompressor.scratch();
+			scratch.assign(src, src + srcSize);
+			MpqDecryptBlock(scratch, sectorKey);
+			input = scratch;
+		}
+		error = decompressor.decompress(input, { dest, destSize }, compressionType);
+		return error.empty();
+	};
+
+	if ((block.flags & MpqFileFlags::SingleUnit) != 0) {
+		if (firstSector == endSector)
+			return ReadResult::Ok;
+		return readSector(fileData, block.packedSize, out, block.unpackedSize, key)
+		    ? ReadResult::Ok
+		    : ReadResult::Error;
+	}
+
+	const uint32_t numSectors = this->numSectors(blockIndex);
+	endSector = std::min(endSector, numSectors);
+	if (compressionType == 0) {
+		if (block.packedSize < block.unpackedSize) {
+			error = "stored file is truncated";
+			return ReadResult::Error;
+		}
+		for (uint32_t i = firstSector; i < endSector; ++i) {
+			const uint32_t sectorStart = i * sectorSize_;
+			const uint32_t size = std::min(sectorSize_, block.unpackedSize - sectorStart);
+			if (!readSector(&fileData[sectorStart], size, &out[sectorStart], size, key + i))
+				return ReadResult::Error;
+		}
+		return ReadResult::Ok;
+	}
+
+	// Compressed files begin with a table of sector offsets.
+	// The whole table is decrypted even for a range of sectors, as each word's key depends on the previous ones.
+	const size_t offsetsSize = (static_cast<size_t>(numSectors) + 1) * 4;
+	if (block.packedSize < offsetsSize) {
+		error = "sector offset table is truncated";
+		return ReadResult::Error;
+	}
+	std::vector<uint8_t> offsetsData { fileData, fileData + offsetsSize };
+	if (encrypted)
+		MpqDecryptBlock(offsetsData, key - 1);
+	for (uint32_t i = firstSector; i < endSector; ++i) {
+		const uint32_t sectorBegin = LoadLE32(&offsetsData[i * 4]);
+		const uint32_t sectorEnd = LoadLE32(&offsetsData[(i + 1) * 4]);
+		if (sectorBegin > sectorEnd || sectorEnd > block.packedSize) {
+			error = "invalid sector offset table";
+			return ReadResult::Error;
+		}
+		const uint32_t outStart = i * sectorSize_;
+		const uint32_t outSize = std::min(sectorSize_, block.unpackedSize - outStart);
+		if (!readSector(&fileData[sectorBegin], sectorEnd - sectorBegin, &out[outStart], outSize, key + i))
+			return ReadResult::Error;
+	}
+	return ReadResult::Ok;
+}
+
+} // namespace devilution_mpq_tools
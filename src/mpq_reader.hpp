@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mpq_crypt.hpp"
+#include "mpq_decompress.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace MpqFileFlags {
+constexpr uint32_t Implode = 0x00000100;
+constexpr uint32_t Compress = 0x00000200;
+constexpr uint32_t Encrypted = 0x00010000;
+constexpr uint32_t FixKey = 0x00020000;
+constexpr uint32_t SingleUnit = 0x01000000;
+constexpr uint32_t SectorCrc = 0x04000000;
+constexpr uint32_t Exists = 0x80000000;
+} // namespace MpqFileFlags
+
+struct MpqBlockEntry {
+	uint32_t offset;
+	uint32_t packedSize;
+	uint32_t unpackedSize;
+	uint32_t flags;
+};
+
+// A read-only view of an MPQ archive backed by a memory-mapped file.
+//
+// The header, hash table and block table are parsed on open.
+// File data is decrypted and decompressed directly from the mapping
+// into the destination buffer.
+//
+// All the const methods are thread-safe.
+class MpqReader {
+public:
+	enum class ReadResult : uint8_t {
+		Ok,
+		// The file uses a feature this reader does not handle.
+		// The caller should fall back to libmpq.
+		Unsupported,
+		Error,
+	};
+
+	// Returns `nullptr` and sets `error` on failure.
+	static std::unique_ptr<MpqReader> open(const std::filesystem::path &path, std::string &error);
+
+	~MpqReader();
+
+	MpqReader(const MpqReader &) = delete;
+	MpqReader &operator=(const MpqReader &) = delete;
+
+	// Returned by `findBlocks` for the paths that are not in the archive.
+	static constexpr uint32_t NoBlock = 0xFFFFFFFF;
+
+	// Returns the index of the block for the given path, if present.
+	[[nodiscard]] std::optional<uint32_t> findBlock(std::string_view mpqPath) const;
+	[[nodiscard]] std::optional<uint32_t> findBlock(const MpqPathHashes &hashes) const;
+
+	// Looks up all the paths at once, setting `blockIndices[i]` to the block of `hashes[i]` or `NoBlock`.
+	void findBlocks(std::span<const MpqPathHashes> hashes, std::span<uint32_t> blockIndices) const;
+
+	[[nodiscard]] const MpqBlockEntry &block(uint32_t blockIndex) const
+	{
+		return blockTable_[blockIndex];
+	}
+
+	// Returns the file's data as stored in the archive (i.e. still compressed and encrypted).
+	// Returns an empty span if the block is out of bounds.
+	[[nodiscard]] std::span<const uint8_t> rawBlockData(uint32_t blockIndex) const;
+
+	// Hints the OS to start reading the block's data from disk,
+	// so that reading the block later does not have to wait for it.
+	void prefetchBlock(uint32_t blockIndex) const;
+
+	// Reads the entire unpacked file into `out`, which must be at least `block(blockIndex).unpackedSize` bytes.
+	//
+	// `mpqPath` is used to derive the decryption key.
+	// If `decrypt` is false and the file is encrypted, returns `ReadResult::Unsupported`.
+	// `decompressor` is the calling thread's own, and can be reused across calls.
+	ReadResult readBlock(uint32_t blockIndex, std::string_view mpqPath, bool decrypt,
+	    uint8_t *out, MpqDecompressor &decompressor, std::string &error) const;
+
+	// As above, with the key precomputed by `MpqFileKey`.
+	ReadResult readBlock(uint32_t blockIndex, uint32_t fileKey, bool decrypt,
+	    uint8_t *out, MpqDecompressor &decompressor, std::string &error) const;
+
+	// Whether `readBlock` can read the file, i.e. does not return `ReadResult::Unsupported` for it.
+	[[nodiscard]] bool isSupported(uint32_t blockIndex, bool decrypt) const;
+
+	// The number of sectors the file is stored in, 1 for single-unit files.
+	[[nodiscard]] uint32_t numSectors(uint32_t blockIndex) const;
+
+	// Reads the sectors in the `[firstSector, endSector)` range into their place in `out`,
+	// so that several threads can read different parts of a large file at once.
+	// Otherwise the same as `readBlock`.
+	ReadResult readSectors(uint32_t blockIndex, uint32_t fileKey, bool decrypt, uint32_t firstSector, uint32_t endSector,
+	    uint8_t *out, MpqDecompressor &decompressor, std::string &error) const;
+
+private:
+	MpqReader() = default;
+
+	std::string parse();
+
+	[[nodiscard]] std::span<const uint8_t> archiveData() const
+	{
+		return { data_ + archiveOffset_, size_ - archiveOffset_ };
+	}
+
+	const uint8_t *data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	void *fileHandle_ = nullptr;
+	void *mappingHandle_ = nullptr;
+#endif
+
+	size_t archiveOffset_ = 0;
+	uint32_t sectorSize_ = 0;
+
+	struct HashEntry {
+		uint32_t nameA;
+		uint32_t nameB;
+		uint32_t blockIndex;
+	};
+	std::vector<HashEntry> hashTable_;
+	std::vector<MpqBlockEntry> blockTable_;
+};
+
+} // namespace devilution_mpq_tools
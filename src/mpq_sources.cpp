@@ -0,0 +1,117 @@
+#include "mpq_sources.hpp"
+
+#include <algorithm>
+#include <span>
+
+#include "embedded_files.h"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+std::string SrcName(const std::filesystem::path &mpq)
+{
+	std::string result = mpq.stem().string();
+	if (result == "DIABDAT")
+		result = "diabdat";
+	return result;
+}
+
+std::string DestName(const std::string &srcName)
+{
+	if (srcName == "hfmonk" || srcName == "hfmusic" || srcName == "hfvoice")
+		return "hellfire";
+	return srcName;
+}
+
+MpqListfile GetMpqFiles(std::string_view srcName)
+{
+	if (srcName == "spawn" || srcName == "diabdat" || srcName == "hellfire"
+	    || srcName == "hfmonk" || srcName == "hfmusic" || srcName == "hfvoice")
+		return GetEmbeddedListfile(srcName);
+	return {};
+}
+
+std::span<const char *const> GetExcludedFiles(std::string_view srcName)
+{
+	if (srcName == "spawn")
+		return { embedded_spawn_rm_data, embedded_spawn_rm_size };
+	if (srcName == "diabdat")
+		return { embedded_diabdat_rm_data, embedded_diabdat_rm_size };
+	if (srcName == "hellfire")
+		return { embedded_hellfire_rm_data, embedded_hellfire_rm_size };
+	if (srcName == "hfmonk")
+		return { embedded_hfmonk_rm_data, embedded_hfmonk_rm_size };
+	if (srcName == "hfmusic")
+		return { embedded_hfmusic_rm_data, embedded_hfmusic_rm_size };
+	if (srcName == "hfvoice")
+		return { embedded_hfvoice_rm_data, embedded_hfvoice_rm_size };
+	return {};
+}
+
+} // namespace
+
+bool IsSaveFileExtension(const std::filesystem::path &ext)
+{
+	return ext == ".hsv" || ext == ".sv";
+}
+
+MpqSource::MpqSource(const std::filesystem::path &mpq)
+    : mpq(mpq)
+    , srcName(SrcName(mpq))
+    , isSaveFile(IsSaveFileExtension(mpq.extension()))
+    , clxCommands(GetClxCommandTable(srcName))
+{
+	destName = isSaveFile
+	    ? srcName + "_" + mpq.extension().string().substr(1)
+	    : DestName(srcName);
+	mpqFiles = isSaveFile ? GetEmbeddedListfile("save") : GetMpqFiles(srcName);
+	const std::span<const char *const> excludedFiles = GetExcludedFiles(srcName);
+	excludedFiles_ = { excludedFiles.begin(), excludedFiles.end() };
+}
+
+std::string MpqSource::loadListfile(MpqArchive &archive)
+{
+	if (!mpqFiles.empty())
+		return "";
+	if (std::string error = archive.readFile("(listfile)", listfileData_, /*decrypt=*/false); !error.empty())
+		return error;
+	const size_t listfileSize = listfileData_.size();
+	listfileData_.push_back('\0');
+	std::replace(listfileData_.begin(), listfileData_.end(), static_cast<uint8_t>('\r'), static_cast<uint8_t>('\0'));
+	std::replace(listfileData_.begin(), listfileData_.end(), static_cast<uint8_t>('\n'), static_cast<uint8_t>('\0'));
+	const char *strings = reinterpret_cast<const char *>(listfileData_.data());
+	std::string_view listfileStr { strings, listfileSize };
+	while (!listfileStr.empty()) {
+		const std::string_view str = listfileStr.substr(0, listfileStr.find('\0'));
+		if (!str.empty()) {
+			listfileOffsets_.push_back(static_cast<uint32_t>(str.data() - strings));
+			listfileHashes_.push_back(HashMpqPath(str));
+		}
+		listfileStr.remove_prefix(std::min(str.size() + 1, listfileStr.size()));
+	}
+	mpqFiles = MpqListfile { strings, listfileOffsets_, listfileHashes_ };
+	return "";
+}
+
+bool MpqSource::isExcluded(std::string_view mpqPath) const
+{
+	std::string mpqPathWithForwardSlash { mpqPath };
+	std::replace(mpqPathWithForwardSlash.begin(), mpqPathWithForwardSlash.end(), '\\', '/');
+	return excludedFiles_.contains(mpqPathWithForwardSlash);
+}
+
+int MpqSource::overlayPriority() const
+{
+	if (srcName == "hellfire")
+		return 8000;
+	if (srcName == "hfmonk")
+		return 8100;
+	if (srcName == "hfmusic")
+		return 8200;
+	if (srcName == "hfvoice")
+		return 8500;
+	return 0;
+}
+
+} // namespace devilution_mpq_tools
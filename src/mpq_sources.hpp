@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "clx_commands.hpp"
+#include "mpq_archive.hpp"
+#include "mpq_listfile.hpp"
+
+namespace devilution_mpq_tools {
+
+bool IsSaveFileExtension(const std::filesystem::path &ext);
+
+// What is in one of the game's MPQs (or a save file), and where its outputs go.
+struct MpqSource {
+	explicit MpqSource(const std::filesystem::path &mpq);
+
+	MpqSource(const MpqSource &) = delete;
+	MpqSource &operator=(const MpqSource &) = delete;
+
+	std::filesystem::path mpq;
+
+	// The name of the MPQ, e.g. "diabdat".
+	std::string srcName;
+
+	// The directory the outputs go into, relative to the output root, e.g. "hellfire" for hfmonk.mpq.
+	std::string destName;
+
+	bool isSaveFile;
+
+	const ClxCommandTable &clxCommands;
+
+	// The embedded listfile for the MPQ, or, after `loadListfile`, the MPQ's own.
+	MpqListfile mpqFiles;
+
+	// Reads the MPQ's own listfile if there is no embedded one for it.
+	// Returns an error message on failure.
+	std::string loadListfile(MpqArchive &archive);
+
+	// The files that are not used by the game, and are not unpacked.
+	[[nodiscard]] bool isExcluded(std::string_view mpqPath) const;
+
+	// The priority of the MPQ's files over those of the other MPQs with the same output directory,
+	// the same as the game's: the Hellfire add-on MPQs override hellfire.mpq.
+	[[nodiscard]] int overlayPriority() const;
+
+private:
+	// The MPQ's own listfile, only used if there is no embedded listfile for it.
+	std::vector<uint8_t> listfileData_;
+	std::vector<uint32_t> listfileOffsets_;
+	std::vector<MpqPathHashes> listfileHashes_;
+
+	std::unordered_set<std::string_view> excludedFiles_;
+};
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,271 @@
+#include "mpq_writer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+#include <zlib.h>
+
+#include "mpq_crypt.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr uint32_t MpqSignature = 0x1A51504D; // "MPQ\x1A"
+constexpr uint32_t MpqHeaderSize = 32;
+
+// Same as the original Diablo MPQs: 512 << 3 = 4096.
+constexpr uint16_t SectorSizeShift = 3;
+constexpr uint32_t SectorSize = 512U << SectorSizeShift;
+
+// The first byte of a compressed sector is a mask of the compression methods used.
+constexpr uint8_t CompressionZlib = 0x02;
+
+constexpr char ListfileName[] = "(listfile)";
+
+void WriteLE16(uint8_t *b, uint16_t val)
+{
+	b[0] = static_cast<uint8_t>(val);
+	b[1] = static_cast<uint8_t>(val >> 8);
+}
+
+void WriteLE32(uint8_t *b, uint32_t val)
+{
+	b[0] = static_cast<uint8_t>(val);
+	b[1] = static_cast<uint8_t>(val >> 8);
+	b[2] = static_cast<uint8_t>(val >> 16);
+	b[3] = static_cast<uint8_t>(val >> 24);
+}
+
+std::string NormalizeMpqPath(std::string_view mpqPath)
+{
+	std::string result { mpqPath };
+	for (char &c : result) {
+		if (c >= 'a' && c <= 'z') {
+			c = static_cast<char>(c - 'a' + 'A');
+		} else if (c == '/') {
+			c = '\\';
+		}
+	}
+	return result;
+}
+
+// Compresses `data` sector by sector into `out`, prefixed with the sector offset table.
+// Returns false if that would not make the file any smaller.
+bool CompressSectors(std::span<const uint8_t> data, std::vector<uint8_t> &out)
+{
+	const size_t numSectors = (data.size() + SectorSize - 1) / SectorSize;
+	const size_t offsetsSize = (numSectors + 1) * 4;
+	out.resize(offsetsSize);
+	std::vector<uint8_t> sector(1 + compressBound(SectorSize));
+	for (size_t i = 0; i < numSectors; ++i) {
+		WriteLE32(&out[i * 4], static_cast<uint32_t>(out.size()));
+		const std::span<const uint8_t> input = data.subspan(i * SectorSize, std::min<size_t>(SectorSize, data.size() - i * SectorSize));
+		sector[0] = CompressionZlib;
+		uLongf compressedSize = static_cast<uLongf>(sector.size() - 1);
+		const int status = compress2(&sector[1], &compressedSize, input.data(), static_cast<uLong>(input.size()), Z_BEST_COMPRESSION);
+		if (status == Z_OK && 1 + compressedSize < input.size()) {
+			out.insert(out.end(), sector.begin(), sector.begin() + 1 + compressedSize);
+		} else {
+			// A sector that is as large as its unpacked size is read as stored.
+			out.insert(out.end(), input.begin(), input.end());
+		}
+		if (out.size() >= data.size())
+			return false;
+	}
+	WriteLE32(&out[numSectors * 4], static_cast<uint32_t>(out.size()));
+	return out.size() < data.size();
+}
+
+} // namespace
+
+MpqWriter::MpqWriter(const std::filesystem::path &path, bool compress)
+    : path_(path)
+    , tmpPath_(std::filesystem::path(path).concat(".tmp"))
+    , spoolPath_(std::filesystem::path(path).concat(".spool"))
+    , compress_(compress)
+{
+}
+
+std::unique_ptr<MpqWriter> MpqWriter::create(const std::filesystem::path &path, bool compress, std::string &error)
+{
+	std::unique_ptr<MpqWriter> writer { new MpqWriter(path, compress) };
+	if (writer->path_.has_parent_path()) {
+		std::error_code ec;
+		std::filesystem::create_directories(writer->path_.parent_path(), ec);
+	}
+	writer->spool_.open(writer->spoolPath_, std::ios::binary | std::ios::trunc);
+	if (writer->spool_.fail()) {
+		error = std::string("failed to open for writing: ") + std::strerror(errno);
+		return nullptr;
+	}
+	return writer;
+}
+
+std::string MpqWriter::addFile(std::string_view mpqPath, std::span<const uint8_t> data)
+{
+	if (data.size() > std::numeric_limits<uint32_t>::max())
+		return std::string(mpqPath) + " is too large for an MPQ";
+	std::vector<uint8_t> packed;
+	if (compress_ && !data.empty() && CompressSectors(data, packed))
+		return writeBlock(mpqPath, packed, static_cast<uint32_t>(data.size()), MpqFileFlags::Compress | MpqFileFlags::Exists);
+	return writeBlock(mpqPath, data, static_cast<uint32_t>(data.size()), MpqFileFlags::Exists);
+}
+
+std::string MpqWriter::writeBlock(std::string_view mpqPath, std::span<const uint8_t> packed,
+    uint32_t unpackedSize, uint32_t flags)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	// The format version 0 has 32-bit offsets, leave room for the tables.
+	// The spool is at least as large as the archive.
+	if (spoolSize_ + packed.size() > std::numeric_limits<uint32_t>::max() / 2)
+		return "the MPQ is too large";
+	const MpqBlockEntry block {
+		.offset = 0,
+		.packedSize = static_cast<uint32_t>(packed.size()),
+		.unpackedSize = unpackedSize,
+		.flags = flags,
+	};
+	spool_.write(reinterpret_cast<const char *>(packed.data()), static_cast<std::streamsize>(packed.size()));
+	if (spool_.fail())
+		return std::string("failed to write ") + std::string(mpqPath) + ": " + std::strerror(errno);
+	const FileEntry file { std::string(mpqPath), spoolSize_, block };
+	spoolSize_ += packed.size();
+
+	const auto [it, inserted] = fileIndices_.try_emplace(NormalizeMpqPath(mpqPath), files_.size());
+	if (inserted) {
+		files_.push_back(file);
+	} else {
+		// The data of the replaced file remains in the spool, but is not copied into the archive.
+		files_[it->second] = file;
+	}
+	return "";
+}
+
+void MpqWriter::removeFile(std::string_view mpqPath)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	const auto it = fileIndices_.find(NormalizeMpqPath(mpqPath));
+	if (it == fileIndices_.end())
+		return;
+	// Moves the last file into the gap.
+	const size_t index = it->second;
+	fileIndices_.erase(it);
+	if (index + 1 != files_.size()) {
+		files_[index] = std::move(files_.back());
+		fileIndices_[NormalizeMpqPath(files_[index].mpqPath)] = index;
+	}
+	files_.pop_back();
+}
+
+std::string MpqWriter::finish()
+{
+	// The order in which the files were added depends on the timing of the threads that added them.
+	std::vector<FileEntry> files;
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		files = files_;
+	}
+	const std::string listfileKey = NormalizeMpqPath(ListfileName);
+	std::erase_if(files, [&listfileKey](const FileEntry &file) { return NormalizeMpqPath(file.mpqPath) == listfileKey; });
+	std::sort(files.begin(), files.end(), [](const FileEntry &a, const FileEntry &b) {
+		return NormalizeMpqPath(a.mpqPath) < NormalizeMpqPath(b.mpqPath);
+	});
+	std::string listfile;
+	for (const FileEntry &file : files) {
+		listfile.append(file.mpqPath);
+		listfile.append("\r\n");
+	}
+	std::string error = addFile(ListfileName, { reinterpret_cast<const uint8_t *>(listfile.data()), listfile.size() });
+	if (!error.empty())
+		return error;
+
+	const std::lock_guard<std::mutex> lock(mutex_);
+	files.push_back(files_[fileIndices_.at(listfileKey)]);
+	spool_.close();
+	if (spool_.fail())
+		return std::string("failed to write ") + spoolPath_.string() + ": " + std::strerror(errno);
+
+	// The data goes right after the header, in order.
+	uint64_t offset = MpqHeaderSize;
+	for (FileEntry &file : files) {
+		file.block.offset = static_cast<uint32_t>(offset);
+		offset += file.block.packedSize;
+	}
+
+	const uint32_t hashTableSize = std::max<uint32_t>(16, std::bit_ceil(static_cast<uint32_t>(files.size() * 4 / 3 + 1)));
+	std::vector<uint8_t> hashTable(static_cast<size_t>(hashTableSize) * 16, 0xFF); // 0xFFFFFFFF: empty
+	std::vector<bool> occupied(hashTableSize);
+	for (size_t i = 0; i < files.size(); ++i) {
+		const std::string_view mpqPath = files[i].mpqPath;
+		uint32_t pos = MpqHashString(mpqPath, MpqHashType::TableOffset) & (hashTableSize - 1);
+		while (occupied[pos])
+			pos = (pos + 1) & (hashTableSize - 1);
+		occupied[pos] = true;
+		uint8_t *entry = &hashTable[pos * 16];
+		WriteLE32(&entry[0], MpqHashString(mpqPath, MpqHashType::NameA));
+		WriteLE32(&entry[4], MpqHashString(mpqPath, MpqHashType::NameB));
+		WriteLE16(&entry[8], 0);  // locale: neutral
+		WriteLE16(&entry[10], 0); // platform
+		WriteLE32(&entry[12], static_cast<uint32_t>(i));
+	}
+	std::vector<uint8_t> blockTable(files.size() * 16);
+	for (size_t i = 0; i < files.size(); ++i) {
+		const MpqBlockEntry &block = files[i].block;
+		uint8_t *entry = &blockTable[i * 16];
+		WriteLE32(&entry[0], block.offset);
+		WriteLE32(&entry[4], block.packedSize);
+		WriteLE32(&entry[8], block.unpackedSize);
+		WriteLE32(&entry[12], block.flags);
+	}
+	MpqEncryptBlock(hashTable, MpqHashString("(hash table)", MpqHashType::FileKey));
+	MpqEncryptBlock(blockTable, MpqHashString("(block table)", MpqHashType::FileKey));
+
+	const auto hashTablePos = static_cast<uint32_t>(offset);
+	const auto blockTablePos = static_cast<uint32_t>(hashTablePos + hashTable.size());
+	const auto archiveSize = static_cast<uint32_t>(blockTablePos + blockTable.size());
+	uint8_t header[MpqHeaderSize];
+	WriteLE32(&header[0], MpqSignature);
+	WriteLE32(&header[4], MpqHeaderSize);
+	WriteLE32(&header[8], archiveSize);
+	WriteLE16(&header[12], 0); // format version
+	WriteLE16(&header[14], SectorSizeShift);
+	WriteLE32(&header[16], hashTablePos);
+	WriteLE32(&header[20], blockTablePos);
+	WriteLE32(&header[24], hashTableSize);
+	WriteLE32(&header[28], static_cast<uint32_t>(files.size()));
+
+	std::ifstream spool { spoolPath_, std::ios::binary };
+	std::ofstream out { tmpPath_, std::ios::binary | std::ios::trunc };
+	if (spool.fail() || out.fail())
+		return std::string("failed to open ") + (spool.fail() ? spoolPath_ : tmpPath_).string() + ": " + std::strerror(errno);
+	out.write(reinterpret_cast<const char *>(header), sizeof(header));
+	std::vector<char> data;
+	for (const FileEntry &file : files) {
+		data.resize(file.block.packedSize);
+		spool.seekg(static_cast<std::streamoff>(file.spoolOffset));
+		spool.read(data.data(), static_cast<std::streamsize>(data.size()));
+		if (spool.fail())
+			return "failed to read " + file.mpqPath + " back from " + spoolPath_.string();
+		out.write(data.data(), static_cast<std::streamsize>(data.size()));
+	}
+	out.write(reinterpret_cast<const char *>(hashTable.data()), static_cast<std::streamsize>(hashTable.size()));
+	out.write(reinterpret_cast<const char *>(blockTable.data()), static_cast<std::streamsize>(blockTable.size()));
+	out.close();
+	if (out.fail())
+		return std::string("failed to write ") + tmpPath_.string() + ": " + std::strerror(errno);
+	spool.close();
+
+	std::error_code ec;
+	std::filesystem::remove(spoolPath_, ec);
+	std::filesystem::rename(tmpPath_, path_, ec);
+	if (ec)
+		return "failed to rename " + tmpPath_.string() + ": " + ec.message();
+	return "";
+}
+
+} // namespace devilution_mpq_tools
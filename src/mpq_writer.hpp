@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mpq_reader.hpp"
+
+namespace devilution_mpq_tools {
+
+// Writes a new MPQ archive in the original format (format version 0, as Diablo's) that DevilutionX can load directly.
+//
+// The file data is streamed to a spool file next to the destination as it is added, in whatever order the files
+// come in. `finish()` then writes the archive with the files sorted by path, followed by a `(listfile)`,
+// the hash table and the block table, so that the same files always give the same archive,
+// and an interrupted run does not leave a truncated archive behind.
+//
+// `addFile` and `removeFile` are thread-safe. Compression happens outside of the lock.
+class MpqWriter {
+public:
+	// If `compress` is true, each file is zlib-compressed sector by sector.
+	// Files that do not get smaller are stored as is.
+	//
+	// Returns `nullptr` and sets `error` on failure.
+	static std::unique_ptr<MpqWriter> create(const std::filesystem::path &path, bool compress, std::string &error);
+
+	MpqWriter(const MpqWriter &) = delete;
+	MpqWriter &operator=(const MpqWriter &) = delete;
+
+	// Adds a file at the given path (with either `/` or `\` as separators).
+	// If a file with the same path has already been added, it is replaced.
+	[[nodiscard]] std::string addFile(std::string_view mpqPath, std::span<const uint8_t> data);
+
+	// Removes a file added earlier, if any. Its data remains in the spool, but is not copied into the archive.
+	void removeFile(std::string_view mpqPath);
+
+	// Writes the archive from the spooled files and moves it to its destination.
+	[[nodiscard]] std::string finish();
+
+private:
+	MpqWriter(const std::filesystem::path &path, bool compress);
+
+	[[nodiscard]] std::string writeBlock(std::string_view mpqPath, std::span<const uint8_t> packed,
+	    uint32_t unpackedSize, uint32_t flags);
+
+	std::filesystem::path path_;
+	std::filesystem::path tmpPath_;
+	std::filesystem::path spoolPath_;
+	bool compress_;
+
+	std::mutex mutex_;
+	std::ofstream spool_;
+	uint64_t spoolSize_ = 0;
+
+	struct FileEntry {
+		std::string mpqPath;
+		// Where the packed data is in the spool file.
+		uint64_t spoolOffset;
+		// The offset is only set once the archive is written.
+		MpqBlockEntry block;
+	};
+	std::vector<FileEntry> files_;
+	// Normalized (upper-case, backslash-separated) path to index in `files_`.
+	std::unordered_map<std::string, size_t> fileIndices_;
+};
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,131 @@
+#include "output_writer.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+namespace devilution_mpq_tools {
+
+OutputWriter::OutputWriter(size_t maxBytesInFlight)
+    : maxBytesInFlight_(maxBytesInFlight)
+    , thread_([this]() { run(); })
+{
+}
+
+OutputWriter::~OutputWriter()
+{
+	finish();
+}
+
+void OutputWriter::write(std::filesystem::path path, std::vector<uint8_t> data)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		// A file larger than the limit is still accepted once the queue is empty.
+		spaceAvailable_.wait(lock, [&]() {
+			return bytesInFlight_ == 0 || bytesInFlight_ + data.size() <= maxBytesInFlight_;
+		});
+		bytesInFlight_ += data.size();
+		requests_.push_back(Request { std::move(path), std::move(data), nullptr, {} });
+	}
+	requestAvailable_.notify_one();
+}
+
+void OutputWriter::then(std::vector<std::filesystem::path> paths, std::function<void(bool written)> callback)
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		requests_.push_back(Request { {}, {}, std::move(callback), std::move(paths) });
+	}
+	requestAvailable_.notify_one();
+}
+
+std::string OutputWriter::finish()
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	requestAvailable_.notify_one();
+	if (thread_.joinable())
+		thread_.join();
+	if (numFailed_ != 0)
+		return "failed to write " + std::to_string(numFailed_) + (numFailed_ == 1 ? " file" : " files");
+	return "";
+}
+
+void OutputWriter::run()
+{
+	std::deque<Request> batch;
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		requestAvailable_.wait(lock, [this]() { return stopping_ || !requests_.empty(); });
+		if (requests_.empty())
+			return;
+		batch.swap(requests_);
+		lock.unlock();
+		size_t batchBytes = 0;
+		for (Request &request : batch) {
+			if (request.callback) {
+				runCallback(request);
+				continue;
+			}
+			if (const std::string error = writeFile(request); !error.empty()) {
+				std::cerr << error << std::endl;
+				failedPaths_.insert(request.path.native());
+				++numFailed_;
+			} else {
+				// A later write of the same path replaces the failed one.
+				failedPaths_.erase(request.path.native());
+			}
+			batchBytes += request.data.size();
+		}
+		batch.clear();
+		lock.lock();
+		bytesInFlight_ -= batchBytes;
+		spaceAvailable_.notify_all();
+	}
+}
+
+void OutputWriter::runCallback(Request &request)
+{
+	bool written = true;
+	for (const std::filesystem::path &path : request.callbackPaths) {
+		if (failedPaths_.contains(path.native())) {
+			written = false;
+			break;
+		}
+	}
+	request.callback(written);
+}
+
+std::string OutputWriter::writeFile(const Request &request)
+{
+	const std::filesystem::path &outputPath = request.path;
+	const std::filesystem::path parent = outputPath.parent_path();
+	if (!parent.empty() && !createdDirectories_.contains(parent.native())) {
+		std::error_code ec;
+		std::filesystem::create_directories(parent, ec);
+		if (ec)
+			return "Failed to create " + parent.string() + ": " + ec.message();
+		createdDirectories_.insert(parent.native());
+	}
+	// The file may be hard-linked to another output. Replace it rather than writing through the link.
+	std::error_code removeError;
+	std::filesystem::remove(outputPath, removeError);
+	std::ofstream out { outputPath.c_str(), std::ios::binary };
+	if (out.fail())
+		return "Failed to open " + outputPath.string() + " for writing: " + std::strerror(errno);
+	out.write(reinterpret_cast<const char *>(request.data.data()), static_cast<std::streamsize>(request.data.size()));
+	if (out.fail())
+		return "Failed to write " + outputPath.string() + ": " + std::strerror(errno);
+	out.close();
+	if (out.fail())
+		return "Failed to close " + outputPath.string() + ": " + std::strerror(errno);
+	return "";
+}
+
+} // namespace devilution_mpq_tools
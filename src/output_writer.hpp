@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// Writes files on a dedicated thread, so that the conversion threads do not block on disk I/O.
+//
+// The queue is bounded by the total size of the pending files: `write` blocks
+// while more than `maxBytesInFlight` bytes are waiting to be written.
+//
+// The writer thread drains all the pending requests in one go and remembers
+// the directories it has created, so each directory is only created once.
+//
+// All methods are thread-safe.
+class OutputWriter {
+public:
+	explicit OutputWriter(size_t maxBytesInFlight);
+
+	// Calls `finish()`.
+	~OutputWriter();
+
+	OutputWriter(const OutputWriter &) = delete;
+	OutputWriter &operator=(const OutputWriter &) = delete;
+
+	// Queues the file for writing, creating its parent directories as needed.
+	void write(std::filesystem::path path, std::vector<uint8_t> data);
+
+	// Runs `callback` on the writer thread once all the previously queued files have been written,
+	// with whether all of `paths` were written successfully.
+	void then(std::vector<std::filesystem::path> paths, std::function<void(bool written)> callback);
+
+	// Writes all the pending files and stops the writer thread.
+	// Returns an error message if any file failed to be written.
+	std::string finish();
+
+private:
+	struct Request {
+		std::filesystem::path path;
+		std::vector<uint8_t> data;
+		std::function<void(bool)> callback;
+		std::vector<std::filesystem::path> callbackPaths;
+	};
+
+	void run();
+	void runCallback(Request &request);
+
+	// Returns an error message on failure.
+	std::string writeFile(const Request &request);
+
+	size_t maxBytesInFlight_;
+
+	std::mutex mutex_;
+	std::condition_variable requestAvailable_;
+	std::condition_variable spaceAvailable_;
+	std::deque<Request> requests_;
+	size_t bytesInFlight_ = 0;
+	bool stopping_ = false;
+
+	// Only accessed on the writer thread.
+	std::unordered_set<std::filesystem::path::string_type> createdDirectories_;
+	std::unordered_set<std::filesystem::path::string_type> failedPaths_;
+
+	// Written on the writer thread, read once it has stopped.
+	size_t numFailed_ = 0;
+
+	std::thread thread_;
+};
+
+} // namespace devilution_mpq_tools
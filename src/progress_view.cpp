@@ -0,0 +1,111 @@
+#include "progress_view.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr size_t MaxInteractiveLineLength = 79;
+
+bool IsInteractive()
+{
+#ifdef _WIN32
+	if (_isatty(_fileno(stderr)) == 0)
+		return false;
+	// Enable ANSI escape sequences on the Windows 10+ console.
+	HANDLE handle = GetStdHandle(STD_ERROR_HANDLE);
+	DWORD mode;
+	if (GetConsoleMode(handle, &mode) == 0)
+		return false;
+	return SetConsoleMode(handle, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != 0;
+#else
+	return isatty(fileno(stderr)) != 0;
+#endif
+}
+
+} // namespace
+
+ProgressView::ProgressView()
+    : interactive_(IsInteractive())
+{
+}
+
+size_t ProgressView::addRow(std::string name, size_t total)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	rows_.push_back(Row { .name = std::move(name), .total = total });
+	return rows_.size() - 1;
+}
+
+void ProgressView::start()
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	started_ = true;
+	if (!interactive_)
+		return;
+	for (const Row &row : rows_) {
+		printRow(row);
+		std::clog << "\n";
+	}
+	std::clog.flush();
+}
+
+void ProgressView::update(size_t row, size_t done, std::string_view status)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	Row &r = rows_[row];
+	if (r.finished)
+		return;
+	r.done = done;
+	r.status = status;
+	if (interactive_ && started_)
+		redrawRow(row);
+}
+
+void ProgressView::finish(size_t row, std::string_view status)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	Row &r = rows_[row];
+	r.done = r.total;
+	r.status = status;
+	r.finished = true;
+	if (interactive_) {
+		if (started_)
+			redrawRow(row);
+	} else {
+		printRow(r);
+		std::clog << std::endl;
+	}
+}
+
+void ProgressView::printRow(const Row &row)
+{
+	std::string line = "[" + std::to_string(row.done) + "/" + std::to_string(row.total) + "] "
+	    + row.name + ": " + row.status;
+	// A wrapped line would break the in-place redrawing.
+	if (interactive_ && line.size() > MaxInteractiveLineLength)
+		line.resize(MaxInteractiveLineLength);
+	std::clog << line;
+}
+
+void ProgressView::redrawRow(size_t rowIndex)
+{
+	// The cursor is always kept on the line after the last row.
+	const size_t linesUp = rows_.size() - rowIndex;
+	std::clog << "\x1b[" << linesUp << "A\r\x1b[2K";
+	printRow(rows_[rowIndex]);
+	std::clog << "\r\x1b[" << linesUp << "B";
+	std::clog.flush();
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// A multi-line progress display with one row per task (e.g. per MPQ).
+//
+// On a terminal, rows are redrawn in place using ANSI escape sequences.
+// Otherwise, only the final status of each row is printed.
+// All methods are thread-safe.
+class ProgressView {
+public:
+	ProgressView();
+
+	// Adds a row and returns its index.
+	size_t addRow(std::string name, size_t total);
+
+	// Prints the initial state of all the rows. Must be called once after all the rows have been added.
+	void start();
+
+	void update(size_t row, size_t done, std::string_view status);
+
+	// Marks the row as done. The row is no longer updated.
+	void finish(size_t row, std::string_view status);
+
+private:
+	struct Row {
+		std::string name {};
+		size_t total = 0;
+		size_t done = 0;
+		std::string status {};
+		bool finished = false;
+	};
+
+	void printRow(const Row &row);
+	void redrawRow(size_t rowIndex);
+
+	std::mutex mutex_;
+	std::vector<Row> rows_;
+	bool interactive_;
+	bool started_ = false;
+};
+
+} // namespace devilution_mpq_tools
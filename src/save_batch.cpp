@@ -0,0 +1,319 @@
+#include "save_batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+
+#include "mpq_archive.hpp"
+#include "mpq_listfile.hpp"
+#include "mpq_reader.hpp"
+#include "mpq_sources.hpp"
+#include "mpq_writer.hpp"
+#include "output_writer.hpp"
+#include "progress_view.hpp"
+#include "stats.hpp"
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+bool HasWildcards(std::string_view str)
+{
+	return str.find_first_of("*?") != std::string_view::npos;
+}
+
+// Matches `*` (any characters) and `?` (a single character).
+bool MatchesWildcards(std::string_view pattern, std::string_view str)
+{
+	size_t p = 0;
+	size_t s = 0;
+	// Where to resume after the last `*` if the rest does not match.
+	std::optional<size_t> starPattern;
+	size_t starStr = 0;
+	while (s < str.size()) {
+		if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s])) {
+			++p;
+			++s;
+		} else if (p < pattern.size() && pattern[p] == '*') {
+			starPattern = ++p;
+			starStr = s;
+		} else if (starPattern.has_value()) {
+			p = *starPattern;
+			s = ++starStr;
+		} else {
+			return false;
+		}
+	}
+	while (p < pattern.size() && pattern[p] == '*')
+		++p;
+	return p == pattern.size();
+}
+
+std::string SaveName(std::filesystem::path relativePath)
+{
+	const std::string ext = relativePath.extension().string();
+	relativePath.replace_extension();
+	return relativePath.generic_string() + "_" + ext.substr(1);
+}
+
+constexpr char Base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void WriteBase64(std::ostream &out, std::span<const uint8_t> data)
+{
+	char quad[4];
+	size_t i = 0;
+	for (; i + 3 <= data.size(); i += 3) {
+		const uint32_t bits = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		quad[0] = Base64Alphabet[bits >> 18];
+		quad[1] = Base64Alphabet[(bits >> 12) & 0x3F];
+		quad[2] = Base64Alphabet[(bits >> 6) & 0x3F];
+		quad[3] = Base64Alphabet[bits & 0x3F];
+		out.write(quad, 4);
+	}
+	if (i == data.size())
+		return;
+	const uint32_t bits = (data[i] << 16) | (i + 1 < data.size() ? data[i + 1] << 8 : 0);
+	quad[0] = Base64Alphabet[bits >> 18];
+	quad[1] = Base64Alphabet[(bits >> 12) & 0x3F];
+	quad[2] = i + 1 < data.size() ? Base64Alphabet[(bits >> 6) & 0x3F] : '=';
+	quad[3] = '=';
+	out.write(quad, 4);
+}
+
+// The state of a worker, reused across the saves it unpacks.
+struct SaveWorker {
+	// Created for the first save, and reset to each following one.
+	std::unique_ptr<MpqArchive> archive;
+	std::vector<uint32_t> blockIndices;
+
+	// All the files of the current save, one after another.
+	std::vector<uint8_t> fileBuf;
+	std::vector<std::pair<size_t, std::span<const uint8_t>>> files;
+
+	std::ostringstream records;
+};
+
+// Where the files of the saves go.
+class SaveOutput {
+public:
+	explicit SaveOutput(const SaveBatchOptions &options)
+	    : options_(options)
+	{
+	}
+
+	std::string open()
+	{
+		if (options_.outputFile.empty()) {
+			fileWriter_.emplace(options_.maxBytesInFlight);
+			return "";
+		}
+		std::string error;
+		if (options_.outputFile.extension() == ".mpq" || options_.outputFile.extension() == ".MPQ") {
+			mpqWriter_ = MpqWriter::create(options_.outputFile, options_.compress, error);
+			return error;
+		}
+		records_.open(options_.outputFile, std::ios::binary | std::ios::trunc);
+		if (!records_)
+			return "failed to open " + options_.outputFile.string();
+		return "";
+	}
+
+	// Writes all the files of a save at once.
+	std::string write(const SaveFile &save, const MpqListfile &listfile, SaveWorker &worker)
+	{
+		if (fileWriter_.has_value()) {
+			for (const auto &[fileIndex, data] : worker.files) {
+				fileWriter_->write(options_.outputRoot / save.name / listfile.path(fileIndex),
+				    std::vector<uint8_t>(data.begin(), data.end()));
+			}
+			return "";
+		}
+		if (mpqWriter_ != nullptr) {
+			for (size_t i = 0; i < worker.files.size(); ++i) {
+				const auto &[fileIndex, data] = worker.files[i];
+				if (std::string error = mpqWriter_->addFile(save.name + "/" + listfile.path(fileIndex), data); !error.empty()) {
+					// The failed save leaves none of its files behind.
+					for (size_t j = 0; j < i; ++j)
+						mpqWriter_->removeFile(save.name + "/" + listfile.path(worker.files[j].first));
+					return error;
+				}
+			}
+			return "";
+		}
+		std::ostringstream &out = worker.records;
+		out.str("");
+		const std::string savePath = save.path.generic_string();
+		for (const auto &[fileIndex, data] : worker.files) {
+			out << "{\"save\":";
+			WriteJsonString(out, savePath);
+			out << ",\"path\":";
+			WriteJsonString(out, listfile.path(fileIndex));
+			out << ",\"size\":" << data.size() << ",\"data\":\"";
+			WriteBase64(out, data);
+			out << "\"}\n";
+		}
+		const std::string records = out.str();
+		const std::lock_guard<std::mutex> lock { recordsMutex_ };
+		records_.write(records.data(), static_cast<std::streamsize>(records.size()));
+		return "";
+	}
+
+	std::string finish()
+	{
+		if (fileWriter_.has_value())
+			return fileWriter_->finish();
+		if (mpqWriter_ != nullptr)
+			return mpqWriter_->finish();
+		records_.close();
+		if (!records_)
+			return "failed to write " + options_.outputFile.string();
+		return "";
+	}
+
+private:
+	const SaveBatchOptions &options_;
+	std::optional<OutputWriter> fileWriter_;
+	std::unique_ptr<MpqWriter> mpqWriter_;
+	std::mutex recordsMutex_;
+	std::ofstream records_;
+};
+
+// Reads all the files of the save before writing any, so that a broken save leaves no outputs behind.
+std::string ConvertSave(const SaveFile &save, const MpqListfile &listfile, SaveOutput &output, SaveWorker &worker)
+{
+	std::string error;
+	const std::unique_ptr<MpqReader> reader = MpqReader::open(save.path, error);
+	if (reader == nullptr)
+		return error;
+	if (worker.archive == nullptr) {
+		worker.archive = std::make_unique<MpqArchive>(save.path, *reader);
+	} else {
+		worker.archive->reset(save.path, *reader);
+	}
+	worker.blockIndices.resize(listfile.size());
+	reader->findBlocks(listfile.hashes, worker.blockIndices);
+
+	size_t totalSize = 0;
+	for (const uint32_t blockIndex : worker.blockIndices) {
+		if (blockIndex != MpqReader::NoBlock)
+			totalSize += reader->block(blockIndex).unpackedSize;
+	}
+	if (worker.fileBuf.size() < totalSize)
+		worker.fileBuf.resize(totalSize);
+	worker.files.clear();
+	size_t offset = 0;
+	for (size_t i = 0; i < listfile.size(); ++i) {
+		const uint32_t blockIndex = worker.blockIndices[i];
+		if (blockIndex == MpqReader::NoBlock)
+			continue;
+		const size_t size = reader->block(blockIndex).unpackedSize;
+		error = worker.archive->readFile(blockIndex, listfile.path(i), listfile.hashes[i].fileKey, &worker.fileBuf[offset]);
+		if (!error.empty())
+			return std::string("failed to read ") + listfile.path(i) + ": " + error;
+		worker.files.emplace_back(i, std::span<const uint8_t>(&worker.fileBuf[offset], size));
+		offset += size;
+	}
+	return output.write(save, listfile, worker);
+}
+
+} // namespace
+
+std::string FindSaveFiles(const std::filesystem::path &pattern, std::vector<SaveFile> &saves)
+{
+	const size_t numSaves = saves.size();
+	std::error_code ec;
+	const std::string filename = pattern.filename().string();
+	if (HasWildcards(filename)) {
+		const std::filesystem::path directory = pattern.has_parent_path() ? pattern.parent_path() : ".";
+		for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(directory, ec)) {
+			const std::filesystem::path &path = entry.path();
+			if (entry.is_regular_file() && IsSaveFileExtension(path.extension())
+			    && MatchesWildcards(filename, path.filename().string()))
+				saves.push_back(SaveFile { path, SaveName(path.filename()) });
+		}
+		if (ec)
+			return "Failed to list " + directory.string() + ": " + ec.message();
+	} else if (std::filesystem::is_directory(pattern, ec)) {
+		for (const std::filesystem::directory_entry &entry : std::filesystem::recursive_directory_iterator(
+		         pattern, std::filesystem::directory_options::skip_permission_denied, ec)) {
+			const std::filesystem::path &path = entry.path();
+			if (entry.is_regular_file() && IsSaveFileExtension(path.extension()))
+				saves.push_back(SaveFile { path, SaveName(path.lexically_relative(pattern)) });
+		}
+		if (ec)
+			return "Failed to list " + pattern.string() + ": " + ec.message();
+	} else if (std::filesystem::is_regular_file(pattern, ec)) {
+		if (!IsSaveFileExtension(pattern.extension()))
+			return pattern.string() + " is not a save file";
+		saves.push_back(SaveFile { pattern, SaveName(pattern.filename()) });
+	} else {
+		return "No such file or directory: " + pattern.string();
+	}
+	if (saves.size() == numSaves)
+		return "No save files at " + pattern.string();
+	// The directory iteration order is unspecified.
+	std::sort(saves.begin() + static_cast<std::ptrdiff_t>(numSaves), saves.end(), [](const SaveFile &a, const SaveFile &b) {
+		return a.path < b.path;
+	});
+	return "";
+}
+
+std::string ConvertSaves(std::span<const SaveFile> saves, const SaveBatchOptions &options, ThreadPool &pool,
+    SaveBatchResult &result)
+{
+	const auto start = std::chrono::steady_clock::now();
+	std::unordered_map<std::string_view, const SaveFile *> names;
+	for (const SaveFile &save : saves) {
+		const auto [it, inserted] = names.emplace(save.name, &save);
+		if (!inserted)
+			return "Saves " + it->second->path.string() + " and " + save.path.string() + " would both be unpacked as " + save.name;
+	}
+
+	SaveOutput output { options };
+	if (std::string error = output.open(); !error.empty())
+		return error;
+
+	const MpqListfile listfile = GetEmbeddedListfile("save");
+	std::vector<SaveWorker> workers(pool.numWorkers());
+	std::atomic<size_t> numDone = 0;
+	std::atomic<size_t> numFiles = 0;
+	std::atomic<size_t> numBytes = 0;
+	std::mutex errorsMutex;
+
+	ProgressView progress;
+	const size_t progressRow = progress.addRow("saves", saves.size());
+	progress.start();
+	for (const SaveFile &save : saves) {
+		pool.submit([&](unsigned workerIndex) {
+			SaveWorker &worker = workers[workerIndex];
+			const std::string error = ConvertSave(save, listfile, output, worker);
+			if (error.empty()) {
+				numFiles += worker.files.size();
+				for (const auto &[fileIndex, data] : worker.files)
+					numBytes += data.size();
+			} else {
+				const std::lock_guard<std::mutex> lock { errorsMutex };
+				result.errors.push_back(save.path.string() + ": " + error);
+			}
+			progress.update(progressRow, ++numDone, "Unpacked " + save.name);
+		});
+	}
+	pool.wait();
+	progress.finish(progressRow, "Done");
+	if (std::string error = output.finish(); !error.empty())
+		return error;
+
+	result.numSaves = saves.size() - result.errors.size();
+	result.numFiles = numFiles;
+	result.numBytes = numBytes;
+	result.duration = std::chrono::steady_clock::now() - start;
+	return "";
+}
+
+} // namespace devilution_mpq_tools
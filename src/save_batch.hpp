@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace devilution_mpq_tools {
+
+// A save file to unpack with `ConvertSaves`.
+struct SaveFile {
+	std::filesystem::path path;
+
+	// Where its files go: the directory under the output root, or the path prefix in the output MPQ.
+	// Its path relative to the directory it was found in, with the extension joined by `_`, e.g. "player1/single_0_sv".
+	std::string name;
+};
+
+// Adds the save files (`.sv` and `.hsv`) at `pattern` to `saves`: a single save file, a directory,
+// searched recursively, or a file name with `*` and `?` wildcards, e.g. "saves/single_*.sv".
+//
+// Returns an error message on failure, or if there are no save files at `pattern`.
+std::string FindSaveFiles(const std::filesystem::path &pattern, std::vector<SaveFile> &saves);
+
+struct SaveBatchOptions {
+	// Each save is unpacked into `outputRoot / SaveFile::name`, unless `outputFile` is set.
+	std::filesystem::path outputRoot;
+
+	// If set, all the saves go into this single file instead: an MPQ if it has the `.mpq` extension,
+	// otherwise newline-delimited JSON records, one per file:
+	// {"save":"<save file path>","path":"<path in the save>","size":<size>,"data":"<base64>"}
+	std::filesystem::path outputFile;
+
+	// Compress the files in the output MPQ.
+	bool compress = true;
+
+	// Bounds the memory used by the unpacked files that are waiting to be written.
+	size_t maxBytesInFlight = 64 * 1024 * 1024;
+};
+
+struct SaveBatchResult {
+	size_t numSaves = 0;
+	size_t numFiles = 0;
+	size_t numBytes = 0;
+	std::chrono::steady_clock::duration duration {};
+
+	// A message for each save that could not be unpacked. The other saves are unpacked regardless,
+	// and the failed ones leave no outputs behind.
+	std::vector<std::string> errors;
+};
+
+// Unpacks many save files at once, a save per task. Each worker reuses its `MpqArchive` and buffers across
+// the saves, and the files of a save are looked up with the precomputed hashes of the save listfile.
+//
+// Returns an error message if the outputs can not be written. The errors of the individual saves are in `result`.
+std::string ConvertSaves(std::span<const SaveFile> saves, const SaveBatchOptions &options, ThreadPool &pool,
+    SaveBatchResult &result);
+
+} // namespace devilution_mpq_tools
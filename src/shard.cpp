@@ -0,0 +1,98 @@
+#include "shard.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <system_error>
+#include <tuple>
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr std::string_view ShardManifestPrefix = ".unpack_and_minify_mpq.shard-";
+constexpr std::string_view ShardManifestSuffix = ".manifest";
+
+// Parses "K<separator>N" into a shard.
+bool ParseShardNumbers(std::string_view str, std::string_view separator, Shard &shard)
+{
+	const size_t separatorPos = str.find(separator);
+	if (separatorPos == std::string_view::npos)
+		return false;
+	unsigned k;
+	unsigned n;
+	const char *const kEnd = str.data() + separatorPos;
+	const char *const nBegin = kEnd + separator.size();
+	const char *const nEnd = str.data() + str.size();
+	const auto [kPtr, kEc] = std::from_chars(str.data(), kEnd, k);
+	const auto [nPtr, nEc] = std::from_chars(nBegin, nEnd, n);
+	if (kEc != std::errc() || kPtr != kEnd || nEc != std::errc() || nPtr != nEnd || k == 0 || k > n)
+		return false;
+	shard = Shard { k - 1, n };
+	return true;
+}
+
+} // namespace
+
+std::string ParseShard(std::string_view str, Shard &shard)
+{
+	if (!ParseShardNumbers(str, "/", shard))
+		return "expected K/N with 1 <= K <= N, e.g. 1/4, got " + std::string(str);
+	return "";
+}
+
+std::string FormatShard(const Shard &shard)
+{
+	return std::to_string(shard.index + 1) + "/" + std::to_string(shard.count);
+}
+
+std::string ShardManifestFilename(const Shard &shard)
+{
+	return std::string(ShardManifestPrefix) + std::to_string(shard.index + 1) + "-of-" + std::to_string(shard.count)
+	    + std::string(ShardManifestSuffix);
+}
+
+std::optional<Shard> ParseShardManifestFilename(std::string_view filename)
+{
+	if (!filename.starts_with(ShardManifestPrefix) || !filename.ends_with(ShardManifestSuffix))
+		return std::nullopt;
+	filename.remove_prefix(ShardManifestPrefix.size());
+	filename.remove_suffix(ShardManifestSuffix.size());
+	Shard shard;
+	if (!ParseShardNumbers(filename, "-of-", shard))
+		return std::nullopt;
+	return shard;
+}
+
+std::vector<unsigned> AssignShards(std::span<const ShardUnit> units, unsigned count)
+{
+	// Longest processing time first: the heaviest remaining unit goes to the lightest shard.
+	// Ties are broken by the key, and then by the number of units and the index of the shard,
+	// so that the assignment is deterministic and units without weight are spread out too.
+	std::vector<size_t> order(units.size());
+	std::iota(order.begin(), order.end(), size_t { 0 });
+	std::sort(order.begin(), order.end(), [&units](size_t a, size_t b) {
+		if (units[a].weight != units[b].weight)
+			return units[a].weight > units[b].weight;
+		return units[a].key < units[b].key;
+	});
+
+	// (total weight, number of units, shard index), lightest on top.
+	using ShardLoad = std::tuple<uint64_t, size_t, unsigned>;
+	std::priority_queue<ShardLoad, std::vector<ShardLoad>, std::greater<>> loads;
+	for (unsigned i = 0; i < count; ++i)
+		loads.emplace(0, 0, i);
+
+	std::vector<unsigned> result(units.size());
+	for (const size_t unitIndex : order) {
+		auto [weight, numUnits, shardIndex] = loads.top();
+		loads.pop();
+		result[unitIndex] = shardIndex;
+		loads.emplace(weight + units[unitIndex].weight, numUnits + 1, shardIndex);
+	}
+	return result;
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// One of `count` parts of a conversion that independent processes run without coordinating,
+// e.g. on several machines that share the input MPQs and the output directory.
+struct Shard {
+	// 0-based, but 1-based on the command line and in the file names: "1/4" is `{ 0, 4 }`.
+	unsigned index = 0;
+	unsigned count = 1;
+};
+
+// Parses "K/N", with 1 <= K <= N. Returns an error message on failure.
+std::string ParseShard(std::string_view str, Shard &shard);
+
+// "K/N", as accepted by `ParseShard`.
+std::string FormatShard(const Shard &shard);
+
+// The name of the manifest file that the shard keeps in the output directory, e.g. ".unpack_and_minify_mpq.shard-1-of-4.manifest".
+std::string ShardManifestFilename(const Shard &shard);
+
+// The shard whose manifest file has this name, if any.
+std::optional<Shard> ParseShardManifestFilename(std::string_view filename);
+
+struct ShardUnit {
+	// Unique across all the units.
+	std::string key;
+
+	// Roughly proportional to the work, e.g. the stored size of the inputs.
+	uint64_t weight;
+};
+
+// Assigns each unit to one of `count` shards, so that the shards have about the same total weight.
+// Returns the shard index of each unit.
+//
+// The result only depends on the keys and the weights, not on the order of the units,
+// so every process that plans the same inputs gets the same assignment.
+std::vector<unsigned> AssignShards(std::span<const ShardUnit> units, unsigned count);
+
+} // namespace devilution_mpq_tools
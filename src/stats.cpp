@@ -0,0 +1,261 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+// clang-format off
+#include <windows.h>
+#include <psapi.h>
+// clang-format on
+#else
+#include <sys/resource.h>
+#endif
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+struct Totals {
+	size_t numEntries = 0;
+	size_t inputSize = 0;
+	size_t outputSize = 0;
+	size_t peakBufferSize = 0;
+	size_t dedupSavedSize = 0;
+	std::array<std::chrono::nanoseconds, NumStages> stageDurations {};
+
+	void add(const EntryStats &entry)
+	{
+		++numEntries;
+		inputSize += entry.inputSize;
+		outputSize += entry.outputSize;
+		dedupSavedSize += entry.dedupSavedSize;
+		if (entry.peakBufferSize > peakBufferSize)
+			peakBufferSize = entry.peakBufferSize;
+		for (const EntryStats::Span &span : entry.spans)
+			stageDurations[static_cast<size_t>(span.stage)] += span.duration;
+	}
+};
+
+double ToSeconds(std::chrono::nanoseconds duration)
+{
+	return std::chrono::duration<double>(duration).count();
+}
+
+double ToMicroseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void WriteTotals(std::ostream &out, const Totals &totals)
+{
+	out << "\"entries\": " << totals.numEntries
+	    << ", \"input_bytes\": " << totals.inputSize
+	    << ", \"output_bytes\": " << totals.outputSize
+	    << ", \"peak_buffer_bytes\": " << totals.peakBufferSize
+	    << ", \"dedup_saved_bytes\": " << totals.dedupSavedSize
+	    << ", \"stage_seconds\": {";
+	bool first = true;
+	for (size_t i = 0; i < NumStages; ++i) {
+		if (totals.stageDurations[i].count() == 0)
+			continue;
+		if (!first)
+			out << ", ";
+		first = false;
+		WriteJsonString(out, StageName(static_cast<Stage>(i)));
+		out << ": " << ToSeconds(totals.stageDurations[i]);
+	}
+	out << "}";
+}
+
+std::string CloseOutput(std::ofstream &out, const std::filesystem::path &path)
+{
+	out.close();
+	if (out.fail())
+		return "failed to write " + path.string() + ": " + std::strerror(errno);
+	return "";
+}
+
+} // namespace
+
+void WriteJsonString(std::ostream &out, std::string_view str)
+{
+	out << '"';
+	for (const char c : str) {
+		switch (c) {
+		case '"':
+			out << "\\\"";
+			break;
+		case '\\':
+			out << "\\\\";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[7];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out << escaped;
+			} else {
+				out << c;
+			}
+		}
+	}
+	out << '"';
+}
+
+std::string_view StageName(Stage stage)
+{
+	switch (stage) {
+	case Stage::Lookup:
+		return "lookup";
+	case Stage::Read:
+		return "read";
+	case Stage::Cl2ToClx:
+		return "cl22clx";
+	case Stage::CelToClx:
+		return "cel2clx";
+	case Stage::PcxToClx:
+		return "pcx2clx";
+	case Stage::SpellIcons:
+		return "spell_icons";
+	case Stage::AutoCrop:
+		return "auto_crop";
+	case Stage::DedupTiles:
+		return "dedup_tiles";
+	case Stage::Audio:
+		return "audio";
+	case Stage::Combine:
+		return "combine";
+	case Stage::Write:
+		return "write";
+	}
+	return "unknown";
+}
+
+uint64_t PeakRssBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0)
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+	// In kilobytes.
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+StatsCollector::StatsCollector()
+    : start_(std::chrono::steady_clock::now())
+{
+}
+
+void StatsCollector::record(EntryStats &&entry)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	entries_.push_back(std::move(entry));
+}
+
+std::string StatsCollector::writeReport(const std::filesystem::path &path)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	Totals totals;
+	std::map<std::string_view, Totals> archiveTotals;
+	for (const EntryStats &entry : entries_) {
+		totals.add(entry);
+		archiveTotals[entry.archive].add(entry);
+	}
+
+	std::ofstream out { path, std::ios::binary };
+	if (out.fail())
+		return "failed to open " + path.string() + " for writing: " + std::strerror(errno);
+	out << "{\n  \"wall_seconds\": " << ToSeconds(std::chrono::steady_clock::now() - start_)
+	    << ",\n  \"peak_rss_bytes\": " << PeakRssBytes()
+	    << ",\n  \"totals\": {";
+	WriteTotals(out, totals);
+	out << "},\n  \"archives\": [";
+	bool first = true;
+	for (const auto &[archive, archiveTotal] : archiveTotals) {
+		out << (first ? "\n" : ",\n") << "    {\"name\": ";
+		first = false;
+		WriteJsonString(out, archive);
+		out << ", ";
+		WriteTotals(out, archiveTotal);
+		out << "}";
+	}
+	out << "\n  ],\n  \"entries\": [";
+	first = true;
+	for (const EntryStats &entry : entries_) {
+		out << (first ? "\n" : ",\n") << "    {\"archive\": ";
+		first = false;
+		WriteJsonString(out, entry.archive);
+		out << ", \"path\": ";
+		WriteJsonString(out, entry.path);
+		out << ", \"worker\": " << entry.worker << ", ";
+		Totals entryTotals;
+		entryTotals.add(entry);
+		WriteTotals(out, entryTotals);
+		out << "}";
+	}
+	out << "\n  ]\n}\n";
+	return CloseOutput(out, path);
+}
+
+std::string StatsCollector::writeTrace(const std::filesystem::path &path)
+{
+	const std::lock_guard<std::mutex> lock(mutex_);
+	std::ofstream out { path, std::ios::binary };
+	if (out.fail())
+		return "failed to open " + path.string() + " for writing: " + std::strerror(errno);
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool first = true;
+	const auto writeEvent = [&](std::string_view name, std::string_view category, unsigned worker,
+	                            std::chrono::steady_clock::time_point begin, std::chrono::nanoseconds duration, const EntryStats &entry) {
+		out << (first ? "\n" : ",\n") << "{\"name\": ";
+		first = false;
+		WriteJsonString(out, name);
+		out << ", \"cat\": ";
+		WriteJsonString(out, category);
+		out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << worker
+		    << ", \"ts\": " << ToMicroseconds(begin - start_)
+		    << ", \"dur\": " << ToMicroseconds(duration)
+		    << ", \"args\": {\"archive\": ";
+		WriteJsonString(out, entry.archive);
+		out << ", \"path\": ";
+		WriteJsonString(out, entry.path);
+		out << ", \"input_bytes\": " << entry.inputSize << ", \"output_bytes\": " << entry.outputSize << "}}";
+	};
+	for (const EntryStats &entry : entries_) {
+		if (entry.spans.empty())
+			continue;
+		// An enclosing event for the whole entry, with the stages nested under it.
+		std::chrono::steady_clock::time_point begin = entry.spans.front().begin;
+		std::chrono::steady_clock::time_point end = begin;
+		for (const EntryStats::Span &span : entry.spans) {
+			begin = std::min(begin, span.begin);
+			end = std::max(end, span.begin + span.duration);
+		}
+		writeEvent(entry.path, "entry", entry.worker, begin, end - begin, entry);
+		for (const EntryStats::Span &span : entry.spans)
+			writeEvent(StageName(span.stage), "stage", entry.worker, span.begin, span.duration, entry);
+	}
+	out << "\n]}\n";
+	return CloseOutput(out, path);
+}
+
+} // namespace devilution_mpq_tools
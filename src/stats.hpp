@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// The stages of processing an MPQ entry.
+enum class Stage : uint8_t {
+	Lookup,
+	Read,
+	Cl2ToClx,
+	CelToClx,
+	PcxToClx,
+	SpellIcons,
+	AutoCrop,
+	DedupTiles,
+	Audio,
+	Combine,
+	Write,
+};
+
+inline constexpr size_t NumStages = static_cast<size_t>(Stage::Write) + 1;
+
+std::string_view StageName(Stage stage);
+
+// Writes `str` as a JSON string, quoted and escaped.
+void WriteJsonString(std::ostream &out, std::string_view str);
+
+// The peak resident set size of the process in bytes, or 0 if unknown.
+uint64_t PeakRssBytes();
+
+// The statistics of a single work item (an MPQ entry or a combine group).
+struct EntryStats {
+	struct Span {
+		Stage stage;
+		std::chrono::steady_clock::time_point begin;
+		std::chrono::nanoseconds duration;
+	};
+
+	std::string archive;
+	std::string path;
+	unsigned worker = 0;
+	std::vector<Span> spans;
+	size_t inputSize = 0;
+	size_t outputSize = 0;
+	size_t peakBufferSize = 0;
+
+	// The output bytes saved by storing identical CLX data once.
+	size_t dedupSavedSize = 0;
+
+	void noteBuffer(size_t size)
+	{
+		if (size > peakBufferSize)
+			peakBufferSize = size;
+	}
+};
+
+// Collects the statistics of all the work items, and writes them out
+// as a JSON report and/or a Chrome trace (chrome://tracing, Perfetto).
+//
+// `record` is thread-safe.
+class StatsCollector {
+public:
+	StatsCollector();
+
+	void record(EntryStats &&entry);
+
+	// Per-entry stats, per-archive and global totals, and the peak RSS.
+	[[nodiscard]] std::string writeReport(const std::filesystem::path &path);
+
+	// A trace event for every stage of every entry, with a track per worker.
+	[[nodiscard]] std::string writeTrace(const std::filesystem::path &path);
+
+private:
+	std::chrono::steady_clock::time_point start_;
+	std::mutex mutex_;
+	std::vector<EntryStats> entries_;
+};
+
+// Times a stage of `entry` for as long as it is in scope.
+// Does nothing if `entry` is null, so that the stats cost nothing when disabled.
+class StageTimer {
+public:
+	StageTimer(EntryStats *entry, Stage stage)
+	    : entry_(entry)
+	    , stage_(stage)
+	{
+		if (entry_ != nullptr)
+			begin_ = std::chrono::steady_clock::now();
+	}
+
+	~StageTimer()
+	{
+		if (entry_ != nullptr)
+			entry_->spans.push_back(EntryStats::Span { stage_, begin_, std::chrono::steady_clock::now() - begin_ });
+	}
+
+	StageTimer(const StageTimer &) = delete;
+	StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+	EntryStats *entry_;
+	Stage stage_;
+	std::chrono::steady_clock::time_point begin_;
+};
+
+} // namespace devilution_mpq_tools
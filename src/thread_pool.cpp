@@ -0,0 +1,88 @@
+#include "thread_pool.hpp"
+
+#include <utility>
+
+namespace devilution_mpq_tools {
+
+ThreadPool::ThreadPool(unsigned numWorkers)
+    : numWorkers_(numWorkers == 0 ? 1 : numWorkers)
+{
+	threads_.reserve(numWorkers_ - 1);
+	for (unsigned i = 1; i < numWorkers_; ++i) {
+		threads_.emplace_back([this, i]() { workerLoop(i); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	taskAvailable_.notify_all();
+	for (std::thread &thread : threads_)
+		thread.join();
+}
+
+void ThreadPool::submit(Task task)
+{
+	enqueue(std::move(task), /*front=*/false);
+}
+
+void ThreadPool::submitFront(Task task)
+{
+	enqueue(std::move(task), /*front=*/true);
+}
+
+void ThreadPool::enqueue(Task task, bool front)
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		if (front) {
+			tasks_.push_front(std::move(task));
+		} else {
+			tasks_.push_back(std::move(task));
+		}
+		++numUnfinished_;
+	}
+	taskAvailable_.notify_one();
+	// Tasks submitted by other tasks must also wake up the thread in `wait()`.
+	allDone_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (numUnfinished_ != 0) {
+		if (tasks_.empty()) {
+			allDone_.wait(lock, [this]() { return numUnfinished_ == 0 || !tasks_.empty(); });
+			continue;
+		}
+		Task task = std::move(tasks_.front());
+		tasks_.pop_front();
+		lock.unlock();
+		task(/*workerIndex=*/0);
+		lock.lock();
+		if (--numUnfinished_ == 0)
+			allDone_.notify_all();
+	}
+}
+
+void ThreadPool::workerLoop(unsigned workerIndex)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		taskAvailable_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+		if (tasks_.empty())
+			return;
+		Task task = std::move(tasks_.front());
+		tasks_.pop_front();
+		lock.unlock();
+		task(workerIndex);
+		lock.lock();
+		if (--numUnfinished_ == 0)
+			allDone_.notify_all();
+	}
+}
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace devilution_mpq_tools {
+
+// A fixed-size pool of worker threads with a single task queue, FIFO unless `submitFront` is used.
+//
+// The thread that calls `wait()` runs tasks as well, as worker 0.
+// A pool with `numWorkers = 1` thus runs every task on the calling thread.
+class ThreadPool {
+public:
+	// The argument is the index of the worker running the task,
+	// in the `[0, numWorkers())` range.
+	using Task = std::function<void(unsigned workerIndex)>;
+
+	explicit ThreadPool(unsigned numWorkers);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	[[nodiscard]] unsigned numWorkers() const { return numWorkers_; }
+
+	void submit(Task task);
+
+	// Queues the task ahead of all the others. Used for the parts of a task split across the workers,
+	// so that they run next rather than after everything that was queued before them.
+	void submitFront(Task task);
+
+	// Runs tasks on the calling thread until all the submitted tasks have finished.
+	void wait();
+
+private:
+	void enqueue(Task task, bool front);
+	void workerLoop(unsigned workerIndex);
+
+	unsigned numWorkers_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable taskAvailable_;
+	std::condition_variable allDone_;
+	std::deque<Task> tasks_;
+	size_t numUnfinished_ = 0;
+	bool stopping_ = false;
+};
+
+} // namespace devilution_mpq_tools
@@ -1,645 +1,1298 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <cerrno>
 #include <charconv>
+#include <chrono>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits>
-#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
-#include <variant>
 #include <vector>
 
-#include <cel2clx.hpp>
-#include <cl22clx.hpp>
-#include <clx_encode.hpp>
 #include <libmpq/mpq.h>
-#include <pcx2clx.hpp>
 
-#include "embedded_files.h"
-#include "extract_spell_icons.hpp"
+#include "asset_conversion.hpp"
+#include "clx_commands.hpp"
+#include "clx_sheet_builder.hpp"
+#include "manifest.hpp"
+#include "mpq_archive.hpp"
+#include "mpq_reader.hpp"
+#include "mpq_sources.hpp"
+#include "mpq_writer.hpp"
+#include "output_writer.hpp"
+#include "progress_view.hpp"
+#include "save_batch.hpp"
+#include "shard.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "wav_encoder.hpp"
 
 namespace {
 
-constexpr char kHelp[] = R"(Usage: unpack_and_minify_mpq [-h] [--output-dir OUTPUT_DIR] [--listfile LISTFILE] [--mp3] [mpq ...]
+using devilution_mpq_tools::AudioCodec;
+using devilution_mpq_tools::ClxCombineGroup;
+using devilution_mpq_tools::ClxCommand;
+using devilution_mpq_tools::ClxCommandEntry;
+using devilution_mpq_tools::ClxCommandKind;
+using devilution_mpq_tools::ClxSheetBuilder;
+using devilution_mpq_tools::CombinedClxPath;
+using devilution_mpq_tools::EntryConversion;
+using devilution_mpq_tools::HashBytes;
+using devilution_mpq_tools::HashString;
+using devilution_mpq_tools::IsSaveFileExtension;
+using devilution_mpq_tools::IsWavFile;
+using devilution_mpq_tools::Manifest;
+using devilution_mpq_tools::ManifestOutput;
+using devilution_mpq_tools::MpqArchive;
+using devilution_mpq_tools::MpqFileKey;
+using devilution_mpq_tools::MpqReader;
+using devilution_mpq_tools::MpqSource;
+using devilution_mpq_tools::MpqWriter;
+using devilution_mpq_tools::OutputCallback;
+using devilution_mpq_tools::OutputWriter;
+using devilution_mpq_tools::EntryStats;
+using devilution_mpq_tools::EncodeWav;
+using devilution_mpq_tools::ProgressView;
+using devilution_mpq_tools::SaveFile;
+using devilution_mpq_tools::Shard;
+using devilution_mpq_tools::ShardUnit;
+using devilution_mpq_tools::Stage;
+using devilution_mpq_tools::StageTimer;
+using devilution_mpq_tools::StatsCollector;
+using devilution_mpq_tools::ThreadPool;
+
+constexpr char kHelp[] = R"(Usage: unpack_and_minify_mpq [-h] [--output-dir OUTPUT_DIR] [--listfile LISTFILE] [--jobs N] [--force] [--output-mpq] [--no-compress]
+                             [--audio CODEC] [--stats FILE] [--trace FILE] [--verify-decompression] [--mp3]
+                             [--shard K/N | --merge] [--saves PATH]... [--saves-output FILE] [mpq ...]
 
 Unpacks Diablo and/or Hellfire MPQ(s), converts all the graphics to CLX, and, optionally, converts audio to MP3.
 If no MPQs are passed on the command line, converts all the MPQs in the current directory.
 
+Outputs that are up to date with their MPQ entries are skipped. The state of the previous run is
+kept in OUTPUT_DIR/.unpack_and_minify_mpq.manifest. An interrupted run resumes where it stopped.
+
 Options:
+  --audio CODEC               How to convert the WAV files: copy (default) or ima-adpcm.
+                              ima-adpcm re-encodes the PCM WAV files as IMA ADPCM, about 4 times smaller.
+  --force                     Convert everything, even the outputs that are up to date.
+  --jobs N                    Number of files to convert in parallel. Default: number of CPU cores.
+  --merge                     Check that all the shards of a --shard run converted their items, and combine
+                              their manifests into OUTPUT_DIR/.unpack_and_minify_mpq.manifest. Pass the same MPQs
+                              and options as to the shards. Converts nothing.
   --mp3                       Convert WAV files to MP3. Not implemented.
+  --no-compress               With --output-mpq, store the files in the MPQ uncompressed.
   --output-dir OUTPUT_DIR     Override output directory. Default: current directory.
+  --output-mpq                Write the outputs into OUTPUT_DIR/devilutionx-<name>.mpq instead of loose files.
+                              Always converts everything.
+  --shard K/N                 Only convert the K-th of N parts of the work, balanced by the stored size of the MPQ entries.
+                              The N shards can run at the same time, e.g. on different machines, with the same MPQs,
+                              options and OUTPUT_DIR, and no other coordination. Run --merge once they are all done.
+  --saves PATH                Unpack many save files at once: a save file, a directory (searched recursively),
+                              or a file name pattern with * and ?, e.g. "saves/*.sv". Can be repeated.
+                              Each save goes into OUTPUT_DIR/<its path relative to the directory>, e.g. single_0_sv.
+                              Always unpacks everything.
+  --saves-output FILE         With --saves, write all the saves into FILE instead: an MPQ if FILE ends with .mpq,
+                              otherwise a JSON object per line for each file, with the data in base64.
+  --stats FILE                Write the per-stage timings and sizes of every entry to FILE as JSON.
+                              Only the MPQs are covered, not --saves.
+  --trace FILE                Write a Chrome trace of the run to FILE (open in chrome://tracing or Perfetto).
+                              Only the MPQs are covered, not --saves.
+  --verify-decompression      Also decompress every sector with libmpq, and fail if the results differ.
+                              Implies --force. The spawn outputs are converted rather than linked.
 )";
 
+// Bump this whenever a change to the conversion changes the outputs,
+// so that the outputs of the previous versions are not considered up to date.
+// Changes that only make the outputs smaller, such as storing identical CLX lists once, do not need a bump:
+// the previous outputs load the same.
+constexpr std::string_view ConverterVersion = "1";
+
 void PrintHelp()
 {
 	std::cerr << kHelp << std::endl;
 }
 
-bool IsSaveFileExtension(const std::filesystem::path &ext)
-{
-	return ext == ".hsv" || ext == ".sv";
-}
-
-std::string SrcName(const std::filesystem::path &mpq)
+template <typename IntT>
+IntT ParseInt(
+    std::string_view str, IntT min = std::numeric_limits<IntT>::min(),
+    IntT max = std::numeric_limits<IntT>::max())
 {
-	std::string result = mpq.stem().string();
-	if (result == "DIABDAT")
-		result = "diabdat";
+	IntT result;
+	auto [ptr, ec] { std::from_chars(str.begin(), str.end(), result) };
+	if (ec == std::errc::result_out_of_range || result < min || result > max) {
+		std::cerr << "expected a number between " << min << " and " << max << ", got " << str << std::endl;
+		std::exit(1);
+	}
+	if (ec != std::errc()) {
+		std::cerr << "expected a number, got " << str << std::endl;
+		std::exit(1);
+	}
 	return result;
 }
 
-std::string DestName(const std::string &srcName)
+struct WrittenFile {
+	std::filesystem::path path;
+	size_t size;
+};
+
+// Where the outputs of a work item go.
+struct OutputSink {
+	// All the output paths are under this directory.
+	const std::filesystem::path *outputDirectory = nullptr;
+
+	// If set, the outputs are added to this MPQ instead of being written as loose files.
+	MpqWriter *mpqWriter = nullptr;
+
+	// Writes the loose files in the background.
+	OutputWriter *fileWriter = nullptr;
+
+	// The loose files written so far.
+	std::vector<WrittenFile> written;
+
+	// The stats of the current work item, or null if stats are disabled.
+	EntryStats *stats = nullptr;
+
+	// The output bytes saved by storing identical CLX data once, across all the work items.
+	size_t dedupSavedSize = 0;
+};
+
+void WriteOutput(OutputSink &sink, const std::filesystem::path &outputPath, const uint8_t *data, size_t size)
 {
-	if (srcName == "hfmonk" || srcName == "hfmusic" || srcName == "hfvoice")
-		return "hellfire";
-	return srcName;
+	const StageTimer timer { sink.stats, Stage::Write };
+	if (sink.stats != nullptr)
+		sink.stats->outputSize += size;
+	if (sink.mpqWriter != nullptr) {
+		std::string mpqPath = outputPath.lexically_relative(*sink.outputDirectory).generic_string();
+		std::replace(mpqPath.begin(), mpqPath.end(), '/', '\\');
+		const std::string error = sink.mpqWriter->addFile(mpqPath, { data, size });
+		if (!error.empty()) {
+			std::cerr << "Failed to add " << mpqPath << " to the MPQ: " << error << std::endl;
+			std::exit(1);
+		}
+		return;
+	}
+	sink.written.push_back(WrittenFile { outputPath, size });
+	sink.fileWriter->write(outputPath, std::vector<uint8_t>(data, data + size));
 }
 
-std::span<const char *const> GetSaveMpqFiles()
+// Writes the outputs of a conversion under `outputDirectory`.
+OutputCallback SinkOutput(OutputSink &sink, const std::filesystem::path &outputDirectory)
 {
-	return { embedded_save_listfile_data, embedded_save_listfile_size };
+	return [&sink, &outputDirectory](const std::filesystem::path &path, std::span<const uint8_t> data) {
+		WriteOutput(sink, outputDirectory / path, data.data(), data.size());
+	};
 }
 
-std::span<const char *const> GetMpqFiles(std::string_view srcName)
+// Exits if reading `mpqPath` failed.
+void CheckRead(std::string_view mpqPath, const std::string &error)
 {
-	if (srcName == "spawn")
-		return { embedded_spawn_listfile_data, embedded_spawn_listfile_size };
-	if (srcName == "diabdat")
-		return { embedded_diabdat_listfile_data, embedded_diabdat_listfile_size };
-	if (srcName == "hellfire")
-		return { embedded_hellfire_listfile_data, embedded_hellfire_listfile_size };
-	if (srcName == "hfmonk")
-		return { embedded_hfmonk_listfile_data, embedded_hfmonk_listfile_size };
-	if (srcName == "hfmusic")
-		return { embedded_hfmusic_listfile_data, embedded_hfmusic_listfile_size };
-	if (srcName == "hfvoice")
-		return { embedded_hfvoice_listfile_data, embedded_hfvoice_listfile_size };
-	return {};
+	if (error.empty())
+		return;
+	std::cerr << "Failed to read MPQ file " << mpqPath << ": " << error << std::endl;
+	std::exit(1);
 }
 
-std::span<const char *const> GetExcludedFiles(std::string_view srcName)
+void ExitOnError(const std::string &error)
 {
-	if (srcName == "spawn")
-		return { embedded_spawn_rm_data, embedded_spawn_rm_size };
-	if (srcName == "diabdat")
-		return { embedded_diabdat_rm_data, embedded_diabdat_rm_size };
-	if (srcName == "hellfire")
-		return { embedded_hellfire_rm_data, embedded_hellfire_rm_size };
-	if (srcName == "hfmonk")
-		return { embedded_hfmonk_rm_data, embedded_hfmonk_rm_size };
-	if (srcName == "hfmusic")
-		return { embedded_hfmusic_rm_data, embedded_hfmusic_rm_size };
-	if (srcName == "hfvoice")
-		return { embedded_hfvoice_rm_data, embedded_hfvoice_rm_size };
-	return {};
+	if (error.empty())
+		return;
+	std::cerr << error << std::endl;
+	std::exit(1);
 }
 
-std::span<const char *const> GetClxCommands(std::string_view srcName)
+std::unique_ptr<MpqReader> OpenMpqReader(const std::filesystem::path &path)
 {
-	if (srcName == "spawn")
-		return { embedded_spawn_clx_data, embedded_spawn_clx_size };
-	if (srcName == "diabdat")
-		return { embedded_diabdat_clx_data, embedded_diabdat_clx_size };
-	if (srcName == "hellfire")
-		return { embedded_hellfire_clx_data, embedded_hellfire_clx_size };
-	if (srcName == "hfmonk")
-		return { embedded_hfmonk_clx_data, embedded_hfmonk_clx_size };
-	return {};
+	std::string error;
+	std::unique_ptr<MpqReader> reader = MpqReader::open(path, error);
+	if (reader == nullptr) {
+		std::cerr << "Failed to open MPQ at " << path << ": " << error << std::endl;
+		std::exit(1);
+	}
+	return reader;
 }
 
-struct Cl2ToClxCommand {
-	std::vector<uint16_t> widths;
-	std::vector<std::string> combine;
-};
-struct CelToClxCommand {
-	std::vector<uint16_t> widths;
-};
-struct PcxToClxCommand {
-	size_t numFrames = 1;
-	std::optional<uint8_t> transparentColor;
-	bool exportPalette = false;
+// A single unit of work: either a single MPQ entry or a whole combine group.
+struct WorkItem {
+	const char *mpqPath;
+	const ClxCombineGroup *group = nullptr;
+
+	// Single entries only: the block of the entry, or `MpqReader::NoBlock` if it is missing,
+	// and its decryption key.
+	uint32_t blockIndex = MpqReader::NoBlock;
+	uint32_t fileKey = 0;
+
+	// Where the item's data starts in the archive (the lowest offset of its members for a group).
+	// Missing entries come last.
+	uint32_t archiveOffset = std::numeric_limits<uint32_t>::max();
+
+	// The number of MPQ entries covered by this item.
+	[[nodiscard]] size_t size() const
+	{
+		return group != nullptr ? group->files.size() : 1;
+	}
+
+	// The lowercased paths of all the files this item writes, relative to the output directory, see `PlanOutputKeys`.
+	// Used to detect items, from the same MPQ or from different ones, that write to the same file.
+	std::vector<std::string> outputKeys {};
+
+	// The path of the main output, which identifies the item in the manifest.
+	[[nodiscard]] const std::string &outputKey() const
+	{
+		return outputKeys.front();
+	}
 };
 
-using ClxCommand = std::variant<Cl2ToClxCommand, CelToClxCommand, PcxToClxCommand>;
+// All the state needed to process a single MPQ.
+struct ArchiveJob : MpqSource {
+	ArchiveJob(const std::filesystem::path &mpq, const std::filesystem::path &outputRoot, ProgressView &progress);
+
+	std::filesystem::path outputDirectory;
+	AudioCodec audioCodec = AudioCodec::Copy;
+	bool verifyDecompression = false;
+
+	// Shared by all the workers.
+	std::unique_ptr<MpqReader> reader;
+
+	std::vector<WorkItem> items;
+	size_t numFiles = 0;
+	std::atomic<size_t> numProcessed = 0;
+	std::atomic<size_t> numItemsRemaining = 0;
+
+	// The MPQ whose outputs are shared with this one, see `PlanLinkedOutputs`.
+	const ArchiveJob *linkSource = nullptr;
+
+	// The output keys (see `WorkItem::outputKey`) and input hashes of the items
+	// whose outputs are hard-linked to those of `linkSource` instead of being converted.
+	std::vector<std::pair<std::string, uint64_t>> linkedItems;
 
-struct ClxCommandAndFiles {
-	ClxCommand command;
-	std::vector<std::string> files;
-	bool combine = false;
+	// Set if the outputs are written into an MPQ. Shared by all the jobs with the same `destName`.
+	MpqWriter *mpqWriter = nullptr;
+
+	ProgressView &progress;
+	size_t progressRow;
 };
 
-template <typename IntT>
-IntT ParseInt(
-    std::string_view str, IntT min = std::numeric_limits<IntT>::min(),
-    IntT max = std::numeric_limits<IntT>::max())
+// The paths of the files that the conversion of the item writes, as `WorkItem::outputKeys`.
+std::vector<std::string> PlanOutputKeys(const WorkItem &item, const MpqSource &source)
 {
-	IntT result;
-	auto [ptr, ec] { std::from_chars(str.begin(), str.end(), result) };
-	if (ec == std::errc::result_out_of_range || result < min || result > max) {
-		std::cerr << "expected a number between " << min << " and " << max << ", got " << str << std::endl;
-		std::exit(1);
+	std::vector<std::filesystem::path> paths;
+	if (item.group != nullptr) {
+		paths = devilution_mpq_tools::GroupOutputPaths(*item.group);
+	} else {
+		std::string path = item.mpqPath;
+		std::replace(path.begin(), path.end(), '\\', '/');
+		const ClxCommandEntry *clxEntry = source.clxCommands.find(item.mpqPath);
+		paths = devilution_mpq_tools::EntryOutputPaths(path, clxEntry != nullptr ? clxEntry->command : nullptr);
 	}
-	if (ec != std::errc()) {
-		std::cerr << "expected a number, got " << str << std::endl;
-		std::exit(1);
+	std::vector<std::string> result;
+	result.reserve(paths.size());
+	for (const std::filesystem::path &path : paths) {
+		std::string &key = result.emplace_back(path.generic_string());
+		std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+			return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		});
 	}
 	return result;
 }
 
-template <typename IntT>
-std::vector<IntT> ParseIntList(
-    std::string_view str, IntT min = std::numeric_limits<IntT>::min(),
-    IntT max = std::numeric_limits<IntT>::max())
+ArchiveJob::ArchiveJob(const std::filesystem::path &mpq, const std::filesystem::path &outputRoot, ProgressView &progress)
+    : MpqSource(mpq)
+    , progress(progress)
 {
-	std::vector<IntT> result;
-	std::string_view remaining = str;
-	std::string_view::size_type commaPos;
-	while (true) {
-		commaPos = remaining.find(',');
-		const std::string_view part = remaining.substr(0, commaPos);
-		result.push_back(ParseInt(part, min, max));
-		if (commaPos == std::string_view::npos)
-			break;
-		remaining.remove_prefix(commaPos + 1);
+	outputDirectory = outputRoot / destName;
+	reader = OpenMpqReader(mpq);
+	{
+		MpqArchive archive { mpq, *reader };
+		CheckRead("(listfile)", loadListfile(archive));
 	}
-	return result;
-}
 
-ClxCommandAndFiles
-ParseCl2ToClxCommand(std::string_view line)
-{
-	Cl2ToClxCommand command;
-	std::vector<std::string> files;
-	bool combine = false;
-	while (!line.empty()) {
-		const std::string_view arg = line.substr(0, line.find(' '));
-		line.remove_prefix(std::min(arg.size() + 1, line.size()));
-		if (arg.empty())
+	// Resolve all the entries in one pass over the hashes.
+	std::vector<uint32_t> blockIndices(mpqFiles.size());
+	reader->findBlocks(mpqFiles.hashes, blockIndices);
+
+	// Plan the work up front. A combine group becomes a single item.
+	// Duplicate listfile entries are dropped, so that no two items write the same output.
+	items.reserve(mpqFiles.size());
+	std::unordered_set<std::string_view> seen;
+	std::vector<bool> scheduledGroups(clxCommands.groups.size());
+	for (size_t fileIndex = 0; fileIndex < mpqFiles.size(); ++fileIndex) {
+		const char *const mpqPath = mpqFiles.path(fileIndex);
+		if (!seen.insert(mpqPath).second)
 			continue;
-		if (arg == "--width") {
-			const std::string_view widths = line.substr(0, line.find(' '));
-			line.remove_prefix(std::min(widths.size() + 1, line.size()));
-			command.widths = ParseIntList<uint16_t>(widths);
-		} else if (arg == "--combine") {
-			combine = true;
-		} else if (arg[0] == '-') {
-			std::cerr << "Unknown argument: " << arg << std::endl;
-			std::exit(1);
-		} else {
-			files.emplace_back(arg);
+		++numFiles;
+		const ClxCommandEntry *clxEntry = clxCommands.find(mpqPath);
+		if (clxEntry != nullptr && clxEntry->group != nullptr) {
+			const size_t groupIndex = clxEntry->group - clxCommands.groups.data();
+			if (scheduledGroups[groupIndex])
+				continue;
+			scheduledGroups[groupIndex] = true;
+			items.push_back(WorkItem { mpqPath, clxEntry->group });
+			continue;
+		}
+		if (isExcluded(mpqPath)) {
+			++numProcessed;
+			continue;
+		}
+		items.push_back(WorkItem { mpqPath, nullptr, blockIndices[fileIndex], mpqFiles.hashes[fileIndex].fileKey });
+	}
+
+	// Process the entries in the order they are stored in, so that the archive
+	// is read from start to end instead of seeking back and forth across it.
+	for (WorkItem &item : items) {
+		if (item.group != nullptr) {
+			for (const std::string_view member : item.group->files) {
+				const std::optional<uint32_t> blockIndex = reader->findBlock(member);
+				if (blockIndex.has_value())
+					item.archiveOffset = std::min(item.archiveOffset, reader->block(*blockIndex).offset);
+			}
+		} else if (item.blockIndex != MpqReader::NoBlock) {
+			item.archiveOffset = reader->block(item.blockIndex).offset;
 		}
 	}
-	return ClxCommandAndFiles { std::move(command), std::move(files), combine };
+	std::stable_sort(items.begin(), items.end(), [](const WorkItem &a, const WorkItem &b) {
+		return a.archiveOffset < b.archiveOffset;
+	});
+	for (WorkItem &item : items)
+		item.outputKeys = PlanOutputKeys(item, *this);
+	progressRow = progress.addRow(mpq.filename().string(), numFiles);
 }
 
-ClxCommandAndFiles
-ParseCelToClxCommand(std::string_view line)
+// Several MPQs can share an output directory (e.g. hellfire and hfmonk), and several entries of an MPQ
+// can convert to the same file (e.g. "foo.cel" and "foo.cl2" both to "foo.clx").
+// A file written by more than one item is only written by the item from the MPQ with the highest
+// `MpqSource::overlayPriority`, or, with equal priorities, by the one that comes last,
+// so that every output is written once and the result does not depend on the order in which the items finish.
+// An item that loses any of its outputs is dropped entirely.
+void ResolveOverlappingOutputs(std::span<const std::unique_ptr<ArchiveJob>> jobs)
 {
-	CelToClxCommand command;
-	std::vector<std::string> files;
-	while (!line.empty()) {
-		const std::string_view arg = line.substr(0, line.find(' '));
-		line.remove_prefix(std::min(arg.size() + 1, line.size()));
-		if (arg.empty())
-			continue;
-		if (arg == "--width") {
-			const std::string_view widths = line.substr(0, line.find(' '));
-			line.remove_prefix(std::min(widths.size() + 1, line.size()));
-			command.widths = ParseIntList<uint16_t>(widths);
-		} else if (arg[0] == '-') {
-			std::cerr << "Unknown argument: " << arg << std::endl;
-			std::exit(1);
-		} else {
-			files.emplace_back(arg);
+	// (job index, item index)
+	using ItemId = std::pair<size_t, size_t>;
+	const auto takesPrecedence = [&jobs](const ItemId &a, const ItemId &b) {
+		const int priorityA = jobs[a.first]->overlayPriority();
+		const int priorityB = jobs[b.first]->overlayPriority();
+		if (priorityA != priorityB)
+			return priorityA > priorityB;
+		return a > b;
+	};
+	// Dropping an item can leave an output it lost to without a writer if that item itself lost another output,
+	// so repeat until every remaining item writes all of its outputs.
+	bool dropped = true;
+	while (dropped) {
+		dropped = false;
+		std::unordered_map<std::string, ItemId> owners;
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			const std::vector<WorkItem> &items = jobs[i]->items;
+			for (size_t j = 0; j < items.size(); ++j) {
+				for (const std::string &outputKey : items[j].outputKeys) {
+					const auto [it, inserted] = owners.try_emplace(jobs[i]->destName + "/" + outputKey, i, j);
+					if (!inserted && takesPrecedence({ i, j }, it->second))
+						it->second = { i, j };
+				}
+			}
+		}
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			ArchiveJob &job = *jobs[i];
+			std::vector<WorkItem> items;
+			items.reserve(job.items.size());
+			for (size_t j = 0; j < job.items.size(); ++j) {
+				WorkItem &item = job.items[j];
+				const bool ownsAll = std::all_of(item.outputKeys.begin(), item.outputKeys.end(), [&](const std::string &outputKey) {
+					return owners[job.destName + "/" + outputKey] == ItemId { i, j };
+				});
+				if (ownsAll) {
+					items.push_back(std::move(item));
+				} else {
+					job.numProcessed += item.size();
+					dropped = true;
+				}
+			}
+			job.items = std::move(items);
+			job.numItemsRemaining = job.items.size();
 		}
 	}
-	return ClxCommandAndFiles { std::move(command), std::move(files), /*.combine=*/false };
 }
 
-ClxCommandAndFiles
-ParsePcxToClxCommand(std::string_view line)
+struct WorkerState {
+	unsigned index;
+	// Archive handles, indexed by job, opened on first use.
+	std::vector<std::unique_ptr<MpqArchive>> archives;
+	std::vector<uint8_t> fileBuf;
+	std::vector<uint8_t> clxData;
+	OutputSink output;
+	EntryStats stats;
+};
+
+void WriteCombinedClx(const ClxCombineGroup &group, ClxSheetBuilder &sheet,
+    const std::filesystem::path &outputDirectory, OutputSink &output)
 {
-	PcxToClxCommand command;
-	std::vector<std::string> files;
-	while (!line.empty()) {
-		const std::string_view arg = line.substr(0, line.find(' '));
-		line.remove_prefix(std::min(arg.size() + 1, line.size()));
-		if (arg.empty())
-			continue;
-		if (arg == "--num-sprites") {
-			const std::string_view numStr = line.substr(0, line.find(' '));
-			line.remove_prefix(std::min(numStr.size() + 1, line.size()));
-			command.numFrames = ParseInt<size_t>(numStr);
-		} else if (arg == "--transparent-color") {
-			const std::string_view colorStr = line.substr(0, line.find(' '));
-			line.remove_prefix(std::min(colorStr.size() + 1, line.size()));
-			command.transparentColor = ParseInt<uint8_t>(colorStr);
-		} else if (arg == "--export-palette") {
-			command.exportPalette = true;
-		} else if (arg[0] == '-') {
-			std::cerr << "Unknown argument: " << arg << std::endl;
-			std::exit(1);
-		} else {
-			files.emplace_back(arg);
+	output.dedupSavedSize += sheet.bytesSaved();
+	if (output.stats != nullptr)
+		output.stats->dedupSavedSize = sheet.bytesSaved();
+	const std::vector<uint8_t> sheetData = sheet.finish();
+	WriteOutput(output, outputDirectory / CombinedClxPath(group), sheetData.data(), sheetData.size());
+}
+
+// Combines the files of the group into a single CLX sheet, with a list per file.
+// Identical members are stored once, see `ClxSheetBuilder`.
+//
+// Each member is converted with its own command into a CLX list as soon as it has been read,
+// and appended to the sheet, so that only a single member is held in memory at a time alongside the output.
+void ProcessCombineGroup(const ClxCombineGroup &group, MpqArchive &archive,
+    const std::filesystem::path &outputDirectory, OutputSink &output)
+{
+	EntryStats *stats = output.stats;
+
+	struct FileInfo {
+		std::string mpqPath;
+		uint32_t blockIndex;
+		size_t size;
+	};
+	std::vector<FileInfo> fileInfos;
+	fileInfos.reserve(group.files.size());
+	{
+		const StageTimer timer { stats, Stage::Lookup };
+		for (const std::string_view file : group.files) {
+			std::string mpqPath { file };
+			std::replace(mpqPath.begin(), mpqPath.end(), '/', '\\');
+			uint32_t blockIndex;
+			CheckRead(mpqPath, archive.findFile(mpqPath.c_str(), blockIndex));
+			fileInfos.push_back({ std::move(mpqPath), blockIndex, archive.fileSize(blockIndex) });
+		}
+	}
+
+	ClxSheetBuilder sheet { fileInfos.size() };
+	std::vector<uint8_t> data;
+	std::vector<uint8_t> converted;
+	for (size_t i = 0; i < fileInfos.size(); ++i) {
+		// The OS reads the next member from disk while this one is being converted.
+		if (i + 1 < fileInfos.size())
+			archive.reader().prefetchBlock(fileInfos[i + 1].blockIndex);
+
+		const FileInfo &info = fileInfos[i];
+		data.resize(info.size);
+		{
+			const StageTimer timer { stats, Stage::Read };
+			CheckRead(info.mpqPath, archive.readFile(info.blockIndex, info.mpqPath.c_str(), MpqFileKey(info.mpqPath), data.data()));
+		}
+		{
+			const StageTimer timer { stats, Stage::Combine };
+			ExitOnError(devilution_mpq_tools::ConvertCombineGroupMember(group, i, data, converted));
+		}
+		sheet.addList(converted);
+		if (stats != nullptr) {
+			stats->inputSize += data.size();
+			stats->noteBuffer(data.size() + converted.size() + sheet.size());
 		}
 	}
-	return ClxCommandAndFiles { std::move(command), std::move(files), /*.combine=*/false };
+
+	WriteCombinedClx(group, sheet, outputDirectory, output);
 }
 
-std::optional<ClxCommandAndFiles>
-ParseClxCommand(std::string_view line)
+// Deduplicates the frames of a dungeon tile CEL and rewrites the frame indices of its MIN.
+void ProcessDedupTilesGroup(const ClxCombineGroup &group, MpqArchive &archive,
+    const std::filesystem::path &outputDirectory, OutputSink &output)
 {
-	const std::string_view arg = line.substr(0, line.find(' '));
-	line.remove_prefix(std::min(arg.size() + 1, line.size()));
-	if (arg.empty() || arg[0] == '#')
-		return std::nullopt;
-	if (arg == "cl22clx")
-		return ParseCl2ToClxCommand(line);
-	if (arg == "cel2clx")
-		return ParseCelToClxCommand(line);
-	if (arg == "pcx2clx")
-		return ParsePcxToClxCommand(line);
-	std::cerr << "Unknown command: " << arg << std::endl;
-	std::exit(1);
+	EntryStats *stats = output.stats;
+	std::array<std::vector<uint8_t>, 2> inputs;
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		std::string mpqPath { group.files[i] };
+		std::replace(mpqPath.begin(), mpqPath.end(), '/', '\\');
+		uint32_t fileNumber;
+		{
+			const StageTimer timer { stats, Stage::Lookup };
+			CheckRead(mpqPath, archive.findFile(mpqPath.c_str(), fileNumber));
+		}
+		inputs[i].resize(archive.fileSize(fileNumber));
+		const StageTimer timer { stats, Stage::Read };
+		CheckRead(mpqPath, archive.readFile(fileNumber, mpqPath.c_str(), MpqFileKey(mpqPath), inputs[i].data()));
+	}
+	ExitOnError(devilution_mpq_tools::ConvertDedupTilesGroup(group, inputs[0], inputs[1], stats, SinkOutput(output, outputDirectory)));
 }
 
-struct string_hash {
-	using is_transparent = void;
-	[[nodiscard]] size_t operator()(const char *txt) const
-	{
-		return std::hash<std::string_view> {}(txt);
+// Converts (or extracts) a single entry that has been read into `data`.
+void ConvertEntry(const WorkItem &item, ArchiveJob &job, std::span<const uint8_t> data,
+    OutputSink &output, std::vector<uint8_t> &clxData)
+{
+	const char *mpqPath = item.mpqPath;
+	std::string mpqPathWithForwardSlash { mpqPath };
+	std::replace(mpqPathWithForwardSlash.begin(), mpqPathWithForwardSlash.end(), '\\', '/');
+	const size_t i = ++job.numProcessed;
+
+	const ClxCommandEntry *clxEntry = job.clxCommands.find(mpqPath);
+	const ClxCommand *command = clxEntry != nullptr ? clxEntry->command : nullptr;
+	switch (devilution_mpq_tools::GetEntryConversion(mpqPathWithForwardSlash, command, job.audioCodec)) {
+	case EntryConversion::Clx:
+		job.progress.update(job.progressRow, i, std::string("Converting ") + mpqPath + " to CLX");
+		break;
+	case EntryConversion::Audio:
+		job.progress.update(job.progressRow, i, std::string("Encoding ") + mpqPath);
+		break;
+	case EntryConversion::Extract:
+		job.progress.update(job.progressRow, i, std::string("Extracting ") + mpqPath);
+		break;
 	}
-	[[nodiscard]] size_t operator()(std::string_view txt) const
-	{
-		return std::hash<std::string_view> {}(txt);
+	ExitOnError(devilution_mpq_tools::ConvertEntry(mpqPathWithForwardSlash, command, job.audioCodec, data, clxData,
+	    output.stats, SinkOutput(output, job.outputDirectory)));
+}
+
+void ProcessEntry(const WorkItem &item, ArchiveJob &job, MpqArchive &archive, WorkerState &worker)
+{
+	const char *mpqPath = item.mpqPath;
+	std::vector<uint8_t> &fileBuf = worker.fileBuf;
+	EntryStats *stats = worker.output.stats;
+	// The entry has already been looked up when planning the job.
+	const uint32_t mpqFileNumber = item.blockIndex;
+	if (mpqFileNumber == MpqReader::NoBlock) {
+		if (job.isSaveFile) {
+			job.progress.update(job.progressRow, ++job.numProcessed, std::string("Missing ") + mpqPath);
+			return;
+		}
+		std::cerr << "Failed to read MPQ file " << mpqPath << ": "
+		          << libmpq__strerror(LIBMPQ_ERROR_EXIST) << std::endl;
+		std::exit(1);
 	}
-	[[nodiscard]] size_t operator()(const std::string &txt) const
+	const size_t mpqFileSize = archive.fileSize(mpqFileNumber);
+	if (fileBuf.size() < mpqFileSize)
+		fileBuf.resize(mpqFileSize);
 	{
-		return std::hash<std::string> {}(txt);
+		const StageTimer timer { stats, Stage::Read };
+		CheckRead(mpqPath, archive.readFile(mpqFileNumber, mpqPath, item.fileKey, fileBuf.data()));
 	}
-};
-template <typename T>
-using HeterogenousUnorderedStringMap = std::unordered_map<std::string, T, string_hash, std::equal_to<>>;
+	ConvertEntry(item, job, { fileBuf.data(), mpqFileSize }, worker.output, worker.clxData);
+}
 
-struct ClxCombineAggregator {
-	ClxCommand command;
-	std::vector<std::string> files;
-	bool processed = false;
-};
+// Hashes everything the outputs of `item` are derived from: the converter version,
+// the conversion command, and the stored (still compressed) data of each MPQ entry.
+uint64_t ComputeInputHash(const WorkItem &item, const ArchiveJob &job)
+{
+	uint64_t hash = HashString(ConverterVersion);
+	std::span<const std::string_view> members;
+	if (item.group != nullptr) {
+		hash = HashString(item.group->outputName, hash);
+		for (const ClxCommand *command : item.group->commands)
+			hash = HashString(command->description, hash);
+		members = item.group->files;
+	} else {
+		const ClxCommandEntry *clxEntry = job.clxCommands.find(item.mpqPath);
+		if (clxEntry != nullptr) {
+			hash = HashString(clxEntry->command->description, hash);
+		} else if (job.audioCodec != AudioCodec::Copy && IsWavFile(item.mpqPath)) {
+			hash = HashString(devilution_mpq_tools::AudioCodecName(job.audioCodec), hash);
+		} else {
+			hash = HashString("extract", hash);
+		}
+	}
+	const auto hashMember = [&](std::string_view mpqPath, std::optional<uint32_t> blockIndex) {
+		hash = HashString(mpqPath, hash);
+		if (!blockIndex.has_value()) {
+			hash = HashString("missing", hash);
+			return;
+		}
+		const devilution_mpq_tools::MpqBlockEntry &block = job.reader->block(*blockIndex);
+		const uint32_t fields[] = { block.packedSize, block.unpackedSize, block.flags };
+		hash = HashBytes({ reinterpret_cast<const uint8_t *>(fields), sizeof(fields) }, hash);
+		hash = HashBytes(job.reader->rawBlockData(*blockIndex), hash);
+	};
+	if (members.empty()) {
+		hashMember(item.mpqPath, item.blockIndex != MpqReader::NoBlock ? std::optional<uint32_t>(item.blockIndex) : std::nullopt);
+	} else {
+		for (const std::string_view member : members)
+			hashMember(member, job.reader->findBlock(member));
+	}
+	return hash;
+}
 
-struct ClxCommands {
-	std::list<ClxCombineAggregator> combine_aggregators;
-	HeterogenousUnorderedStringMap<std::variant<ClxCommand, ClxCombineAggregator *>> per_file;
+// MPQs with mostly the same files, in different output directories, by source name:
+// the shareware files are a subset of the full game's.
+constexpr std::pair<std::string_view, std::string_view> LinkedMpqs[] = {
+	{ "spawn", "diabdat" },
 };
 
-std::string DefaultCombinedClxFilename(std::string_view firstPath)
+// The items of an MPQ with the same output path, conversion command and stored data as an item of its
+// `LinkedMpqs` counterpart are not converted, and their outputs are hard-linked after the run instead.
+// Only for loose files: the manifest has the outputs of every item to link to.
+void PlanLinkedOutputs(std::span<const std::unique_ptr<ArchiveJob>> jobs)
 {
-	std::string outputFilename = std::filesystem::path(firstPath).stem().string();
-	size_t numSuffixLength = 0;
-	while (numSuffixLength < outputFilename.size()) {
-		const char c = outputFilename[outputFilename.size() - numSuffixLength - 1];
-		if (c < '0' || c > '9')
-			break;
-		++numSuffixLength;
+	for (const std::unique_ptr<ArchiveJob> &job : jobs) {
+		for (const auto &[srcName, sourceName] : LinkedMpqs) {
+			if (job->srcName != srcName)
+				continue;
+			for (const std::unique_ptr<ArchiveJob> &other : jobs) {
+				if (other->srcName == sourceName)
+					job->linkSource = other.get();
+			}
+		}
+		if (job->linkSource == nullptr)
+			continue;
+		const ArchiveJob &source = *job->linkSource;
+		std::unordered_map<std::string, const WorkItem *> sourceItems;
+		for (const WorkItem &item : source.items)
+			sourceItems.emplace(item.outputKey(), &item);
+		std::erase_if(job->items, [&](const WorkItem &item) {
+			std::string key = item.outputKey();
+			const auto it = sourceItems.find(key);
+			if (it == sourceItems.end())
+				return false;
+			const uint64_t inputHash = ComputeInputHash(item, *job);
+			if (ComputeInputHash(*it->second, source) != inputHash)
+				return false;
+			job->linkedItems.emplace_back(std::move(key), inputHash);
+			job->numProcessed += item.size();
+			return true;
+		});
+		job->numItemsRemaining = job->items.size();
 	}
-	outputFilename.resize(outputFilename.size() - numSuffixLength);
-	outputFilename.append(".clx");
-	return outputFilename;
 }
 
-ClxCommands
-ParseClxCommands(std::span<const char *const> clxCommands)
+// Hard-links the outputs planned by `PlanLinkedOutputs`, once the outputs they link to are written.
+// Falls back to copying if the file system does not support hard links.
+void LinkOutputs(std::span<const std::unique_ptr<ArchiveJob>> jobs, const std::filesystem::path &outputRoot, Manifest &manifest)
 {
-	ClxCommands result;
-	for (const std::string_view str : clxCommands) {
-		std::optional<ClxCommandAndFiles> parsed = ParseClxCommand(str);
-		if (!parsed.has_value())
-			continue;
-		std::variant<ClxCommand, ClxCombineAggregator *> value;
-		if (parsed->combine) {
-			ClxCombineAggregator &aggregator = result.combine_aggregators.emplace_back();
-			aggregator.command = std::move(parsed->command);
-			aggregator.files = parsed->files;
-			value = &aggregator;
-		} else {
-			value = parsed->command;
-		}
-		for (std::string &file : parsed->files) {
-			if (!result.per_file.emplace(std::move(file), value).second) {
-				std::cerr << "More than 1 CLX conversion command for " << file << std::endl;
+	for (const std::unique_ptr<ArchiveJob> &job : jobs) {
+		for (const auto &[outputKey, inputHash] : job->linkedItems) {
+			const std::string manifestKey = job->destName + "/" + outputKey;
+			if (manifest.isUpToDate(manifestKey, inputHash))
+				continue;
+			const std::string &sourceDestName = job->linkSource->destName;
+			const std::optional<std::vector<ManifestOutput>> sourceOutputs = manifest.outputs(sourceDestName + "/" + outputKey);
+			if (!sourceOutputs.has_value()) {
+				std::cerr << "Internal error: no outputs recorded for " << sourceDestName << "/" << outputKey << std::endl;
 				std::exit(1);
 			}
+			std::vector<ManifestOutput> outputs;
+			outputs.reserve(sourceOutputs->size());
+			for (const ManifestOutput &sourceOutput : *sourceOutputs) {
+				const std::filesystem::path relativePath = std::filesystem::path(sourceOutput.path).lexically_relative(sourceDestName);
+				const std::filesystem::path linkPath = job->outputDirectory / relativePath;
+				std::error_code ec;
+				std::filesystem::create_directories(linkPath.parent_path(), ec);
+				std::filesystem::remove(linkPath, ec);
+				std::filesystem::create_hard_link(outputRoot / sourceOutput.path, linkPath, ec);
+				if (ec)
+					std::filesystem::copy_file(outputRoot / sourceOutput.path, linkPath, ec);
+				if (ec) {
+					std::cerr << "Failed to link " << linkPath << " to " << sourceOutput.path << ": " << ec.message() << std::endl;
+					std::exit(1);
+				}
+				outputs.push_back(ManifestOutput {
+				    (std::filesystem::path(job->destName) / relativePath).generic_string(), sourceOutput.size });
+			}
+			manifest.record(manifestKey, inputHash, std::move(outputs));
 		}
 	}
-	return result;
 }
 
-void WriteOutput(const std::filesystem::path &outputPath, const uint8_t *data, size_t size)
+// How many items ahead of the one being processed to prefetch.
+// Larger than the number of items in flight, so that the prefetches are ahead of all the workers.
+constexpr size_t PrefetchDistance = 32;
+
+void PrefetchItem(const WorkItem &item, const ArchiveJob &job)
 {
-	std::filesystem::create_directories(outputPath.parent_path());
-	std::ofstream out { outputPath.c_str(), std::ios::binary };
-	if (out.fail()) {
-		std::cerr << "Failed to open " << outputPath << " for writing: " << std::strerror(errno) << std::endl;
-	}
-	out.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
-	if (out.fail()) {
-		std::cerr << "Failed to write " << outputPath << ": " << std::strerror(errno) << std::endl;
-	}
-	out.close();
-	if (out.fail()) {
-		std::cerr << "Failed to close " << outputPath << ": " << std::strerror(errno) << std::endl;
+	if (item.group != nullptr) {
+		for (const std::string_view member : item.group->files) {
+			const std::optional<uint32_t> blockIndex = job.reader->findBlock(member);
+			if (blockIndex.has_value())
+				job.reader->prefetchBlock(*blockIndex);
+		}
+	} else if (item.blockIndex != MpqReader::NoBlock) {
+		job.reader->prefetchBlock(item.blockIndex);
 	}
+}
+
+// Everything the work items are processed with, shared by all the workers.
+struct RunContext {
+	// Null if every item must be processed.
+	Manifest *manifest;
+	// Only set for a shard, whose own manifest is `manifest`: the items that the merged manifest
+	// has as up to date are not converted again.
+	Manifest *mergedManifest;
+	// Null if stats are disabled.
+	StatsCollector *stats;
+	OutputWriter &fileWriter;
+	ThreadPool &pool;
+	std::span<WorkerState> workers;
 };
 
-class MpqArchive {
-public:
-	explicit MpqArchive(const std::filesystem::path &path)
-	{
-		const int32_t error = libmpq__archive_open(&archive_, path.string().c_str(), 0);
-		if (error != 0) {
-			std::cerr << "Failed to open MPQ at " << path << ": "
-			          << libmpq__strerror(error) << std::endl;
-			std::exit(1);
-		}
+MpqArchive &GetArchive(WorkerState &worker, size_t jobIndex, const ArchiveJob &job)
+{
+	std::unique_ptr<MpqArchive> &archive = worker.archives[jobIndex];
+	if (archive == nullptr)
+		archive = std::make_unique<MpqArchive>(job.mpq, *job.reader, job.verifyDecompression);
+	return *archive;
+}
+
+// Points the worker's output at the job, and starts the stats for `path` if enabled.
+void StartOutput(ArchiveJob &job, std::string_view path, const RunContext &run, WorkerState &worker)
+{
+	worker.output.outputDirectory = &job.outputDirectory;
+	worker.output.mpqWriter = job.mpqWriter;
+	worker.output.fileWriter = &run.fileWriter;
+	worker.output.written.clear();
+	worker.output.stats = nullptr;
+	if (run.stats != nullptr) {
+		worker.stats = EntryStats {};
+		worker.stats.archive = job.mpq.filename().string();
+		worker.stats.path = path;
+		worker.stats.worker = worker.index;
+		worker.output.stats = &worker.stats;
 	}
+}
 
-	uint32_t getFileNumber(const char *mpqPath, bool optional = false)
-	{
-		uint32_t mpqFileNumber;
-		int32_t error = libmpq__file_number(archive_, mpqPath, &mpqFileNumber);
-		if (error == LIBMPQ_ERROR_EXIST && optional)
-			return static_cast<uint32_t>(-1);
-		if (error != 0) {
-			std::cerr << "Failed to read MPQ file " << mpqPath << ": "
-			          << libmpq__strerror(error) << std::endl;
-			std::exit(1);
+void MarkItemDone(ArchiveJob &job)
+{
+	if (--job.numItemsRemaining == 0)
+		job.progress.finish(job.progressRow, "Done");
+}
+
+// Records the outputs of a processed item in the manifest, and its stats.
+void FinishWorkItem(ArchiveJob &job, const std::string &manifestKey, uint64_t inputHash,
+    const RunContext &run, WorkerState &worker)
+{
+	if (run.manifest != nullptr) {
+		std::vector<ManifestOutput> outputs;
+		std::vector<std::filesystem::path> paths;
+		outputs.reserve(worker.output.written.size());
+		paths.reserve(worker.output.written.size());
+		for (const WrittenFile &file : worker.output.written) {
+			outputs.push_back(ManifestOutput {
+			    (std::filesystem::path(job.destName) / file.path.lexically_relative(job.outputDirectory)).generic_string(),
+			    file.size });
+			paths.push_back(file.path);
 		}
-		return mpqFileNumber;
+		// Only record the item once its outputs are on disk, so that the next run converts it again if they are not.
+		run.fileWriter.then(std::move(paths), [manifest = run.manifest, manifestKey, inputHash, outputs = std::move(outputs)](bool written) mutable {
+			if (written)
+				manifest->record(manifestKey, inputHash, std::move(outputs));
+		});
 	}
+	if (run.stats != nullptr)
+		run.stats->record(std::move(worker.stats));
+	MarkItemDone(job);
+}
 
-	size_t getFileSize(uint32_t mpqFileNumber, const char *mpqPath = "")
-	{
-		int32_t error;
-		libmpq__off_t mpqFileSize;
-		if ((error = libmpq__file_size_unpacked(archive_, mpqFileNumber, &mpqFileSize)) != 0) {
-			std::cerr << "Failed to read MPQ file " << mpqPath << ": "
-			          << libmpq__strerror(error) << std::endl;
-			std::exit(1);
+// Entries and combine groups with at least this many unpacked bytes are split into parts
+// that run on several workers at once, see `SplitWorkItem`.
+constexpr size_t SplitMinSize = 1024 * 1024;
+
+// Roughly how many unpacked bytes of a single entry each part reads.
+constexpr size_t SplitPartSize = 256 * 1024;
+
+// The number of parts to split the item into, 1 if it is not split.
+size_t NumSplitParts(const WorkItem &item, const ArchiveJob &job, unsigned numWorkers)
+{
+	if (numWorkers == 1)
+		return 1;
+	if (item.group != nullptr) {
+		// The files of a dedup-tiles group depend on each other.
+		if (item.group->command->kind == ClxCommandKind::DedupTiles)
+			return 1;
+		size_t size = 0;
+		for (const std::string_view member : item.group->files) {
+			const std::optional<uint32_t> blockIndex = job.reader->findBlock(member);
+			if (!blockIndex.has_value())
+				return 1;
+			size += job.reader->block(*blockIndex).unpackedSize;
 		}
-		return mpqFileSize;
+		return size >= SplitMinSize ? item.group->files.size() : 1;
 	}
+	if (item.blockIndex == MpqReader::NoBlock || !job.reader->isSupported(item.blockIndex, /*decrypt=*/true))
+		return 1;
+	const size_t size = job.reader->block(item.blockIndex).unpackedSize;
+	if (size < SplitMinSize)
+		return 1;
+	return std::min<size_t>({ (size + SplitPartSize - 1) / SplitPartSize, job.reader->numSectors(item.blockIndex), numWorkers });
+}
 
-	size_t readFile(uint32_t mpqFileNumber, size_t mpqFileSize, const char *mpqPath, uint8_t *buf, bool decrypt)
-	{
-		if (tmp_buf_.size() < mpqFileSize) {
-			tmp_buf_.resize(static_cast<size_t>(mpqFileSize));
-		}
-		int32_t error;
-		if (decrypt) {
-			error = libmpq__file_read_with_filename_and_temporary_buffer(
-			    archive_, mpqFileNumber, mpqPath, buf, mpqFileSize,
-			    tmp_buf_.data(), mpqFileSize, /*transferred=*/nullptr);
-		} else {
-			error = libmpq__file_read_with_temporary_buffer(
-			    archive_, mpqFileNumber, buf, mpqFileSize,
-			    tmp_buf_.data(), mpqFileSize, /*transferred=*/nullptr);
+// The state shared by the parts of a split item.
+struct SplitItem {
+	const WorkItem *item;
+	size_t jobIndex;
+	size_t numParts;
+	std::string manifestKey;
+	uint64_t inputHash;
+
+	// Single entries: the file, each part reads a range of its sectors.
+	std::vector<uint8_t> fileBuf;
+
+	// Combine groups: the converted CLX list of each member, a member per part.
+	std::vector<std::vector<uint8_t>> lists;
+
+	std::atomic<size_t> numPartsRemaining;
+};
+
+void ProcessSplitPart(SplitItem &split, size_t part, ArchiveJob &job, const RunContext &run, WorkerState &worker)
+{
+	const WorkItem &item = *split.item;
+	StartOutput(job, std::string(item.mpqPath) + " (part " + std::to_string(part + 1) + " of " + std::to_string(split.numParts) + ")",
+	    run, worker);
+	EntryStats *stats = worker.output.stats;
+	MpqArchive &archive = GetArchive(worker, split.jobIndex, job);
+	if (item.group != nullptr) {
+		std::string mpqPath { item.group->files[part] };
+		std::replace(mpqPath.begin(), mpqPath.end(), '/', '\\');
+		{
+			const StageTimer timer { stats, Stage::Read };
+			CheckRead(mpqPath, archive.readFile(mpqPath.c_str(), worker.fileBuf));
 		}
-		if (error != 0) {
-			std::cerr << "Failed to read MPQ file " << mpqPath << ": "
-			          << libmpq__strerror(error) << " " << mpqPath << std::endl;
-			std::exit(1);
+		{
+			const StageTimer timer { stats, Stage::Combine };
+			ExitOnError(devilution_mpq_tools::ConvertCombineGroupMember(*item.group, part, worker.fileBuf, split.lists[part]));
 		}
-		return static_cast<size_t>(mpqFileSize);
+		if (stats != nullptr) {
+			stats->inputSize = worker.fileBuf.size();
+			stats->noteBuffer(worker.fileBuf.size() + split.lists[part].size());
+		}
+	} else {
+		const uint32_t numSectors = job.reader->numSectors(item.blockIndex);
+		const auto firstSector = static_cast<uint32_t>(numSectors * part / split.numParts);
+		const auto endSector = static_cast<uint32_t>(numSectors * (part + 1) / split.numParts);
+		const StageTimer timer { stats, Stage::Read };
+		CheckRead(item.mpqPath, archive.readSectors(item.blockIndex, item.fileKey, firstSector, endSector, split.fileBuf.data()));
 	}
+	if (run.stats != nullptr)
+		run.stats->record(std::move(worker.stats));
+}
 
-	size_t readFile(const char *mpqPath, std::vector<uint8_t> &buf, bool decrypt = true, bool optional = false)
-	{
-		const uint32_t mpqFileNumber = getFileNumber(mpqPath, optional);
-		if (optional && mpqFileNumber == static_cast<uint32_t>(-1))
-			return static_cast<size_t>(-1);
-		const size_t mpqFileSize = getFileSize(mpqFileNumber, mpqPath);
-		if (buf.size() < static_cast<size_t>(mpqFileSize)) {
-			buf.resize(static_cast<size_t>(mpqFileSize));
+// Runs on the worker that finishes the last part.
+void FinishSplitItem(SplitItem &split, ArchiveJob &job, const RunContext &run, WorkerState &worker)
+{
+	const WorkItem &item = *split.item;
+	StartOutput(job, item.mpqPath, run, worker);
+	if (item.group != nullptr) {
+		ClxSheetBuilder sheet { split.lists.size() };
+		{
+			const StageTimer timer { worker.output.stats, Stage::Combine };
+			for (const std::vector<uint8_t> &list : split.lists)
+				sheet.addList(list);
 		}
-		return readFile(mpqFileNumber, mpqFileSize, mpqPath, buf.data(), decrypt);
+		WriteCombinedClx(*item.group, sheet, job.outputDirectory, worker.output);
+	} else {
+		ConvertEntry(item, job, split.fileBuf, worker.output, worker.clxData);
 	}
+	FinishWorkItem(job, split.manifestKey, split.inputHash, run, worker);
+}
 
-	~MpqArchive()
-	{
-		const int32_t error = libmpq__archive_close(archive_);
-		if (error != 0) {
-			std::cerr << "Failed to close MPQ: " << libmpq__strerror(error) << std::endl;
-			std::exit(1);
-		}
+// Splits a large item into parts that are queued ahead of the other items, so that a run does not end
+// with a single worker busy with its largest items while the others are idle:
+//
+// * The members of a combine group are read and converted concurrently, and then stitched into the sheet in order.
+//   Unlike `ProcessCombineGroup`, this holds all the converted members in memory at once.
+// * The sectors of a single entry are read (decrypted and decompressed) concurrently, a range per part,
+//   and the entry is then converted as usual.
+//
+// The worker that finishes the last part completes the item.
+void SplitWorkItem(const WorkItem &item, size_t jobIndex, ArchiveJob &job, const std::string &manifestKey, uint64_t inputHash,
+    size_t numParts, const RunContext &run)
+{
+	auto split = std::make_shared<SplitItem>();
+	split->item = &item;
+	split->jobIndex = jobIndex;
+	split->numParts = numParts;
+	split->manifestKey = manifestKey;
+	split->inputHash = inputHash;
+	split->numPartsRemaining = numParts;
+	if (item.group != nullptr) {
+		split->lists.resize(numParts);
+		const size_t i = (job.numProcessed += item.group->files.size());
+		job.progress.update(job.progressRow, i, std::string("Combining ") + item.mpqPath + " (" + std::to_string(numParts) + " in parallel)");
+	} else {
+		split->fileBuf.resize(job.reader->block(item.blockIndex).unpackedSize);
+		job.progress.update(job.progressRow, job.numProcessed, std::string("Reading ") + item.mpqPath + " (" + std::to_string(numParts) + " parts)");
+	}
+	// Submitted last to first, so that they start in order.
+	for (size_t part = numParts; part-- > 0;) {
+		run.pool.submitFront([split, part, &job, &run](unsigned workerIndex) {
+			WorkerState &worker = run.workers[workerIndex];
+			ProcessSplitPart(*split, part, job, run, worker);
+			if (--split->numPartsRemaining == 0)
+				FinishSplitItem(*split, job, run, worker);
+		});
 	}
+}
+
+void ProcessWorkItem(const WorkItem &item, size_t jobIndex, ArchiveJob &job, const RunContext &run, WorkerState &worker)
+{
+	// The items are started in order, so every item gets prefetched once.
+	const size_t itemIndex = &item - job.items.data();
+	if (itemIndex + PrefetchDistance < job.items.size())
+		PrefetchItem(job.items[itemIndex + PrefetchDistance], job);
 
-private:
-	mpq_archive_s *archive_;
-	std::vector<uint8_t> tmp_buf_;
+	const std::string manifestKey = job.destName + "/" + item.outputKey();
+	const uint64_t inputHash = run.manifest != nullptr ? ComputeInputHash(item, job) : 0;
+	if (run.manifest != nullptr
+	    && (run.manifest->isUpToDate(manifestKey, inputHash)
+	        || (run.mergedManifest != nullptr && run.mergedManifest->isUpToDate(manifestKey, inputHash)))) {
+		const size_t i = (job.numProcessed += item.size());
+		job.progress.update(job.progressRow, i, std::string("Up to date: ") + item.mpqPath);
+		MarkItemDone(job);
+		return;
+	}
+	if (const size_t numParts = NumSplitParts(item, job, run.pool.numWorkers()); numParts > 1) {
+		SplitWorkItem(item, jobIndex, job, manifestKey, inputHash, numParts, run);
+		return;
+	}
+
+	StartOutput(job, item.mpqPath, run, worker);
+	MpqArchive &archive = GetArchive(worker, jobIndex, job);
+	if (item.group != nullptr && item.group->command->kind == ClxCommandKind::DedupTiles) {
+		const size_t i = (job.numProcessed += item.group->files.size());
+		job.progress.update(job.progressRow, i, std::string("Deduplicating the tiles of ") + item.mpqPath);
+		ProcessDedupTilesGroup(*item.group, archive, job.outputDirectory, worker.output);
+	} else if (item.group != nullptr) {
+		const ClxCombineGroup &group = *item.group;
+		const size_t i = (job.numProcessed += group.files.size());
+		job.progress.update(job.progressRow, i, std::string("Combining ") + item.mpqPath + " (" + std::to_string(group.files.size()) + ")");
+		ProcessCombineGroup(group, archive, job.outputDirectory, worker.output);
+	} else {
+		ProcessEntry(item, job, archive, worker);
+	}
+	FinishWorkItem(job, manifestKey, inputHash, run, worker);
+}
+
+// Bounds the memory used by the converted files that are waiting to be written.
+constexpr size_t MaxOutputBytesInFlight = 64 * 1024 * 1024;
+
+struct OutputOptions {
+	// Ignore the manifest and convert everything.
+	bool force = false;
+
+	// Write an MPQ per output directory instead of loose files.
+	bool mpq = false;
+
+	// Compress the files in the output MPQ.
+	bool compress = true;
+
+	// How the WAV files are converted.
+	AudioCodec audioCodec = AudioCodec::Copy;
+
+	// Check the decompression against libmpq's. Converts everything, so that every entry is read.
+	bool verifyDecompression = false;
+
+	// Only convert the items assigned to this shard, see `KeepShardItems`.
+	std::optional<Shard> shard;
 };
 
-void PrintStatus(std::string_view status, size_t i, size_t n)
+// The output MPQs are named `<OutputMpqPrefix><destName>.mpq`.
+// They are not inputs, even though the default output directory is also where the input MPQs are looked for.
+constexpr std::string_view OutputMpqPrefix = "devilutionx-";
+
+std::unique_ptr<MpqWriter> CreateMpqWriter(const std::filesystem::path &path, bool compress)
 {
-	std::clog << "\r                                                           \r"
-	          << "[" << i << "/" << n << "] " << status;
-	std::clog.flush();
+	std::string error;
+	std::unique_ptr<MpqWriter> writer = MpqWriter::create(path, compress, error);
+	if (writer == nullptr) {
+		std::cerr << "Failed to create MPQ at " << path << ": " << error << std::endl;
+		std::exit(1);
+	}
+	return writer;
 }
 
-void ProcessAggregator(ClxCombineAggregator &aggregator, MpqArchive &archive,
-    const std::filesystem::path &outputDirectory)
+// Opens the MPQs and plans their work items.
+std::vector<std::unique_ptr<ArchiveJob>> PlanJobs(std::span<const std::filesystem::path> mpqs,
+    const std::filesystem::path &outputRoot, const OutputOptions &options, ProgressView &progress)
 {
-	struct FileInfo {
-		std::string mpqPath;
-		uint32_t mpqFileNumber;
-		size_t size;
-	};
-	FileInfo fileInfos[aggregator.files.size()];
-	size_t totalFilesSize = 0;
-	for (size_t i = 0; i < aggregator.files.size(); ++i) {
-		std::string mpqPath { aggregator.files[i] };
-		std::replace(mpqPath.begin(), mpqPath.end(), '/', '\\');
-		const uint32_t fileNumber = archive.getFileNumber(mpqPath.c_str());
-		const size_t fileSize = archive.getFileSize(fileNumber, mpqPath.c_str());
-		fileInfos[i] = { std::move(mpqPath), fileNumber, fileSize };
-		totalFilesSize += fileSize;
-	}
-	const size_t headerSize = dvl_gfx::ClxSheetHeaderSize(aggregator.files.size());
-	std::unique_ptr<uint8_t[]> data { new uint8_t[headerSize + totalFilesSize] };
-	size_t accumulatedSize = headerSize;
-	for (size_t i = 0; i < aggregator.files.size(); ++i) {
-		dvl_gfx::ClxSheetHeaderSetListOffset(i, accumulatedSize, data.get());
-		archive.readFile(fileInfos[i].mpqFileNumber, fileInfos[i].size,
-		    fileInfos[i].mpqPath.c_str(), &data[accumulatedSize], /*decrypt=*/true);
-		accumulatedSize += fileInfos[i].size;
-	}
-	if (std::holds_alternative<Cl2ToClxCommand>(aggregator.command)) {
-		const Cl2ToClxCommand &command = std::get<Cl2ToClxCommand>(aggregator.command);
-		std::vector<uint8_t> converted;
-		const std::optional<dvl_gfx::IoError> clxError = dvl_gfx::Cl2ToClx(
-		    data.get(), accumulatedSize, command.widths.data(), command.widths.size(), converted);
-		if (clxError.has_value()) {
-			std::cerr << "Failed CL2->CLX combined conversion: " << clxError->message
-			          << " " << aggregator.files[0] << std::endl;
-			std::exit(1);
-		}
-		const std::string outputFilename = DefaultCombinedClxFilename(
-		    aggregator.files[0]);
-		WriteOutput(
-		    outputDirectory
-		        / std::filesystem::path(aggregator.files[0]).parent_path()
-		        / outputFilename,
-		    converted.data(), converted.size());
-	} else {
-		std::cerr << "Only CL2 files can be combined error" << std::endl;
-		std::exit(1);
+	std::vector<std::unique_ptr<ArchiveJob>> jobs;
+	jobs.reserve(mpqs.size());
+	for (const std::filesystem::path &mpq : mpqs) {
+		std::clog << "Processing " << mpq << std::endl;
+		ArchiveJob &job = *jobs.emplace_back(std::make_unique<ArchiveJob>(mpq, outputRoot, progress));
+		job.audioCodec = options.audioCodec;
+		job.verifyDecompression = options.verifyDecompression;
 	}
-	aggregator.processed = true;
+	ResolveOverlappingOutputs(jobs);
+	// Every entry is read when verifying the decompression, including the ones whose outputs would be linked.
+	if (!options.mpq && !options.verifyDecompression)
+		PlanLinkedOutputs(jobs);
+	return jobs;
 }
 
-void Process(const std::filesystem::path &mpq, const std::filesystem::path &outputRoot)
+// The stored (usually compressed) size of the item's entries, by which the items are balanced across the shards.
+uint64_t StoredSize(const WorkItem &item, const ArchiveJob &job)
 {
-	const std::filesystem::path srcExt = mpq.extension();
-	const bool isSaveFile = IsSaveFileExtension(srcExt);
+	if (item.group == nullptr)
+		return item.blockIndex != MpqReader::NoBlock ? job.reader->block(item.blockIndex).packedSize : 0;
+	uint64_t size = 0;
+	for (const std::string_view member : item.group->files) {
+		const std::optional<uint32_t> blockIndex = job.reader->findBlock(member);
+		if (blockIndex.has_value())
+			size += job.reader->block(*blockIndex).packedSize;
+	}
+	return size;
+}
 
-	const std::string srcName = SrcName(mpq);
-	const std::string destName = isSaveFile
-	    ? srcName + "_" + srcExt.string().substr(1)
-	    : DestName(srcName);
-	const std::filesystem::path outputDirectory = outputRoot / destName;
+// The shard of every item, indexed by job and then by item. The items of all the MPQs are balanced together.
+// Every process that plans the same MPQs with the same options gets the same result.
+std::vector<std::vector<unsigned>> PlanShards(std::span<const std::unique_ptr<ArchiveJob>> jobs, unsigned count)
+{
+	std::vector<ShardUnit> units;
+	for (const std::unique_ptr<ArchiveJob> &job : jobs) {
+		for (const WorkItem &item : job->items)
+			units.push_back(ShardUnit { job->destName + "/" + item.outputKey(), StoredSize(item, *job) });
+	}
+	const std::vector<unsigned> assignment = devilution_mpq_tools::AssignShards(units, count);
+	std::vector<std::vector<unsigned>> result;
+	result.reserve(jobs.size());
+	auto it = assignment.begin();
+	for (const std::unique_ptr<ArchiveJob> &job : jobs) {
+		const auto end = it + static_cast<std::ptrdiff_t>(job->items.size());
+		result.emplace_back(it, end);
+		it = end;
+	}
+	return result;
+}
 
-	std::clog << "Processing " << mpq << std::endl;
-	MpqArchive archive { mpq };
+// Drops the items of the other shards.
+void KeepShardItems(std::span<const std::unique_ptr<ArchiveJob>> jobs, const Shard &shard)
+{
+	const std::vector<std::vector<unsigned>> shards = PlanShards(jobs, shard.count);
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		ArchiveJob &job = *jobs[i];
+		std::vector<WorkItem> items;
+		for (size_t j = 0; j < job.items.size(); ++j) {
+			if (shards[i][j] == shard.index) {
+				items.push_back(job.items[j]);
+			} else {
+				job.numProcessed += job.items[j].size();
+			}
+		}
+		job.items = std::move(items);
+		job.numItemsRemaining = job.items.size();
+	}
+}
 
-	std::span<const char *const> mpqFiles = isSaveFile ? GetSaveMpqFiles()
-	                                                   : GetMpqFiles(srcName);
+void ProcessSaves(std::span<const SaveFile> saves, const std::filesystem::path &outputRoot,
+    const std::filesystem::path &outputFile, const OutputOptions &options, ThreadPool &pool)
+{
+	std::clog << "Unpacking " << saves.size() << " saves" << std::endl;
+	devilution_mpq_tools::SaveBatchOptions batchOptions;
+	batchOptions.outputRoot = outputRoot;
+	batchOptions.outputFile = outputFile;
+	batchOptions.compress = options.compress;
+	batchOptions.maxBytesInFlight = MaxOutputBytesInFlight;
+	devilution_mpq_tools::SaveBatchResult result;
+	const std::string error = devilution_mpq_tools::ConvertSaves(saves, batchOptions, pool, result);
+	if (!error.empty()) {
+		std::cerr << "Failed to unpack the saves: " << error << std::endl;
+		std::exit(1);
+	}
+	const double seconds = std::chrono::duration<double>(result.duration).count();
+	std::clog << "Unpacked " << result.numSaves << " saves (" << result.numFiles << " files, " << result.numBytes << " bytes) in "
+	          << seconds << " s: " << (seconds > 0 ? static_cast<double>(result.numSaves) / seconds : 0) << " saves/s" << std::endl;
+	if (result.errors.empty())
+		return;
+	for (const std::string &saveError : result.errors)
+		std::cerr << "Failed to unpack " << saveError << std::endl;
+	std::exit(1);
+}
 
-	std::vector<const char *> listfileEntries;
-	std::vector<uint8_t> listfileData;
-	if (mpqFiles.empty()) {
-		const size_t listfileSize = archive.readFile("(listfile)", listfileData, /*decrypt=*/false);
-		std::replace(listfileData.begin(), listfileData.end(), static_cast<uint8_t>('\r'), static_cast<uint8_t>('\0'));
-		std::replace(listfileData.begin(), listfileData.end(), static_cast<uint8_t>('\n'), static_cast<uint8_t>('\0'));
-		std::string_view listfileStr { reinterpret_cast<char *>(listfileData.data()), listfileSize };
-		while (!listfileStr.empty()) {
-			const std::string_view str = listfileStr.substr(0, listfileStr.find('\0'));
-			if (!str.empty())
-				listfileEntries.push_back(str.data());
-			listfileStr.remove_prefix(std::min(str.size() + 1, listfileStr.size()));
+// `stats` is null if stats are disabled.
+void Process(std::span<const std::filesystem::path> mpqs, const std::filesystem::path &outputRoot,
+    const OutputOptions &options, StatsCollector *stats, ThreadPool &pool)
+{
+	// The output MPQs are written from scratch, so the manifest does not apply to them.
+	// A shard keeps a manifest of its own, so that the shards do not write to the same file.
+	std::optional<Manifest> manifest;
+	std::optional<Manifest> mergedManifest;
+	if (!options.mpq) {
+		const bool ignoreExisting = options.force || options.verifyDecompression;
+		if (options.shard.has_value()) {
+			manifest.emplace(outputRoot, ignoreExisting, devilution_mpq_tools::ShardManifestFilename(*options.shard));
+			mergedManifest.emplace(outputRoot, ignoreExisting);
+		} else {
+			manifest.emplace(outputRoot, ignoreExisting);
 		}
-		mpqFiles = listfileEntries;
 	}
+	std::map<std::string, std::unique_ptr<MpqWriter>> mpqWriters;
+	OutputWriter fileWriter { MaxOutputBytesInFlight };
 
-	std::span<const char *const> excludedFiles = GetExcludedFiles(srcName);
-	std::unordered_set<std::string_view> excludedFilesMap { excludedFiles.begin(), excludedFiles.end() };
+	ProgressView progress;
+	const std::vector<std::unique_ptr<ArchiveJob>> jobs = PlanJobs(mpqs, outputRoot, options, progress);
+	if (options.mpq) {
+		for (const std::unique_ptr<ArchiveJob> &job : jobs) {
+			std::unique_ptr<MpqWriter> &writer = mpqWriters[job->destName];
+			if (writer == nullptr)
+				writer = CreateMpqWriter(outputRoot / (std::string(OutputMpqPrefix) + job->destName + ".mpq"), options.compress);
+			job->mpqWriter = writer.get();
+		}
+	}
+	if (options.shard.has_value()) {
+		KeepShardItems(jobs, *options.shard);
+		std::clog << "Shard " << devilution_mpq_tools::FormatShard(*options.shard) << std::endl;
+	}
+	progress.start();
 
-	ClxCommands clxCommands = ParseClxCommands(GetClxCommands(srcName));
+	for (const std::unique_ptr<ArchiveJob> &job : jobs) {
+		for (size_t i = 0; i < std::min(PrefetchDistance, job->items.size()); ++i)
+			PrefetchItem(job->items[i], *job);
+	}
 
-	std::vector<uint8_t> fileBuf;
-	std::vector<uint8_t> clxData;
-	size_t i = 0;
-	for (const char *const mpqPath : mpqFiles) {
-		std::string mpqPathWithForwardSlash { mpqPath };
-		std::replace(mpqPathWithForwardSlash.begin(), mpqPathWithForwardSlash.end(), '\\', '/');
-
-		const auto clxIt = clxCommands.per_file.find(mpqPathWithForwardSlash);
-		if (clxIt != clxCommands.per_file.end() && std::holds_alternative<ClxCombineAggregator *>(clxIt->second)) {
-			ClxCombineAggregator &aggregator = *std::get<ClxCombineAggregator *>(clxIt->second);
-			if (aggregator.processed)
+	std::vector<WorkerState> workers(pool.numWorkers());
+	for (unsigned i = 0; i < workers.size(); ++i) {
+		workers[i].index = i;
+		workers[i].archives.resize(jobs.size());
+	}
+	const RunContext run { manifest ? &*manifest : nullptr, mergedManifest ? &*mergedManifest : nullptr, stats, fileWriter, pool, workers };
+
+	// All the MPQs share a single queue. Interleave their items so that
+	// a small MPQ does not have to wait for a large one to finish.
+	bool submitted = true;
+	for (size_t i = 0; submitted; ++i) {
+		submitted = false;
+		for (size_t jobIndex = 0; jobIndex < jobs.size(); ++jobIndex) {
+			ArchiveJob &job = *jobs[jobIndex];
+			if (i == 0 && job.items.empty())
+				progress.finish(job.progressRow, "Done");
+			if (i >= job.items.size())
 				continue;
-			++i;
-			PrintStatus(std::string("Combining ") + mpqPath + " (" + std::to_string(aggregator.files.size()) + ")", i, mpqFiles.size());
-			ProcessAggregator(aggregator, archive, outputDirectory);
-			i += aggregator.files.size() - 1;
-			continue;
+			const WorkItem &item = job.items[i];
+			pool.submit([&item, jobIndex, &job, &run](unsigned workerIndex) {
+				ProcessWorkItem(item, jobIndex, job, run, run.workers[workerIndex]);
+			});
+			submitted = true;
 		}
+	}
+	pool.wait();
+	const std::string writeError = fileWriter.finish();
+	// The outputs that a shard links to can be in the other shards, so `MergeShards` links them instead.
+	if (manifest.has_value() && !options.shard.has_value())
+		LinkOutputs(jobs, outputRoot, *manifest);
+	size_t dedupSavedSize = 0;
+	for (const WorkerState &worker : workers)
+		dedupSavedSize += worker.output.dedupSavedSize;
+	if (dedupSavedSize != 0)
+		std::clog << "Identical CLX lists stored once: " << dedupSavedSize << " bytes saved" << std::endl;
+	if (manifest.has_value())
+		manifest->compact();
+	for (const auto &[destName, writer] : mpqWriters) {
+		const std::string error = writer->finish();
+		if (!error.empty()) {
+			std::cerr << "Failed to write the MPQ for " << destName << ": " << error << std::endl;
+			std::exit(1);
+		}
+	}
+	// The items whose outputs were written are kept in the manifest above, so only the others are converted again.
+	if (!writeError.empty()) {
+		std::cerr << "Failed to write the outputs: " << writeError << std::endl;
+		std::exit(1);
+	}
+}
 
-		++i;
-
-		if (excludedFilesMap.contains(mpqPathWithForwardSlash)) {
-			PrintStatus(std::string("Skipping ") + mpqPath, i, mpqFiles.size());
+// Checks that the shards of a `--shard` run converted all of their items from the same MPQs with the same options,
+// and that the outputs are all there. Then combines the shard manifests into the manifest of the output directory,
+// and links the outputs planned by `PlanLinkedOutputs`. Exits without changing anything if a shard is incomplete.
+//
+// The items that a shard left as up to date in the manifest of a previous merge are taken from there.
+void MergeShards(std::span<const std::filesystem::path> mpqs, const std::filesystem::path &outputRoot, const OutputOptions &options)
+{
+	std::vector<std::filesystem::path> shardPaths;
+	unsigned numShards = 0;
+	std::error_code ec;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(outputRoot, ec)) {
+		const std::optional<Shard> shard = devilution_mpq_tools::ParseShardManifestFilename(entry.path().filename().string());
+		if (!shard.has_value())
 			continue;
+		if (numShards != 0 && shard->count != numShards) {
+			std::cerr << "Found the manifests of both " << numShards << " and " << shard->count << " shards in " << outputRoot
+			          << ". Remove the ones of the stale run." << std::endl;
+			std::exit(1);
 		}
-		const size_t mpqFileSize = archive.readFile(mpqPath, fileBuf, /*decrypt=*/true, /*optional=*/isSaveFile);
-		if (isSaveFile && mpqFileSize == static_cast<size_t>(-1)) {
-			PrintStatus(std::string("Missing ") + mpqPath, i, mpqFiles.size());
-			continue;
+		numShards = shard->count;
+		shardPaths.resize(numShards);
+		shardPaths[shard->index] = entry.path();
+	}
+	if (ec) {
+		std::cerr << "Failed to list " << outputRoot << ": " << ec.message() << std::endl;
+		std::exit(1);
+	}
+	if (numShards == 0) {
+		std::cerr << "No shard manifests in " << outputRoot << std::endl;
+		std::exit(1);
+	}
+	std::vector<std::unique_ptr<Manifest>> shardManifests;
+	for (unsigned i = 0; i < numShards; ++i) {
+		const Shard shard { i, numShards };
+		if (shardPaths[i].empty()) {
+			std::cerr << "Missing the manifest of shard " << devilution_mpq_tools::FormatShard(shard) << " in " << outputRoot << std::endl;
+			std::exit(1);
 		}
+		shardManifests.push_back(std::make_unique<Manifest>(outputRoot, /*ignoreExisting=*/false,
+		    devilution_mpq_tools::ShardManifestFilename(shard)));
+	}
+	Manifest previous { outputRoot, /*ignoreExisting=*/false };
 
-		std::filesystem::path outputPath = outputDirectory / mpqPathWithForwardSlash;
+	ProgressView progress;
+	const std::vector<std::unique_ptr<ArchiveJob>> jobs = PlanJobs(mpqs, outputRoot, options, progress);
+	const std::vector<std::vector<unsigned>> shards = PlanShards(jobs, numShards);
 
-		if (clxIt != clxCommands.per_file.end()) {
-			const ClxCommand &clxCommand = std::get<ClxCommand>(clxIt->second);
-			PrintStatus(std::string("Converting ") + mpqPath + " to CLX", i, mpqFiles.size());
-			outputPath.replace_extension(".clx");
-			if (std::holds_alternative<Cl2ToClxCommand>(clxCommand)) {
-				const Cl2ToClxCommand &command = std::get<Cl2ToClxCommand>(clxCommand);
-				clxData.clear();
-				const std::optional<dvl_gfx::IoError> clxError = dvl_gfx::Cl2ToClx(
-				    fileBuf.data(), mpqFileSize, command.widths.data(), command.widths.size(), clxData);
-				if (clxError.has_value()) {
-					std::cerr << "Failed CL2->CLX conversion: " << clxError->message << " " << mpqPath << std::endl;
-					std::exit(1);
-				}
-				WriteOutput(outputPath, clxData.data(), clxData.size());
-			} else if (std::holds_alternative<CelToClxCommand>(clxCommand)) {
-				const CelToClxCommand &command = std::get<CelToClxCommand>(clxCommand);
-				clxData.clear();
-				const std::optional<dvl_gfx::IoError> clxError = dvl_gfx::CelToClx(
-				    fileBuf.data(), mpqFileSize, command.widths.data(), command.widths.size(), clxData);
-				if (clxError.has_value()) {
-					std::cerr << "Failed CL2->CLX conversion: " << clxError->message << " " << mpqPath << std::endl;
-					std::exit(1);
-				}
-				if (outputPath.filename() == "spelli2.clx" || outputPath.filename() == "spelicon.clx") {
-					std::vector<uint8_t> iconBackground;
-					std::vector<uint8_t> iconsWithoutBackground;
-					const std::string extractError = devilution_mpq_tools::ExtractSpellIcons(clxData, iconBackground, iconsWithoutBackground);
-					if (!extractError.empty()) {
-						std::cerr << "Failed to extract spell icons from " << mpqPath << ": " << extractError << std::endl;
-						std::exit(1);
-					}
-
-					const std::string stem = outputPath.stem().string();
-					WriteOutput(outputPath.replace_filename(stem + "_bg.clx"), iconBackground.data(), iconBackground.size());
-					WriteOutput(outputPath.replace_filename(stem + "_fg.clx"), iconsWithoutBackground.data(), iconsWithoutBackground.size());
-				} else {
-					WriteOutput(outputPath, clxData.data(), clxData.size());
-				}
-			} else if (std::holds_alternative<PcxToClxCommand>(clxCommand)) {
-				const PcxToClxCommand &command = std::get<PcxToClxCommand>(clxCommand);
-				clxData.clear();
-				std::array<uint8_t, 256 * 3> paletteData;
-				const std::optional<dvl_gfx::IoError> clxError = dvl_gfx::PcxToClx(
-				    fileBuf.data(), mpqFileSize, command.numFrames, command.transparentColor,
-				    /*cropWidths=*/ {}, clxData, command.exportPalette ? paletteData.data() : nullptr);
-				if (clxError.has_value()) {
-					std::cerr << "Failed CL2->CLX conversion: " << clxError->message << " " << mpqPath << std::endl;
-					std::exit(1);
-				}
-				WriteOutput(outputPath, clxData.data(), clxData.size());
-				if (command.exportPalette) {
-					outputPath.replace_extension(".pal");
-					WriteOutput(outputPath, paletteData.data(), paletteData.size());
-				}
+	struct MergedRecord {
+		std::string key;
+		uint64_t inputHash;
+		std::vector<ManifestOutput> outputs;
+	};
+	std::vector<MergedRecord> records;
+	std::vector<std::string> errors;
+	size_t numItems = 0;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		const ArchiveJob &job = *jobs[i];
+		numItems += job.items.size();
+		for (size_t j = 0; j < job.items.size(); ++j) {
+			std::string key = job.destName + "/" + job.items[j].outputKey();
+			const uint64_t inputHash = ComputeInputHash(job.items[j], job);
+			Manifest &shardManifest = *shardManifests[shards[i][j]];
+			Manifest *source = nullptr;
+			if (shardManifest.isUpToDate(key, inputHash)) {
+				source = &shardManifest;
+			} else if (previous.isUpToDate(key, inputHash)) {
+				source = &previous;
 			} else {
-				std::cerr << "Internal error" << std::endl;
-				std::exit(1);
+				errors.push_back(key + " (shard " + devilution_mpq_tools::FormatShard(Shard { shards[i][j], numShards }) + ")");
+				continue;
 			}
-		} else {
-			PrintStatus(std::string("Extracting ") + mpqPath, i, mpqFiles.size());
-			WriteOutput(outputPath, fileBuf.data(), mpqFileSize);
+			std::vector<ManifestOutput> outputs = *source->outputs(key);
+			records.push_back(MergedRecord { std::move(key), inputHash, std::move(outputs) });
 		}
+		// Keep the links that are still up to date, `LinkOutputs` makes the others.
+		for (const auto &[outputKey, inputHash] : job.linkedItems) {
+			std::string key = job.destName + "/" + outputKey;
+			if (previous.isUpToDate(key, inputHash))
+				records.push_back(MergedRecord { key, inputHash, *previous.outputs(key) });
+		}
+	}
+	if (!errors.empty()) {
+		constexpr size_t MaxErrorsShown = 20;
+		std::cerr << errors.size() << " of " << numItems << " items are missing or out of date:" << std::endl;
+		for (size_t i = 0; i < std::min(errors.size(), MaxErrorsShown); ++i)
+			std::cerr << "  " << errors[i] << std::endl;
+		if (errors.size() > MaxErrorsShown)
+			std::cerr << "  and " << (errors.size() - MaxErrorsShown) << " more" << std::endl;
+		std::cerr << "Re-run these shards with the same MPQs and options, and merge again." << std::endl;
+		std::exit(1);
 	}
-	PrintStatus("Done", mpqFiles.size(), mpqFiles.size());
-	std::clog << std::endl;
+
+	// `previous` is already loaded, so the merged manifest can replace its file.
+	Manifest merged { outputRoot, /*ignoreExisting=*/true };
+	for (MergedRecord &record : records)
+		merged.record(record.key, record.inputHash, std::move(record.outputs));
+	LinkOutputs(jobs, outputRoot, merged);
+	merged.compact();
+	// The merged manifest has all of their records, and the next sharded run can use a different number of shards.
+	for (const std::filesystem::path &path : shardPaths)
+		std::filesystem::remove(path, ec);
+	std::clog << "Merged " << numShards << " shards: " << numItems << " items" << std::endl;
 }
 
 } // namespace
@@ -647,8 +1300,15 @@ void Process(const std::filesystem::path &mpq, const std::filesystem::path &outp
 int main(int argc, char *argv[])
 {
 	bool mp3 = false;
+	bool merge = false;
+	OutputOptions outputOptions;
 	std::string outputRoot = ".";
+	const char *statsPath = nullptr;
+	const char *tracePath = nullptr;
+	unsigned jobs = std::max(std::thread::hardware_concurrency(), 1U);
 	std::vector<std::filesystem::path> mpqs;
+	std::vector<SaveFile> saves;
+	std::filesystem::path savesOutput;
 	for (int i = 1; i < argc; ++i) {
 		const std::string_view arg = argv[i];
 		if (arg == "-h" || arg == "--help") {
@@ -659,36 +1319,147 @@ int main(int argc, char *argv[])
 			mp3 = true;
 			std::cerr << "--mp3 option is not implemented yet." << std::endl;
 			std::exit(64);
+		} else if (arg == "--force") {
+			outputOptions.force = true;
+		} else if (arg == "--verify-decompression") {
+			outputOptions.verifyDecompression = true;
+		} else if (arg == "--output-mpq") {
+			outputOptions.mpq = true;
+		} else if (arg == "--no-compress") {
+			outputOptions.compress = false;
+		} else if (arg == "--merge") {
+			merge = true;
+		} else if (arg == "--shard") {
+			if (i + 1 == argc) {
+				std::cerr << "--shard requires an argument" << std::endl;
+				std::exit(64);
+			}
+			Shard shard;
+			const std::string error = devilution_mpq_tools::ParseShard(argv[++i], shard);
+			if (!error.empty()) {
+				std::cerr << "--shard: " << error << std::endl;
+				std::exit(64);
+			}
+			outputOptions.shard = shard;
+		} else if (arg == "--audio") {
+			if (i + 1 == argc) {
+				std::cerr << "--audio requires an argument" << std::endl;
+				std::exit(64);
+			}
+			const std::optional<AudioCodec> codec = devilution_mpq_tools::ParseAudioCodec(argv[++i]);
+			if (!codec.has_value()) {
+				std::cerr << "unknown audio codec: " << argv[i] << std::endl;
+				std::exit(64);
+			}
+			outputOptions.audioCodec = *codec;
 		} else if (arg == "--output-dir") {
 			if (i + 1 == argc) {
 				std::cerr << "--output-dir requires an argument" << std::endl;
 				std::exit(64);
 			}
 			outputRoot = argv[++i];
+		} else if (arg == "--stats" || arg == "--trace") {
+			if (i + 1 == argc) {
+				std::cerr << arg << " requires an argument" << std::endl;
+				std::exit(64);
+			}
+			if (arg == "--stats") {
+				statsPath = argv[++i];
+			} else {
+				tracePath = argv[++i];
+			}
+		} else if (arg == "--saves" || arg == "--saves-output") {
+			if (i + 1 == argc) {
+				std::cerr << arg << " requires an argument" << std::endl;
+				std::exit(64);
+			}
+			if (arg == "--saves-output") {
+				savesOutput = argv[++i];
+				continue;
+			}
+			const std::string error = devilution_mpq_tools::FindSaveFiles(argv[++i], saves);
+			if (!error.empty()) {
+				std::cerr << error << std::endl;
+				std::exit(1);
+			}
+		} else if (arg == "--jobs") {
+			if (i + 1 == argc) {
+				std::cerr << "--jobs requires an argument" << std::endl;
+				std::exit(64);
+			}
+			jobs = ParseInt<unsigned>(argv[++i], /*min=*/1);
 		} else if (!arg.empty() && arg[0] != '-') {
 			mpqs.emplace_back(arg);
 		} else {
 			std::cerr << "unknown argument: " << arg << std::endl;
 		}
 	}
+	if (!savesOutput.empty() && saves.empty()) {
+		std::cerr << "--saves-output requires --saves" << std::endl;
+		std::exit(64);
+	}
+	if (merge && outputOptions.shard.has_value()) {
+		std::cerr << "--merge and --shard can not be combined: run each shard, and then --merge" << std::endl;
+		std::exit(64);
+	}
+	if ((merge || outputOptions.shard.has_value()) && (outputOptions.mpq || !saves.empty())) {
+		std::cerr << "--shard and --merge only apply to converting MPQs into loose files, not to --output-mpq or --saves" << std::endl;
+		std::exit(64);
+	}
+	if (mpqs.empty() && !saves.empty() && (statsPath != nullptr || tracePath != nullptr)) {
+		std::cerr << "--stats and --trace only cover the MPQs, not --saves" << std::endl;
+		std::exit(64);
+	}
+	if (mpqs.empty() && !saves.empty()) {
+		ThreadPool pool { jobs };
+		ProcessSaves(saves, outputRoot, savesOutput, outputOptions, pool);
+		return 0;
+	}
 	if (mpqs.empty()) {
 		for (const std::filesystem::directory_entry &entry :
 		    std::filesystem::directory_iterator(std::filesystem::current_path(), std::filesystem::directory_options::skip_permission_denied)) {
 			if (!entry.is_regular_file())
 				continue;
 			const std::filesystem::path ext = entry.path().extension();
+			if (entry.path().filename().string().starts_with(OutputMpqPrefix))
+				continue;
 			if (ext == ".mpq" || ext == ".MPQ" || IsSaveFileExtension(ext)) {
 				mpqs.emplace_back(entry.path());
 			}
 		}
+		// The directory iteration order is unspecified.
+		// Sort for a deterministic resolution of overlapping outputs.
+		std::sort(mpqs.begin(), mpqs.end());
 	}
 	if (mpqs.empty()) {
 		std::cerr << "Error: No MPQs found in the current directory or in the command line\n\n";
 		PrintHelp();
 		std::exit(1);
 	}
-	for (const std::filesystem::path &mpq : mpqs) {
-		Process(mpq, outputRoot);
+	if (merge) {
+		MergeShards(mpqs, outputRoot, outputOptions);
+		return 0;
+	}
+	ThreadPool pool { jobs };
+	std::optional<StatsCollector> stats;
+	if (statsPath != nullptr || tracePath != nullptr)
+		stats.emplace();
+	Process(mpqs, outputRoot, outputOptions, stats ? &*stats : nullptr, pool);
+	if (!saves.empty())
+		ProcessSaves(saves, outputRoot, savesOutput, outputOptions, pool);
+	if (statsPath != nullptr) {
+		const std::string error = stats->writeReport(statsPath);
+		if (!error.empty()) {
+			std::cerr << "Failed to write the stats: " << error << std::endl;
+			std::exit(1);
+		}
+	}
+	if (tracePath != nullptr) {
+		const std::string error = stats->writeTrace(tracePath);
+		if (!error.empty()) {
+			std::cerr << "Failed to write the trace: " << error << std::endl;
+			std::exit(1);
+		}
 	}
 	return 0;
 }
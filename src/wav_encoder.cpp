@@ -0,0 +1,257 @@
+#include "wav_encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace devilution_mpq_tools {
+
+namespace {
+
+constexpr uint16_t WaveFormatPcm = 1;
+constexpr uint16_t WaveFormatImaAdpcm = 0x11;
+
+constexpr std::array<int16_t, 89> ImaStepTable {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+	11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+constexpr std::array<int8_t, 16> ImaIndexTable {
+	-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+uint16_t LoadLE16(const uint8_t *b)
+{
+	return static_cast<uint16_t>(b[0] | (b[1] << 8));
+}
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void AppendLE16(std::vector<uint8_t> &out, uint16_t val)
+{
+	out.push_back(static_cast<uint8_t>(val));
+	out.push_back(static_cast<uint8_t>(val >> 8));
+}
+
+void AppendLE32(std::vector<uint8_t> &out, uint32_t val)
+{
+	AppendLE16(out, static_cast<uint16_t>(val));
+	AppendLE16(out, static_cast<uint16_t>(val >> 16));
+}
+
+void AppendTag(std::vector<uint8_t> &out, const char (&tag)[5])
+{
+	out.insert(out.end(), tag, tag + 4);
+}
+
+struct PcmWav {
+	uint16_t channels;
+	uint32_t sampleRate;
+	uint16_t bitsPerSample;
+	std::span<const uint8_t> data;
+
+	[[nodiscard]] size_t numFrames() const
+	{
+		return data.size() / (static_cast<size_t>(channels) * (bitsPerSample / 8));
+	}
+
+	// The sample as 16-bit signed.
+	[[nodiscard]] int sample(size_t frame, unsigned channel) const
+	{
+		const size_t index = frame * channels + channel;
+		if (bitsPerSample == 8)
+			return (static_cast<int>(data[index]) - 128) * 256;
+		return static_cast<int16_t>(LoadLE16(&data[index * 2]));
+	}
+};
+
+// Returns an error message on failure. `format` is set to the WAV format tag,
+// and `wav` is only filled in for the PCM formats that can be re-encoded.
+std::string ParseWav(std::span<const uint8_t> file, uint16_t &format, std::optional<PcmWav> &wav)
+{
+	if (file.size() < 12 || std::memcmp(file.data(), "RIFF", 4) != 0 || std::memcmp(&file[8], "WAVE", 4) != 0)
+		return "not a RIFF WAVE file";
+	std::optional<PcmWav> fmt;
+	std::optional<std::span<const uint8_t>> data;
+	bool hasFormat = false;
+	size_t pos = 12;
+	while (file.size() - pos >= 8) {
+		const uint8_t *header = &file[pos];
+		pos += 8;
+		// Some of the original files have a data chunk size past the end of the file.
+		const size_t size = std::min<size_t>(LoadLE32(&header[4]), file.size() - pos);
+		const std::span<const uint8_t> chunk = file.subspan(pos, size);
+		if (std::memcmp(header, "fmt ", 4) == 0) {
+			if (chunk.size() < 16)
+				return "fmt chunk is truncated";
+			hasFormat = true;
+			format = LoadLE16(&chunk[0]);
+			fmt = PcmWav { LoadLE16(&chunk[2]), LoadLE32(&chunk[4]), LoadLE16(&chunk[14]), {} };
+		} else if (std::memcmp(header, "data", 4) == 0) {
+			data = chunk;
+		}
+		pos += std::min(size + (size & 1), file.size() - pos);
+	}
+	if (!hasFormat)
+		return "missing fmt chunk";
+	if (!data.has_value())
+		return "missing data chunk";
+	if (format == WaveFormatPcm && (fmt->channels == 1 || fmt->channels == 2)
+	    && (fmt->bitsPerSample == 8 || fmt->bitsPerSample == 16) && fmt->sampleRate != 0) {
+		wav = fmt;
+		wav->data = *data;
+	}
+	return "";
+}
+
+struct ImaAdpcmChannel {
+	int predictor = 0;
+	int index = 0;
+
+	// Encodes the sample and updates the state exactly as the decoder does, so that the errors do not accumulate.
+	uint8_t encode(int sample)
+	{
+		const int step = ImaStepTable[index];
+		int diff = sample - predictor;
+		uint8_t nibble = 0;
+		if (diff < 0) {
+			nibble = 8;
+			diff = -diff;
+		}
+		int delta = step >> 3;
+		if (diff >= step) {
+			nibble |= 4;
+			diff -= step;
+			delta += step;
+		}
+		if (diff >= step >> 1) {
+			nibble |= 2;
+			diff -= step >> 1;
+			delta += step >> 1;
+		}
+		if (diff >= step >> 2) {
+			nibble |= 1;
+			delta += step >> 2;
+		}
+		predictor = std::clamp((nibble & 8) != 0 ? predictor - delta : predictor + delta, -32768, 32767);
+		index = std::clamp(index + ImaIndexTable[nibble], 0, static_cast<int>(ImaStepTable.size() - 1));
+		return nibble;
+	}
+};
+
+// The usual block sizes for each sample rate: about 23 ms of audio per block.
+uint16_t ImaAdpcmBlockAlign(uint32_t sampleRate, uint16_t channels)
+{
+	if (sampleRate <= 11025)
+		return 256 * channels;
+	if (sampleRate <= 22050)
+		return 512 * channels;
+	return 1024 * channels;
+}
+
+void EncodeImaAdpcm(const PcmWav &wav, std::vector<uint8_t> &out)
+{
+	const uint16_t channels = wav.channels;
+	const uint16_t blockAlign = ImaAdpcmBlockAlign(wav.sampleRate, channels);
+	// A header per channel with the first sample, then 4 bits per sample.
+	const uint32_t samplesPerBlock = (blockAlign - 4 * channels) * 2 / channels + 1;
+	const size_t numFrames = wav.numFrames();
+	const size_t numBlocks = (numFrames + samplesPerBlock - 1) / samplesPerBlock;
+	const auto dataSize = static_cast<uint32_t>(numBlocks * blockAlign);
+
+	out.clear();
+	out.reserve(60 + dataSize);
+	AppendTag(out, "RIFF");
+	AppendLE32(out, 52 + dataSize);
+	AppendTag(out, "WAVE");
+	AppendTag(out, "fmt ");
+	AppendLE32(out, 20);
+	AppendLE16(out, WaveFormatImaAdpcm);
+	AppendLE16(out, channels);
+	AppendLE32(out, wav.sampleRate);
+	AppendLE32(out, static_cast<uint32_t>(static_cast<uint64_t>(wav.sampleRate) * blockAlign / samplesPerBlock));
+	AppendLE16(out, blockAlign);
+	AppendLE16(out, /*bitsPerSample=*/4);
+	AppendLE16(out, /*cbSize=*/2);
+	AppendLE16(out, static_cast<uint16_t>(samplesPerBlock));
+	AppendTag(out, "fact");
+	AppendLE32(out, 4);
+	AppendLE32(out, static_cast<uint32_t>(numFrames));
+	AppendTag(out, "data");
+	AppendLE32(out, dataSize);
+
+	// The last block is padded by repeating the last sample. The fact chunk has the actual length.
+	const auto sampleAt = [&](size_t frame, unsigned channel) {
+		return wav.sample(std::min(frame, numFrames - 1), channel);
+	};
+	std::array<ImaAdpcmChannel, 2> state;
+	for (size_t block = 0; block < numBlocks; ++block) {
+		const size_t firstFrame = block * samplesPerBlock;
+		for (unsigned c = 0; c < channels; ++c) {
+			const int sample = sampleAt(firstFrame, c);
+			state[c].predictor = sample;
+			AppendLE16(out, static_cast<uint16_t>(static_cast<int16_t>(sample)));
+			out.push_back(static_cast<uint8_t>(state[c].index));
+			out.push_back(0);
+		}
+		// The samples come in groups of 8 per channel, 2 per byte, low nibble first.
+		for (size_t frame = firstFrame + 1; frame < firstFrame + samplesPerBlock; frame += 8) {
+			for (unsigned c = 0; c < channels; ++c) {
+				for (size_t i = 0; i < 8; i += 2) {
+					const uint8_t low = state[c].encode(sampleAt(frame + i, c));
+					const uint8_t high = state[c].encode(sampleAt(frame + i + 1, c));
+					out.push_back(static_cast<uint8_t>(low | (high << 4)));
+				}
+			}
+		}
+	}
+}
+
+} // namespace
+
+std::optional<AudioCodec> ParseAudioCodec(std::string_view name)
+{
+	if (name == "copy")
+		return AudioCodec::Copy;
+	if (name == "ima-adpcm")
+		return AudioCodec::ImaAdpcm;
+	return std::nullopt;
+}
+
+std::string_view AudioCodecName(AudioCodec codec)
+{
+	switch (codec) {
+	case AudioCodec::Copy:
+		return "copy";
+	case AudioCodec::ImaAdpcm:
+		return "ima-adpcm";
+	}
+	return "unknown";
+}
+
+std::string EncodeWav(std::span<const uint8_t> wav, AudioCodec codec, std::vector<uint8_t> &out)
+{
+	out.clear();
+	if (codec == AudioCodec::Copy)
+		return "";
+	uint16_t format;
+	std::optional<PcmWav> pcm;
+	if (std::string error = ParseWav(wav, format, pcm); !error.empty())
+		return error;
+	if (!pcm.has_value() || pcm->numFrames() == 0)
+		return "";
+	EncodeImaAdpcm(*pcm, out);
+	if (out.size() >= wav.size())
+		out.clear();
+	return "";
+}
+
+} // namespace devilution_mpq_tools
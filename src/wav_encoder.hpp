@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "audio_codec.hpp"
+
+namespace devilution_mpq_tools {
+
+// The codec named `name` (as passed to `--audio`), or `std::nullopt` if there is none.
+std::optional<AudioCodec> ParseAudioCodec(std::string_view name);
+
+std::string_view AudioCodecName(AudioCodec codec);
+
+// Re-encodes a WAV file with `codec`. The output only depends on the input,
+// so that re-running the conversion produces the same bytes.
+//
+// `out` is left empty if the file is to be kept as is: it is not PCM (e.g. it is already IMA ADPCM),
+// or re-encoding it does not make it smaller.
+//
+// Returns an error message on failure.
+std::string EncodeWav(std::span<const uint8_t> wav, AudioCodec codec, std::vector<uint8_t> &out);
+
+} // namespace devilution_mpq_tools
@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "asset_library.hpp"
+#include "mpq_writer.hpp"
+
+namespace devilution_mpq_tools {
+namespace {
+
+std::vector<uint8_t> Contents(const std::string &text, size_t size)
+{
+	std::vector<uint8_t> result(size);
+	for (size_t i = 0; i < size; ++i)
+		result[i] = static_cast<uint8_t>(text[i % text.size()]);
+	return result;
+}
+
+class AssetLibraryTest : public ::testing::Test {
+protected:
+	void SetUp() override
+	{
+		dir_ = std::filesystem::temp_directory_path()
+		    / ("asset_library_test_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+		std::filesystem::remove_all(dir_);
+		std::filesystem::create_directories(dir_);
+	}
+
+	void TearDown() override
+	{
+		std::filesystem::remove_all(dir_);
+	}
+
+	// Writes an MPQ named `name` with the given files. The MPQs with names that the tools do not know
+	// have the priority of `DIABDAT.MPQ`, and their files are listed by their own `(listfile)` and extracted as is.
+	std::filesystem::path writeMpq(const std::string &name, const std::vector<std::pair<std::string, std::vector<uint8_t>>> &files)
+	{
+		const std::filesystem::path path = dir_ / name;
+		std::string error;
+		const std::unique_ptr<MpqWriter> writer = MpqWriter::create(path, /*compress=*/true, error);
+		EXPECT_NE(writer, nullptr) << error;
+		if (writer == nullptr)
+			return path;
+		for (const auto &[mpqPath, data] : files)
+			EXPECT_EQ(writer->addFile(mpqPath, data), "");
+		EXPECT_EQ(writer->finish(), "");
+		return path;
+	}
+
+	std::filesystem::path dir_;
+};
+
+TEST_F(AssetLibraryTest, Get)
+{
+	const std::vector<uint8_t> a = Contents("a", 1000);
+	const std::vector<uint8_t> b = Contents("bc", 5000);
+	AssetLibrary library;
+	ASSERT_EQ(library.openArchive(writeMpq("test.mpq", { { "data\\a.txt", a }, { "data\\b.bin", b } })), "");
+
+	EXPECT_TRUE(library.contains("data/a.txt"));
+	EXPECT_TRUE(library.contains("DATA\\B.BIN"));
+	EXPECT_FALSE(library.contains("data/c.txt"));
+
+	AssetLibrary::Asset asset;
+	ASSERT_EQ(library.get("data/a.txt", asset), "");
+	ASSERT_NE(asset, nullptr);
+	EXPECT_EQ(*asset, a);
+	ASSERT_EQ(library.get("Data\\B.bin", asset), "");
+	ASSERT_NE(asset, nullptr);
+	EXPECT_EQ(*asset, b);
+	EXPECT_EQ(library.cachedSize(), a.size() + b.size());
+
+	// A failure resets the asset of an earlier call.
+	EXPECT_NE(library.get("data/c.txt", asset), "");
+	EXPECT_EQ(asset, nullptr);
+}
+
+TEST_F(AssetLibraryTest, EvictsTheLeastRecentlyUsed)
+{
+	AssetLibrary library { AssetLibraryOptions { .cacheSize = 250 } };
+	ASSERT_EQ(library.openArchive(writeMpq("test.mpq", {
+	                                                       { "a", Contents("a", 100) },
+	                                                       { "b", Contents("b", 100) },
+	                                                       { "c", Contents("c", 100) },
+	                                                       { "big", Contents("d", 300) },
+	                                                   })),
+	    "");
+
+	AssetLibrary::Asset a;
+	AssetLibrary::Asset b;
+	AssetLibrary::Asset asset;
+	ASSERT_EQ(library.get("a", a), "");
+	ASSERT_EQ(library.get("b", b), "");
+	EXPECT_EQ(library.cachedSize(), 200U);
+
+	// Cached assets are returned as is.
+	ASSERT_EQ(library.get("a", asset), "");
+	EXPECT_EQ(asset, a);
+
+	// "b" is now the least recently used one, and makes room for "c".
+	ASSERT_EQ(library.get("c", asset), "");
+	EXPECT_EQ(library.cachedSize(), 200U);
+	ASSERT_EQ(library.get("a", asset), "");
+	EXPECT_EQ(asset, a);
+	ASSERT_EQ(library.get("b", asset), "");
+	EXPECT_NE(asset, b);
+	EXPECT_EQ(*asset, *b);
+	EXPECT_EQ(library.cachedSize(), 200U);
+
+	// Larger than the cache: converted on every request, and does not evict anything.
+	AssetLibrary::Asset big;
+	ASSERT_EQ(library.get("big", big), "");
+	EXPECT_EQ(big->size(), 300U);
+	ASSERT_EQ(library.get("big", asset), "");
+	EXPECT_NE(asset, big);
+	EXPECT_EQ(*asset, *big);
+	EXPECT_EQ(library.cachedSize(), 200U);
+}
+
+TEST_F(AssetLibraryTest, OverlayReplacesTheCachedAsset)
+{
+	const std::vector<uint8_t> base = Contents("base", 100);
+	const std::vector<uint8_t> overlay = Contents("overlay", 100);
+	const std::vector<uint8_t> other = Contents("other", 100);
+	AssetLibrary library;
+	ASSERT_EQ(library.openArchive(writeMpq("base.mpq", { { "shared.txt", base }, { "base.txt", other } })), "");
+
+	AssetLibrary::Asset before;
+	ASSERT_EQ(library.get("shared.txt", before), "");
+	EXPECT_EQ(*before, base);
+	ASSERT_EQ(library.get("base.txt", before), "");
+
+	// With equal priorities, the MPQ opened last wins, and its asset replaces the cached one.
+	ASSERT_EQ(library.openArchive(writeMpq("overlay.mpq", { { "shared.txt", overlay } })), "");
+	EXPECT_EQ(library.cachedSize(), other.size());
+	AssetLibrary::Asset asset;
+	ASSERT_EQ(library.get("shared.txt", asset), "");
+	EXPECT_EQ(*asset, overlay);
+	ASSERT_EQ(library.get("base.txt", asset), "");
+	EXPECT_EQ(asset, before);
+}
+
+TEST_F(AssetLibraryTest, OverlayKeepsTheHigherPriority)
+{
+	// A file that the listfile of hfvoice.mpq has and that is not excluded.
+	constexpr char Path[] = "sfx\\hellfire\\cowsut1.wav";
+	const std::vector<uint8_t> hellfire = Contents("hellfire", 100);
+	AssetLibrary library;
+	ASSERT_EQ(library.openArchive(writeMpq("hfvoice.mpq", { { Path, hellfire } })), "");
+	ASSERT_EQ(library.openArchive(writeMpq("test.mpq", { { Path, Contents("test", 100) } })), "");
+
+	AssetLibrary::Asset asset;
+	ASSERT_EQ(library.get(Path, asset), "");
+	EXPECT_EQ(*asset, hellfire);
+}
+
+TEST_F(AssetLibraryTest, ConcurrentGet)
+{
+	// Many more assets than fit in the cache, so that the threads keep converting and evicting them.
+	constexpr size_t NumFiles = 64;
+	constexpr size_t NumThreads = 8;
+	std::vector<std::pair<std::string, std::vector<uint8_t>>> files;
+	for (size_t i = 0; i < NumFiles; ++i)
+		files.emplace_back("file" + std::to_string(i), Contents(std::to_string(i), 1000 + i));
+	AssetLibrary library { AssetLibraryOptions { .cacheSize = 8000 } };
+	ASSERT_EQ(library.openArchive(writeMpq("test.mpq", files)), "");
+
+	std::vector<size_t> numMismatches(NumThreads);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < NumThreads; ++t) {
+		threads.emplace_back([&, t]() {
+			AssetLibrary::Asset asset;
+			for (size_t n = 0; n < 4 * NumFiles; ++n) {
+				const size_t i = (n * (2 * t + 1) + t) % NumFiles;
+				if (!library.get(files[i].first, asset).empty() || asset == nullptr || *asset != files[i].second)
+					++numMismatches[t];
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+
+	for (size_t t = 0; t < NumThreads; ++t)
+		EXPECT_EQ(numMismatches[t], 0U) << "thread " << t;
+	EXPECT_LE(library.cachedSize(), 8000U);
+}
+
+} // namespace
+} // namespace devilution_mpq_tools
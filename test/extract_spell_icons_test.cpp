@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "extract_spell_icons.hpp"
+
+namespace devilution_mpq_tools {
+namespace {
+
+constexpr uint8_t Transparent = 255;
+
+// Runs both implementations on a copy of `pixels` and expects the same result.
+void ExpectMatchesScalar(const std::vector<uint8_t> &pixels, const std::vector<uint8_t> &bg)
+{
+	std::vector<uint8_t> expected = pixels;
+	std::vector<uint8_t> actual = pixels;
+	RemoveBackgroundRowScalar(expected.data(), bg.data(), static_cast<unsigned>(pixels.size()));
+	RemoveBackgroundRow(actual.data(), bg.data(), static_cast<unsigned>(pixels.size()));
+	ASSERT_EQ(actual, expected);
+}
+
+TEST(RemoveBackgroundRowTest, Scalar)
+{
+	std::vector<uint8_t> pixels { 144, 100, 200, 200, 196, 197, 199, 192, 206, 207 };
+	const std::vector<uint8_t> bg { 0, 100, 203, 210, 202, 203, 205, 197, 200, 207 };
+	RemoveBackgroundRowScalar(pixels.data(), bg.data(), static_cast<unsigned>(pixels.size()));
+	const std::vector<uint8_t> expected {
+		Transparent, // The bright yellow is never part of an icon.
+		100,         // Not a background color.
+		Transparent, // Close to the background.
+		200,         // Far from the background.
+		Transparent, // 196 and 202 are the same background color.
+		197,         // 197 and 203 are not.
+		Transparent, // 199 and 205 are the same background color.
+		Transparent, // The lowest background color.
+		206,         // The highest background color, but 6 apart and not one of the pairs.
+		207,         // Out of the background range.
+	};
+	EXPECT_EQ(pixels, expected);
+}
+
+TEST(RemoveBackgroundRowTest, AllPairsMatchScalar)
+{
+	// Every (fg, bg) pair, in rows long enough to go through the vector loop.
+	std::vector<uint8_t> pixels(256);
+	std::vector<uint8_t> bg(256);
+	for (unsigned i = 0; i < 256; ++i) {
+		for (unsigned j = 0; j < 256; ++j) {
+			pixels[j] = static_cast<uint8_t>(j);
+			bg[j] = static_cast<uint8_t>(i + j);
+		}
+		ExpectMatchesScalar(pixels, bg);
+	}
+}
+
+TEST(RemoveBackgroundRowTest, IconRowsMatchScalar)
+{
+	// Rows like the ones of the spell icons: a noisy background with parts of an icon on top.
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<unsigned> bgColor(192, 206);
+	std::uniform_int_distribution<unsigned> iconColor(0, 255);
+	std::bernoulli_distribution isIcon(0.3);
+	for (const unsigned width : { 29U, 34U, 46U, 47U, 56U }) {
+		for (unsigned row = 0; row < 64; ++row) {
+			std::vector<uint8_t> pixels(width);
+			std::vector<uint8_t> bg(width);
+			for (unsigned x = 0; x < width; ++x) {
+				bg[x] = static_cast<uint8_t>(bgColor(rng));
+				pixels[x] = static_cast<uint8_t>(isIcon(rng) ? iconColor(rng) : bgColor(rng));
+			}
+			ExpectMatchesScalar(pixels, bg);
+		}
+	}
+}
+
+TEST(RemoveBackgroundRowTest, EdgeWidthsAndTail)
+{
+	// All the widths around the vector size, at every alignment.
+	// The pixels past the end of the row must be left untouched.
+	constexpr unsigned MaxWidth = 65;
+	constexpr unsigned MaxOffset = 16;
+	std::vector<uint8_t> pixels(MaxOffset + MaxWidth + 16);
+	std::vector<uint8_t> bg(pixels.size());
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = static_cast<uint8_t>(192 + i % 16);
+		bg[i] = static_cast<uint8_t>(194 + i % 13);
+	}
+	for (unsigned offset = 0; offset < MaxOffset; ++offset) {
+		for (unsigned width = 0; width <= MaxWidth; ++width) {
+			std::vector<uint8_t> expected = pixels;
+			std::vector<uint8_t> actual = pixels;
+			RemoveBackgroundRowScalar(&expected[offset], &bg[offset], width);
+			RemoveBackgroundRow(&actual[offset], &bg[offset], width);
+			ASSERT_EQ(actual, expected) << "offset " << offset << ", width " << width;
+		}
+	}
+}
+
+} // namespace
+} // namespace devilution_mpq_tools
@@ -0,0 +1,329 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <bzlib.h>
+#include <zlib.h>
+
+#include "mpq_decompress.hpp"
+#include "mpq_reader.hpp"
+
+namespace devilution_mpq_tools {
+namespace {
+
+// A PKWARE DCL implode encoder, written from the description of the format in Mark Adler's blast.c,
+// to test the decoder against.
+class Imploder {
+public:
+	Imploder(bool codedLiterals, unsigned dictionaryBits)
+	    : codedLiterals_(codedLiterals)
+	    , dictionaryBits_(dictionaryBits)
+	{
+		writeBits(codedLiterals ? 1 : 0, 8);
+		writeBits(dictionaryBits, 8);
+	}
+
+	void literal(uint8_t value)
+	{
+		writeBits(0, 1);
+		if (codedLiterals_) {
+			writeCode(LiteralCodes()[value]);
+		} else {
+			writeBits(value, 8);
+		}
+	}
+
+	// Copies `length` bytes from `distance` bytes back.
+	void match(unsigned length, unsigned distance)
+	{
+		writeBits(1, 1);
+		writeLength(length);
+		const unsigned lowBits = length == 2 ? 2 : dictionaryBits_;
+		writeCode(DistanceCodes()[(distance - 1) >> lowBits]);
+		writeBits((distance - 1) & ((1U << lowBits) - 1), lowBits);
+	}
+
+	std::vector<uint8_t> finish()
+	{
+		writeBits(1, 1);
+		writeLength(519);
+		if (numBits_ != 0)
+			out_.push_back(static_cast<uint8_t>(bits_));
+		return std::move(out_);
+	}
+
+private:
+	struct Code {
+		uint16_t bits;
+		uint8_t length;
+	};
+
+	// Builds the canonical codes from blast.c's compact code lengths.
+	template <size_t N>
+	static std::vector<Code> BuildCodes(const uint8_t (&compactLengths)[N])
+	{
+		std::vector<uint8_t> lengths;
+		for (const uint8_t b : compactLengths)
+			lengths.insert(lengths.end(), (b >> 4) + 1, b & 15);
+		std::array<unsigned, 16> counts {};
+		for (const uint8_t length : lengths)
+			++counts[length];
+		std::array<unsigned, 16> next {};
+		unsigned code = 0;
+		for (unsigned length = 1; length < 16; ++length) {
+			next[length] = code;
+			code = (code + counts[length]) << 1;
+		}
+		std::vector<Code> result;
+		for (const uint8_t length : lengths)
+			result.push_back(Code { static_cast<uint16_t>(next[length]++), length });
+		return result;
+	}
+
+	static const std::vector<Code> &LiteralCodes()
+	{
+		static const std::vector<Code> codes = BuildCodes({ 11, 124, 8, 7, 28, 7, 188, 13, 76, 4, 10, 8, 12, 10, 12, 10, 8, 23, 8,
+		    9, 7, 6, 7, 8, 7, 6, 55, 8, 23, 24, 12, 11, 7, 9, 11, 12, 6, 7, 22, 5,
+		    7, 24, 6, 11, 9, 6, 7, 22, 7, 11, 38, 7, 9, 8, 25, 11, 8, 11, 9, 12,
+		    8, 12, 5, 38, 5, 38, 5, 11, 7, 5, 6, 21, 6, 10, 53, 8, 7, 24, 10, 27,
+		    44, 253, 253, 253, 252, 252, 252, 13, 12, 45, 12, 45, 12, 61, 12, 45,
+		    44, 173 });
+		return codes;
+	}
+
+	static const std::vector<Code> &LengthCodes()
+	{
+		static const std::vector<Code> codes = BuildCodes({ 2, 35, 36, 53, 38, 23 });
+		return codes;
+	}
+
+	static const std::vector<Code> &DistanceCodes()
+	{
+		static const std::vector<Code> codes = BuildCodes({ 2, 20, 53, 230, 247, 151, 248 });
+		return codes;
+	}
+
+	void writeLength(unsigned length)
+	{
+		constexpr uint16_t Base[16] = { 3, 2, 4, 5, 6, 7, 8, 9, 10, 12, 16, 24, 40, 72, 136, 264 };
+		constexpr uint8_t ExtraBits[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+		for (unsigned symbol = 0; symbol < 16; ++symbol) {
+			if (length >= Base[symbol] && length < Base[symbol] + (1U << ExtraBits[symbol])) {
+				writeCode(LengthCodes()[symbol]);
+				writeBits(length - Base[symbol], ExtraBits[symbol]);
+				return;
+			}
+		}
+		FAIL() << "invalid length " << length;
+	}
+
+	// The codes are stored with their bits inverted, most significant bit first.
+	void writeCode(Code code)
+	{
+		for (unsigned i = code.length; i-- > 0;)
+			writeBits(((code.bits >> i) & 1) ^ 1, 1);
+	}
+
+	void writeBits(unsigned value, unsigned count)
+	{
+		for (unsigned i = 0; i < count; ++i) {
+			bits_ |= ((value >> i) & 1) << numBits_;
+			if (++numBits_ == 8) {
+				out_.push_back(static_cast<uint8_t>(bits_));
+				bits_ = 0;
+				numBits_ = 0;
+			}
+		}
+	}
+
+	bool codedLiterals_;
+	unsigned dictionaryBits_;
+	std::vector<uint8_t> out_;
+	unsigned bits_ = 0;
+	unsigned numBits_ = 0;
+};
+
+// Implodes `data` with the longest matches, skipping some of them so that literals follow repeats too.
+std::vector<uint8_t> Implode(std::span<const uint8_t> data, bool codedLiterals, unsigned dictionaryBits, std::mt19937 &rng)
+{
+	Imploder imploder { codedLiterals, dictionaryBits };
+	const size_t maxDistance = size_t { 64 } << dictionaryBits;
+	std::bernoulli_distribution tryMatch(0.7);
+	for (size_t i = 0; i < data.size();) {
+		size_t bestLength = 0;
+		size_t bestDistance = 0;
+		if (i > 0 && tryMatch(rng)) {
+			for (size_t distance = 1; distance <= std::min(i, maxDistance); ++distance) {
+				size_t length = 0;
+				while (i + length < data.size() && length < 518 && data[i + length - distance] == data[i + length])
+					++length;
+				// A match of 2 bytes only has 2 low bits of distance.
+				if (length == 2 && distance > 256)
+					continue;
+				if (length > bestLength) {
+					bestLength = length;
+					bestDistance = distance;
+				}
+			}
+		}
+		if (bestLength >= 2) {
+			imploder.match(static_cast<unsigned>(bestLength), static_cast<unsigned>(bestDistance));
+			i += bestLength;
+		} else {
+			imploder.literal(data[i]);
+			++i;
+		}
+	}
+	return imploder.finish();
+}
+
+// Random data with repeats of itself, from `alphabet`.
+std::vector<uint8_t> RepetitiveData(size_t size, std::span<const uint8_t> alphabet, std::mt19937 &rng)
+{
+	std::vector<uint8_t> data;
+	std::bernoulli_distribution repeat(0.3);
+	while (data.size() < size) {
+		if (!data.empty() && repeat(rng)) {
+			const size_t start = std::uniform_int_distribution<size_t>(0, data.size() - 1)(rng);
+			const size_t length = std::min(std::uniform_int_distribution<size_t>(1, 600)(rng), data.size() - start);
+			for (size_t i = 0; i < length; ++i)
+				data.push_back(data[start + i]);
+		} else {
+			data.push_back(alphabet[std::uniform_int_distribution<size_t>(0, alphabet.size() - 1)(rng)]);
+		}
+	}
+	data.resize(size);
+	return data;
+}
+
+TEST(PkwareExplodeTest, BlastReferenceVector)
+{
+	// The example from the comments of blast.c.
+	const std::vector<uint8_t> in { 0x00, 0x04, 0x82, 0x24, 0x25, 0x8f, 0x80, 0x7f };
+	std::string out(13, '\0');
+	const std::span<uint8_t> outBytes { reinterpret_cast<uint8_t *>(out.data()), out.size() };
+	EXPECT_EQ(PkwareExplode(in, outBytes), 13);
+	EXPECT_EQ(out, "AIAIAIAIAIAIA");
+}
+
+TEST(PkwareExplodeTest, RoundTrip)
+{
+	std::mt19937 rng(5);
+	std::vector<uint8_t> allBytes(256);
+	for (unsigned i = 0; i < 256; ++i)
+		allBytes[i] = static_cast<uint8_t>(i);
+	const std::vector<uint8_t> fewBytes { 'a', 'b', ' ', 0x00, 0xFF };
+	const std::array<const std::vector<uint8_t> *, 2> alphabets { &allBytes, &fewBytes };
+	for (const bool codedLiterals : { false, true }) {
+		for (const unsigned dictionaryBits : { 4U, 5U, 6U }) {
+			for (const size_t size : { size_t { 1 }, size_t { 300 }, size_t { 4096 } }) {
+				for (const std::vector<uint8_t> *alphabet : alphabets) {
+					const std::vector<uint8_t> data = RepetitiveData(size, *alphabet, rng);
+					const std::vector<uint8_t> imploded = Implode(data, codedLiterals, dictionaryBits, rng);
+					std::vector<uint8_t> out(data.size());
+					EXPECT_EQ(PkwareExplode(imploded, out), static_cast<int64_t>(data.size()));
+					EXPECT_EQ(out, data) << "coded literals " << codedLiterals << ", dictionary bits " << dictionaryBits
+					                     << ", size " << size << ", alphabet of " << alphabet->size();
+				}
+			}
+		}
+	}
+}
+
+TEST(PkwareExplodeTest, StopsAtTheEndOfTheOutput)
+{
+	std::mt19937 rng(7);
+	const std::vector<uint8_t> alphabet { 'x', 'y' };
+	const std::vector<uint8_t> data = RepetitiveData(1000, alphabet, rng);
+	const std::vector<uint8_t> imploded = Implode(data, false, 6, rng);
+	std::vector<uint8_t> out(500);
+	EXPECT_EQ(PkwareExplode(imploded, out), 500);
+	EXPECT_TRUE(std::equal(out.begin(), out.end(), data.begin()));
+}
+
+TEST(PkwareExplodeTest, RejectsBadHeaders)
+{
+	std::vector<uint8_t> out(16);
+	EXPECT_EQ(PkwareExplode(std::vector<uint8_t> { 0x00 }, out), -1);
+	EXPECT_EQ(PkwareExplode(std::vector<uint8_t> { 0x02, 0x04, 0x00 }, out), -1);
+	EXPECT_EQ(PkwareExplode(std::vector<uint8_t> { 0x00, 0x07, 0x00 }, out), -1);
+}
+
+TEST(MpqDecompressorTest, ImplodeSectors)
+{
+	std::mt19937 rng(11);
+	const std::vector<uint8_t> alphabet { 'a', 'b', 'c' };
+	const std::vector<uint8_t> data = RepetitiveData(4096, alphabet, rng);
+	const std::vector<uint8_t> imploded = Implode(data, true, 6, rng);
+	MpqDecompressor decompressor;
+	std::vector<uint8_t> out(data.size());
+	EXPECT_EQ(decompressor.decompress(imploded, out, MpqFileFlags::Implode), "");
+	EXPECT_EQ(out, data);
+
+	// The same stream as a multi-compressed sector.
+	std::vector<uint8_t> sector { MpqCompression::PkwareImplode };
+	sector.insert(sector.end(), imploded.begin(), imploded.end());
+	std::fill(out.begin(), out.end(), 0);
+	EXPECT_EQ(decompressor.decompress(sector, out, MpqFileFlags::Compress), "");
+	EXPECT_EQ(out, data);
+}
+
+TEST(MpqDecompressorTest, ZlibSectors)
+{
+	std::mt19937 rng(13);
+	std::vector<uint8_t> alphabet(256);
+	for (unsigned i = 0; i < 256; ++i)
+		alphabet[i] = static_cast<uint8_t>(i);
+	// Several sectors through the same decompressor, which reuses its inflate state.
+	MpqDecompressor decompressor;
+	for (const size_t size : { 1, 100, 4096, 4096, 513 }) {
+		const std::vector<uint8_t> data = RepetitiveData(size, alphabet, rng);
+		uLongf compressedSize = compressBound(static_cast<uLong>(data.size()));
+		std::vector<uint8_t> sector(1 + compressedSize);
+		sector[0] = MpqCompression::Zlib;
+		ASSERT_EQ(compress2(&sector[1], &compressedSize, data.data(), static_cast<uLong>(data.size()), Z_BEST_COMPRESSION), Z_OK);
+		sector.resize(1 + compressedSize);
+		std::vector<uint8_t> out(data.size());
+		EXPECT_EQ(decompressor.decompress(sector, out, MpqFileFlags::Compress), "");
+		EXPECT_EQ(out, data) << "size " << size;
+	}
+}
+
+TEST(MpqDecompressorTest, Bzip2Sectors)
+{
+	std::mt19937 rng(17);
+	const std::vector<uint8_t> alphabet { 0, 1, 2, 3, 'x', 'y', 'z' };
+	MpqDecompressor decompressor;
+	for (const size_t size : { 1, 4096, 700 }) {
+		const std::vector<uint8_t> data = RepetitiveData(size, alphabet, rng);
+		auto compressedSize = static_cast<unsigned>(data.size() + data.size() / 100 + 600);
+		std::vector<uint8_t> sector(1 + compressedSize);
+		sector[0] = MpqCompression::Bzip2;
+		ASSERT_EQ(BZ2_bzBuffToBuffCompress(reinterpret_cast<char *>(&sector[1]), &compressedSize,
+		              const_cast<char *>(reinterpret_cast<const char *>(data.data())), static_cast<unsigned>(data.size()),
+		              /*blockSize100k=*/9, /*verbosity=*/0, /*workFactor=*/0),
+		    BZ_OK);
+		sector.resize(1 + compressedSize);
+		std::vector<uint8_t> out(data.size());
+		EXPECT_EQ(decompressor.decompress(sector, out, MpqFileFlags::Compress), "");
+		EXPECT_EQ(out, data) << "size " << size;
+	}
+}
+
+TEST(MpqDecompressorTest, RejectsCorruptSectors)
+{
+	MpqDecompressor decompressor;
+	std::vector<uint8_t> out(64);
+	// A zlib sector that is not a zlib stream.
+	EXPECT_NE(decompressor.decompress(std::vector<uint8_t> { MpqCompression::Zlib, 0x12, 0x34, 0x56 }, out, MpqFileFlags::Compress), "");
+	// A compression method that does not exist.
+	EXPECT_NE(decompressor.decompress(std::vector<uint8_t> { 0x04, 0x00 }, out, MpqFileFlags::Compress), "");
+}
+
+} // namespace
+} // namespace devilution_mpq_tools
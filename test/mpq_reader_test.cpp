@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "mpq_crypt.hpp"
+#include "mpq_reader.hpp"
+#include "mpq_writer.hpp"
+
+namespace devilution_mpq_tools {
+namespace {
+
+constexpr char Path[] = "data\\file.bin";
+
+uint32_t LoadLE32(const uint8_t *b)
+{
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+	    | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void WriteLE32(uint8_t *out, uint32_t val)
+{
+	out[0] = static_cast<uint8_t>(val);
+	out[1] = static_cast<uint8_t>(val >> 8);
+	out[2] = static_cast<uint8_t>(val >> 16);
+	out[3] = static_cast<uint8_t>(val >> 24);
+}
+
+class MpqReaderTest : public ::testing::Test {
+protected:
+	void SetUp() override
+	{
+		path_ = std::filesystem::temp_directory_path()
+		    / ("mpq_reader_test_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()) + ".mpq");
+		std::string error;
+		const std::unique_ptr<MpqWriter> writer = MpqWriter::create(path_, /*compress=*/false, error);
+		ASSERT_NE(writer, nullptr) << error;
+		// Several sectors, stored as is.
+		data_.resize(10000);
+		for (size_t i = 0; i < data_.size(); ++i)
+			data_[i] = static_cast<uint8_t>(i * 7);
+		ASSERT_EQ(writer->addFile(Path, data_), "");
+		ASSERT_EQ(writer->finish(), "");
+		std::ifstream in { path_, std::ios::binary };
+		bytes_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	void TearDown() override
+	{
+		std::filesystem::remove(path_);
+	}
+
+	std::unique_ptr<MpqReader> open(std::string &error)
+	{
+		{
+			std::ofstream out { path_, std::ios::binary | std::ios::trunc };
+			out.write(reinterpret_cast<const char *>(bytes_.data()), static_cast<std::streamsize>(bytes_.size()));
+		}
+		return MpqReader::open(path_, error);
+	}
+
+	// Decrypts the block table, lets `patch` change the entry of `Path`, and encrypts it again.
+	void patchBlock(void (*patch)(uint8_t *entry))
+	{
+		std::string error;
+		const std::unique_ptr<MpqReader> reader = open(error);
+		ASSERT_NE(reader, nullptr) << error;
+		const std::optional<uint32_t> blockIndex = reader->findBlock(Path);
+		ASSERT_TRUE(blockIndex.has_value());
+		const uint32_t blockTablePos = LoadLE32(&bytes_[20]);
+		const uint32_t blockTableSize = LoadLE32(&bytes_[28]);
+		const std::span<uint8_t> blockTable { &bytes_[blockTablePos], blockTableSize * 16 };
+		const uint32_t key = MpqHashString("(block table)", MpqHashType::FileKey);
+		MpqDecryptBlock(blockTable, key);
+		patch(&blockTable[*blockIndex * 16]);
+		MpqEncryptBlock(blockTable, key);
+	}
+
+	std::filesystem::path path_;
+	std::vector<uint8_t> data_;
+	std::vector<uint8_t> bytes_;
+};
+
+TEST_F(MpqReaderTest, ReadsStoredFile)
+{
+	std::string error;
+	const std::unique_ptr<MpqReader> reader = open(error);
+	ASSERT_NE(reader, nullptr) << error;
+	const std::optional<uint32_t> blockIndex = reader->findBlock(Path);
+	ASSERT_TRUE(blockIndex.has_value());
+	EXPECT_GT(reader->numSectors(*blockIndex), 1U);
+	std::vector<uint8_t> out(data_.size());
+	MpqDecompressor decompressor;
+	ASSERT_EQ(reader->readBlock(*blockIndex, Path, /*decrypt=*/true, out.data(), decompressor, error), MpqReader::ReadResult::Ok) << error;
+	EXPECT_EQ(out, data_);
+}
+
+TEST_F(MpqReaderTest, RejectsLargeSectorSizeShift)
+{
+	// 16 would overflow a 32-bit sector size to 0, 32 and up are undefined.
+	for (const uint16_t shift : { 16, 23, 32, 0xFFFF }) {
+		bytes_[14] = static_cast<uint8_t>(shift);
+		bytes_[15] = static_cast<uint8_t>(shift >> 8);
+		std::string error;
+		EXPECT_EQ(open(error), nullptr) << "shift " << shift;
+		EXPECT_NE(error.find("sector size"), std::string::npos) << error;
+	}
+}
+
+TEST_F(MpqReaderTest, RejectsTruncatedStoredFile)
+{
+	// The unpacked size goes past the packed data, which is followed by the hash and block tables.
+	patchBlock([](uint8_t *entry) { WriteLE32(&entry[4], LoadLE32(&entry[8]) - 100); });
+	std::string error;
+	const std::unique_ptr<MpqReader> reader = open(error);
+	ASSERT_NE(reader, nullptr) << error;
+	const std::optional<uint32_t> blockIndex = reader->findBlock(Path);
+	ASSERT_TRUE(blockIndex.has_value());
+	std::vector<uint8_t> out(data_.size());
+	MpqDecompressor decompressor;
+	EXPECT_EQ(reader->readBlock(*blockIndex, Path, /*decrypt=*/true, out.data(), decompressor, error), MpqReader::ReadResult::Error);
+	EXPECT_EQ(error, "stored file is truncated");
+}
+
+} // namespace
+} // namespace devilution_mpq_tools
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "mpq_reader.hpp"
+#include "mpq_writer.hpp"
+
+namespace devilution_mpq_tools {
+namespace {
+
+class MpqWriterTest : public ::testing::Test {
+protected:
+	void SetUp() override
+	{
+		path_ = std::filesystem::temp_directory_path()
+		    / ("mpq_writer_test_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()) + ".mpq");
+	}
+
+	void TearDown() override
+	{
+		std::filesystem::remove(path_);
+	}
+
+	// Reads a file of the written MPQ, or `std::nullopt` if it is not there.
+	std::optional<std::vector<uint8_t>> read(const MpqReader &reader, std::string_view mpqPath)
+	{
+		const std::optional<uint32_t> blockIndex = reader.findBlock(mpqPath);
+		if (!blockIndex.has_value())
+			return std::nullopt;
+		std::vector<uint8_t> out(reader.block(*blockIndex).unpackedSize);
+		std::string error;
+		MpqDecompressor decompressor;
+		EXPECT_EQ(reader.readBlock(*blockIndex, mpqPath, /*decrypt=*/true, out.data(), decompressor, error), MpqReader::ReadResult::Ok) << error;
+		return out;
+	}
+
+	std::filesystem::path path_;
+};
+
+TEST_F(MpqWriterTest, RemoveFile)
+{
+	const std::vector<uint8_t> a(100, 'a');
+	const std::vector<uint8_t> b(200, 'b');
+	const std::vector<uint8_t> c(300, 'c');
+	std::string error;
+	const std::unique_ptr<MpqWriter> writer = MpqWriter::create(path_, /*compress=*/false, error);
+	ASSERT_NE(writer, nullptr) << error;
+	ASSERT_EQ(writer->addFile("dir\\a", a), "");
+	ASSERT_EQ(writer->addFile("dir\\b", b), "");
+	ASSERT_EQ(writer->addFile("dir\\c", c), "");
+	// Case-insensitive, and with either separator.
+	writer->removeFile("DIR/A");
+	writer->removeFile("dir\\missing");
+	// Replaces the file that took the place of the removed one.
+	ASSERT_EQ(writer->addFile("dir\\c", b), "");
+	ASSERT_EQ(writer->finish(), "");
+
+	const std::unique_ptr<MpqReader> reader = MpqReader::open(path_, error);
+	ASSERT_NE(reader, nullptr) << error;
+	EXPECT_EQ(read(*reader, "dir\\a"), std::nullopt);
+	EXPECT_EQ(read(*reader, "dir\\b"), b);
+	EXPECT_EQ(read(*reader, "dir\\c"), b);
+	const std::optional<std::vector<uint8_t>> listfile = read(*reader, "(listfile)");
+	ASSERT_TRUE(listfile.has_value());
+	EXPECT_EQ(std::string(listfile->begin(), listfile->end()).find("dir\\a"), std::string::npos);
+}
+
+} // namespace
+} // namespace devilution_mpq_tools